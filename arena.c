@@ -0,0 +1,85 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*!
+ * @brief init_arena initializes an empty arena
+ * @param arena is a pointer to the arena
+ */
+void init_arena(arena_t *arena) {
+    arena->blocks = NULL;
+    arena->is_region = false;
+}
+
+/*!
+ * @brief init_arena_region initializes an empty arena in a region of memory which it does not own
+ * Allocations fail once the region is full, and clearing the arena only empties it. The state of the arena is
+ * kept at the start of the region: when the region is shared, other processes see what has been allocated.
+ * @param arena is a pointer to the arena
+ * @param memory is the region, aligned on ARENA_ALIGNMENT bytes
+ * @param size is the size of the region
+ */
+void init_arena_region(arena_t *arena, void *memory, size_t size) {
+    arena->blocks = (arena_block_t *) memory;
+    arena->blocks->next = NULL;
+    arena->blocks->capacity = size - sizeof(arena_block_t);
+    arena->blocks->used = 0;
+    arena->is_region = true;
+}
+
+/*!
+ * @brief arena_alloc allocates memory from an arena
+ * Allocations are cut from the current block, a new block being added when it is full. They cannot be released
+ * one by one.
+ * @param arena is a pointer to the arena
+ * @param size is the size to allocate
+ * @return a pointer to the memory, aligned on ARENA_ALIGNMENT bytes, NULL if memory is exhausted
+ */
+void *arena_alloc(arena_t *arena, size_t size) {
+    size = (size + ARENA_ALIGNMENT - 1) & ~((size_t) ARENA_ALIGNMENT - 1);
+
+    arena_block_t *block = arena->blocks;
+    if (arena->is_region && block->capacity - block->used < size) {
+        return NULL;
+    }
+    if (block == NULL || block->capacity - block->used < size) {
+        size_t capacity = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        arena_block_t *new_block = malloc(sizeof(arena_block_t) + capacity);
+        if (new_block == NULL) {
+            return NULL;
+        }
+        new_block->capacity = capacity;
+        new_block->used = 0;
+
+        // Un bloc dédié à une grande allocation ne remplace pas le bloc courant, qui peut encore servir
+        if (block != NULL && capacity > ARENA_BLOCK_SIZE) {
+            new_block->next = block->next;
+            block->next = new_block;
+            new_block->used = size;
+            return new_block->data;
+        }
+        new_block->next = block;
+        arena->blocks = new_block;
+        block = new_block;
+    }
+
+    void *memory = block->data + block->used;
+    block->used += size;
+    return memory;
+}
+
+/*!
+ * @brief clear_arena releases all the allocations of an arena at once
+ * @param arena is a pointer to the arena, which is empty afterwards
+ */
+void clear_arena(arena_t *arena) {
+    if (arena->is_region) {
+        arena->blocks->used = 0;
+        return;
+    }
+    while (arena->blocks != NULL) {
+        arena_block_t *block = arena->blocks;
+        arena->blocks = block->next;
+        free(block);
+    }
+}
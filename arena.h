@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Size of the blocks of an arena, larger allocations get a block of their own
+#define ARENA_BLOCK_SIZE (1024 * 1024)
+// Alignment of the allocations of an arena
+#define ARENA_ALIGNMENT 16
+
+// A block of memory of an arena, allocated at once and cut into pieces
+typedef struct _arena_block {
+    struct _arena_block *next;
+    size_t capacity;
+    size_t used;
+    _Alignas(ARENA_ALIGNMENT) uint8_t data[];
+} arena_block_t;
+
+// Allocator whose allocations are all released together (@see clear_arena)
+typedef struct {
+    arena_block_t *blocks; // The current block first
+    bool is_region; // Set to true when the arena is a single region given by its owner (@see init_arena_region)
+} arena_t;
+
+void init_arena(arena_t *arena);
+void init_arena_region(arena_t *arena, void *memory, size_t size);
+void *arena_alloc(arena_t *arena, size_t size);
+void clear_arena(arena_t *arena);
@@ -0,0 +1,424 @@
+#include "checkpoint.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "file-properties.h"
+
+// Checkpoint of the running synchronization, its journal is -1 when there is none
+static checkpoint_t checkpoint = {.journal = -1};
+
+/*!
+ * @brief checkpoint_slot gives the first slot to probe for a path
+ * @param path is the path of the record
+ * @param capacity is the capacity of the table (a power of 2)
+ * @return the index of the slot
+ */
+static size_t checkpoint_slot(char *path, size_t capacity) {
+    uint64_t hash = 0xCBF29CE484222325ULL; // FNV-1a
+    for (unsigned char *c = (unsigned char *) path; *c != '\0'; c++) {
+        hash = (hash ^ *c) * 0x100000001B3ULL;
+    }
+    return hash & (capacity - 1);
+}
+
+/*!
+ * @brief find_checkpoint_record looks up the records of a path
+ * @param path is the path to find
+ * @return a pointer to the records of the path, NULL if it has none
+ */
+static checkpoint_record_t *find_checkpoint_record(char *path) {
+    if (checkpoint.count == 0) {
+        return NULL;
+    }
+
+    for (size_t slot = checkpoint_slot(path, checkpoint.capacity); checkpoint.slots[slot].path != NULL;
+         slot = (slot + 1) & (checkpoint.capacity - 1)) {
+        if (strcmp(checkpoint.slots[slot].path, path) == 0) {
+            return &checkpoint.slots[slot];
+        }
+    }
+    return NULL;
+}
+
+/*!
+ * @brief add_checkpoint_record gives the records of a path, creating them if needed
+ * @param path is the path of the records
+ * @return a pointer to the records, NULL if memory is exhausted
+ */
+static checkpoint_record_t *add_checkpoint_record(char *path) {
+    checkpoint_record_t *record = find_checkpoint_record(path);
+    if (record != NULL) {
+        return record;
+    }
+
+    // Agrandissement de la table au-delà de 70% de remplissage
+    if ((checkpoint.count + 1) * 10 > checkpoint.capacity * 7) {
+        size_t capacity = checkpoint.capacity == 0 ? 1024 : checkpoint.capacity * 2;
+        checkpoint_record_t *slots = calloc(capacity, sizeof(checkpoint_record_t));
+        if (slots == NULL) {
+            return NULL;
+        }
+        for (size_t i = 0; i < checkpoint.capacity; i++) {
+            if (checkpoint.slots[i].path != NULL) {
+                size_t slot = checkpoint_slot(checkpoint.slots[i].path, capacity);
+                while (slots[slot].path != NULL) {
+                    slot = (slot + 1) & (capacity - 1);
+                }
+                slots[slot] = checkpoint.slots[i];
+            }
+        }
+        free(checkpoint.slots);
+        checkpoint.slots = slots;
+        checkpoint.capacity = capacity;
+    }
+
+    size_t slot = checkpoint_slot(path, checkpoint.capacity);
+    while (checkpoint.slots[slot].path != NULL) {
+        slot = (slot + 1) & (checkpoint.capacity - 1);
+    }
+    record = &checkpoint.slots[slot];
+    record->path = strdup(path);
+    if (record->path == NULL) {
+        return NULL;
+    }
+    checkpoint.count++;
+    return record;
+}
+
+/*!
+ * @brief load_chunk_digest adds a chunk digest to the records of a path
+ * The chunk digests of a previous version of the file are dropped.
+ * @param record is the records of the path
+ * @param state is the chunk record, whose offset is the index of the chunk
+ */
+static void load_chunk_digest(checkpoint_record_t *record, checkpoint_state_t *state) {
+    uint64_t chunks_count = tree_hash_chunks_count(state->size);
+    if (state->offset < 0 || (uint64_t) state->offset >= chunks_count) {
+        return;
+    }
+
+    checkpoint_state_t *chunks = &record->chunks;
+    if (!chunks->is_set || chunks->size != state->size || chunks->inode != state->inode
+        || chunks->mtime.tv_sec != state->mtime.tv_sec || chunks->mtime.tv_nsec != state->mtime.tv_nsec) {
+        free(record->chunk_digests);
+        free(record->has_chunk_digest);
+        record->chunk_digests = malloc(chunks_count * 16);
+        record->has_chunk_digest = calloc(chunks_count, sizeof(bool));
+        if (record->chunk_digests == NULL || record->has_chunk_digest == NULL) {
+            free(record->chunk_digests);
+            free(record->has_chunk_digest);
+            record->chunk_digests = NULL;
+            record->has_chunk_digest = NULL;
+            chunks->is_set = false;
+            return;
+        }
+        *chunks = *state;
+    }
+
+    memcpy(record->chunk_digests[state->offset], state->md5sum, 16);
+    record->has_chunk_digest[state->offset] = true;
+}
+
+/*!
+ * @brief load_checkpoint reads the records of an interrupted synchronization
+ * A line is only taken into account when it is complete: the journal may have been cut by the interruption.
+ * @param journal is the checkpoint journal, opened for reading
+ */
+static void load_checkpoint(FILE *journal) {
+    char *line = NULL;
+    size_t line_capacity = 0;
+    ssize_t line_length;
+
+    while ((line_length = getline(&line, &line_capacity, journal)) != -1) {
+        if (line_length == 0 || line[line_length - 1] != '\n') {
+            break;
+        }
+        line[line_length - 1] = '\0';
+
+        char kind;
+        checkpoint_state_t state;
+        memset(&state, 0, sizeof(state));
+        unsigned long long size, inode;
+        long long mtime_sec, offset;
+        long mtime_nsec;
+        char md5_hex[33];
+        int path_start = 0;
+        if (sscanf(line, "%c %llu %lld %ld %llu %32s %lld %n", &kind, &size, &mtime_sec, &mtime_nsec, &inode, md5_hex,
+                   &offset, &path_start) != 7 || path_start == 0 || strlen(md5_hex) != 32) {
+            continue;
+        }
+        for (int i = 0; i < 16; i++) {
+            unsigned int byte;
+            sscanf(md5_hex + 2 * i, "%2x", &byte);
+            state.md5sum[i] = byte;
+        }
+        state.is_set = true;
+        state.size = size;
+        state.mtime.tv_sec = mtime_sec;
+        state.mtime.tv_nsec = mtime_nsec;
+        state.inode = inode;
+        state.offset = offset;
+
+        checkpoint_record_t *record = add_checkpoint_record(line + path_start);
+        if (record == NULL) {
+            break;
+        }
+        if (kind == CHECKPOINT_DIGEST) {
+            record->digest = state;
+        } else if (kind == CHECKPOINT_COPY) {
+            record->copy = state;
+        } else if (kind == CHECKPOINT_PROGRESS) {
+            record->progress = state;
+        } else if (kind == CHECKPOINT_CHUNK) {
+            load_chunk_digest(record, &state);
+        }
+    }
+
+    free(line);
+}
+
+/*!
+ * @brief read_checkpoint loads the records of the interrupted synchronization of a destination
+ * @param root is the destination directory
+ * @return the number of paths with records
+ */
+size_t read_checkpoint(char *root) {
+    char path[PATH_SIZE];
+    if (snprintf(path, sizeof(path), "%s/%s", root, CHECKPOINT_FILE_NAME) >= PATH_SIZE) {
+        return 0;
+    }
+
+    FILE *journal = fopen(path, "r");
+    if (journal != NULL) {
+        load_checkpoint(journal);
+        fclose(journal);
+    }
+    return checkpoint.count;
+}
+
+/*!
+ * @brief clear_checkpoint_records releases the records loaded by read_checkpoint
+ */
+void clear_checkpoint_records() {
+    for (size_t i = 0; i < checkpoint.capacity; i++) {
+        free(checkpoint.slots[i].path);
+        free(checkpoint.slots[i].chunk_digests);
+        free(checkpoint.slots[i].has_chunk_digest);
+    }
+    free(checkpoint.slots);
+    checkpoint.slots = NULL;
+    checkpoint.capacity = 0;
+    checkpoint.count = 0;
+}
+
+/*!
+ * @brief open_checkpoint starts the checkpoint journal of a synchronization, in the destination directory
+ * With --resume, the records of the interrupted synchronization are loaded first and the journal is continued,
+ * else it is started over.
+ * @param the_config is a pointer to the configuration
+ * @return 0 in case of success, -1 else (the synchronization then runs without checkpoint)
+ */
+int open_checkpoint(configuration_t *the_config) {
+    if (snprintf(checkpoint.path, sizeof(checkpoint.path), "%s/%s", the_config->destination, CHECKPOINT_FILE_NAME) >= PATH_SIZE) {
+        return -1;
+    }
+
+    if (the_config->resume) {
+        size_t count = read_checkpoint(the_config->destination);
+        if (the_config->verbose == true) {
+            printf("Reprise avec %zu fichiers du point de reprise\n", count);
+        }
+    }
+
+    checkpoint.journal = open(checkpoint.path, O_WRONLY | O_CREAT | O_APPEND | (the_config->resume ? 0 : O_TRUNC), 0600);
+    if (checkpoint.journal == -1) {
+        perror("Erreur lors de la création du point de reprise");
+        return -1;
+    }
+    checkpoint.last_sync = time(NULL);
+    return 0;
+}
+
+/*!
+ * @brief attach_checkpoint continues the checkpoint journal opened by the main process, from a lister process
+ * Nothing is done when the synchronization has no journal.
+ * @param root is the destination directory
+ * @return 0 in case of success, -1 else
+ */
+int attach_checkpoint(char *root) {
+    if (snprintf(checkpoint.path, sizeof(checkpoint.path), "%s/%s", root, CHECKPOINT_FILE_NAME) >= PATH_SIZE) {
+        return -1;
+    }
+
+    checkpoint.journal = open(checkpoint.path, O_WRONLY | O_APPEND);
+    checkpoint.last_sync = time(NULL);
+    return checkpoint.journal == -1 ? -1 : 0;
+}
+
+/*!
+ * @brief close_checkpoint ends the checkpoint journal
+ * @param is_complete is true when the synchronization succeeded: the journal is then removed,
+ * else it is kept for a --resume
+ */
+void close_checkpoint(bool is_complete) {
+    if (checkpoint.journal != -1) {
+        if (!is_complete) {
+            fdatasync(checkpoint.journal);
+        }
+        close(checkpoint.journal);
+        checkpoint.journal = -1;
+        if (is_complete && unlink(checkpoint.path) == -1 && errno != ENOENT) {
+            perror("Erreur lors de la suppression du point de reprise");
+        }
+    }
+
+    clear_checkpoint_records();
+}
+
+/*!
+ * @brief is_checkpoint_open tells if the running synchronization has a checkpoint journal
+ * @return true if it has one
+ */
+bool is_checkpoint_open() {
+    return checkpoint.journal != -1;
+}
+
+/*!
+ * @brief append_checkpoint writes a record to the journal, which is synced every CHECKPOINT_INTERVAL seconds
+ * Each record is written by a single write in append mode, so that the lister processes and the hashing threads
+ * can record at the same time.
+ * @param kind is the kind of the record
+ * @param entry is the entry whose properties are recorded
+ * @param md5sum is the MD5 sum recorded
+ * @param offset is the offset recorded (the offset of a progress record, the index of a chunk record)
+ */
+static void append_checkpoint(checkpoint_kind_t kind, files_list_entry_t *entry, uint8_t *md5sum, off_t offset) {
+    if (checkpoint.journal == -1 || strchr(entry->path_and_name, '\n') != NULL) {
+        return;
+    }
+
+    char md5_hex[33];
+    for (int i = 0; i < 16; i++) {
+        sprintf(md5_hex + 2 * i, "%02x", md5sum[i]);
+    }
+    char line[PATH_SIZE + 160];
+    int length = snprintf(line, sizeof(line), "%c %llu %lld %ld %llu %s %lld %s\n", kind, (unsigned long long) entry->size,
+                          (long long) entry->mtime.tv_sec, entry->mtime.tv_nsec, (unsigned long long) entry->inode, md5_hex,
+                          (long long) offset, entry->path_and_name);
+    if (length < 0 || (size_t) length >= sizeof(line) || write(checkpoint.journal, line, length) != length) {
+        return;
+    }
+
+    time_t now = time(NULL);
+    if (now - checkpoint.last_sync >= CHECKPOINT_INTERVAL) {
+        checkpoint.last_sync = now;
+        fdatasync(checkpoint.journal);
+    }
+}
+
+/*!
+ * @brief is_same_file tells if an entry still has the properties of a record
+ * @param state is the recorded state
+ * @param entry is the entry, with its current stats
+ * @return true if the size, mtime and inode are unchanged
+ */
+static bool is_same_file(checkpoint_state_t *state, files_list_entry_t *entry) {
+    return state->is_set && state->size == entry->size && state->inode == entry->inode
+           && state->mtime.tv_sec == entry->mtime.tv_sec && state->mtime.tv_nsec == entry->mtime.tv_nsec;
+}
+
+/*!
+ * @brief find_checkpoint_digest gets the MD5 sum of a file from the resumed synchronization
+ * @param entry is the entry, with its current stats
+ * @return 0 if its MD5 sum was recorded and the file did not change since, -1 else
+ */
+int find_checkpoint_digest(files_list_entry_t *entry) {
+    checkpoint_record_t *record = find_checkpoint_record(entry->path_and_name);
+    if (record == NULL || !is_same_file(&record->digest, entry)) {
+        return -1;
+    }
+
+    memcpy(entry->md5sum, record->digest.md5sum, sizeof(entry->md5sum));
+    return 0;
+}
+
+/*!
+ * @brief checkpoint_digest records the MD5 sum of a file which has just been computed
+ * @param entry is the entry
+ */
+void checkpoint_digest(files_list_entry_t *entry) {
+    append_checkpoint(CHECKPOINT_DIGEST, entry, entry->md5sum, 0);
+}
+
+/*!
+ * @brief is_copy_checkpointed tells if a source file was written to the destination by the resumed synchronization
+ * The caller must still check that the destination file is there.
+ * @param source_entry is the source entry
+ * @return true if the file was written, and did not change since
+ */
+bool is_copy_checkpointed(files_list_entry_t *source_entry) {
+    checkpoint_record_t *record = find_checkpoint_record(source_entry->path_and_name);
+    return record != NULL && is_same_file(&record->copy, source_entry)
+           && memcmp(record->copy.md5sum, source_entry->md5sum, sizeof(source_entry->md5sum)) == 0;
+}
+
+/*!
+ * @brief checkpoint_copy records that a source file was written to the destination
+ * @param source_entry is the source entry
+ */
+void checkpoint_copy(files_list_entry_t *source_entry) {
+    append_checkpoint(CHECKPOINT_COPY, source_entry, source_entry->md5sum, 0);
+}
+
+/*!
+ * @brief find_copy_progress gives the size of the temporary file of an interrupted copy which is known to be on disk
+ * @param source_entry is the source entry being copied
+ * @return the offset where the copy can be resumed, 0 to copy the whole file
+ */
+off_t find_copy_progress(files_list_entry_t *source_entry) {
+    checkpoint_record_t *record = find_checkpoint_record(source_entry->path_and_name);
+    if (record == NULL || !is_same_file(&record->progress, source_entry)) {
+        return 0;
+    }
+    return record->progress.offset;
+}
+
+/*!
+ * @brief checkpoint_copy_progress records the progress of the copy of a large file
+ * It must be called once the temporary file has been synced up to the offset.
+ * @param source_entry is the source entry being copied
+ * @param offset is the size of the temporary file synced to disk
+ */
+void checkpoint_copy_progress(files_list_entry_t *source_entry, off_t offset) {
+    append_checkpoint(CHECKPOINT_PROGRESS, source_entry, source_entry->md5sum, offset);
+}
+
+/*!
+ * @brief find_checkpoint_chunk gets the MD5 sum of a chunk of a file digested as a tree, from the resumed synchronization
+ * @param entry is the entry, with its current stats
+ * @param chunk_index is the index of the chunk
+ * @param md5sum receives the MD5 sum of the chunk
+ * @return 0 if the chunk digest was recorded and the file did not change since, -1 else
+ */
+int find_checkpoint_chunk(files_list_entry_t *entry, uint64_t chunk_index, uint8_t *md5sum) {
+    checkpoint_record_t *record = find_checkpoint_record(entry->path_and_name);
+    if (record == NULL || record->has_chunk_digest == NULL || !is_same_file(&record->chunks, entry)
+        || chunk_index >= tree_hash_chunks_count(entry->size) || !record->has_chunk_digest[chunk_index]) {
+        return -1;
+    }
+
+    memcpy(md5sum, record->chunk_digests[chunk_index], 16);
+    return 0;
+}
+
+/*!
+ * @brief checkpoint_chunk_digest records the MD5 sum of a chunk of a file which has just been computed
+ * @param entry is the entry, whose stats are those of the file when the chunk was read
+ * @param chunk_index is the index of the chunk
+ * @param md5sum is the MD5 sum of the chunk
+ */
+void checkpoint_chunk_digest(files_list_entry_t *entry, uint64_t chunk_index, uint8_t *md5sum) {
+    append_checkpoint(CHECKPOINT_CHUNK, entry, md5sum, chunk_index);
+}
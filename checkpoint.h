@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/types.h>
+#include "files-list.h"
+#include "configuration.h"
+#include "defines.h"
+
+#define CHECKPOINT_FILE_NAME RESERVED_FILES_PREFIX "checkpoint"
+// Seconds between two syncs of the checkpoint journal
+#define CHECKPOINT_INTERVAL 2
+// Large files are copied by segments of this size, their progress being recorded after each one
+#define CHECKPOINT_SEGMENT_SIZE (64 * 1024 * 1024)
+
+// Kinds of records of the checkpoint journal, which are the first character of their line
+typedef enum {
+    CHECKPOINT_DIGEST = 'H', // MD5 sum of a file
+    CHECKPOINT_COPY = 'C', // Source file written to the destination
+    CHECKPOINT_PROGRESS = 'P', // Size of the temporary file of a copy, synced to disk
+    CHECKPOINT_CHUNK = 'K' // MD5 sum of a chunk of a file digested as a tree, its index being the offset (removed with the journal)
+} checkpoint_kind_t;
+
+// Properties of a file when a record was written: the record is only valid while they do not change
+typedef struct {
+    bool is_set;
+    uint64_t size;
+    struct timespec mtime;
+    ino_t inode;
+    uint8_t md5sum[16];
+    off_t offset;
+} checkpoint_state_t;
+
+// Latest records of a path
+typedef struct {
+    char *path;
+    checkpoint_state_t digest;
+    checkpoint_state_t copy;
+    checkpoint_state_t progress;
+    checkpoint_state_t chunks; // Properties of the file when its chunk digests were recorded
+    uint8_t (*chunk_digests)[16];
+    bool *has_chunk_digest;
+} checkpoint_record_t;
+
+// Checkpoint journal of the current synchronization, with a hash table of the records of the resumed one
+typedef struct {
+    checkpoint_record_t *slots;
+    size_t capacity;
+    size_t count;
+    int journal; // Opened in append mode: each record is written at once, by any process or thread
+    char path[PATH_SIZE];
+    time_t last_sync;
+} checkpoint_t;
+
+size_t read_checkpoint(char *root);
+void clear_checkpoint_records();
+int open_checkpoint(configuration_t *the_config);
+int attach_checkpoint(char *root);
+void close_checkpoint(bool is_complete);
+bool is_checkpoint_open();
+int find_checkpoint_digest(files_list_entry_t *entry);
+void checkpoint_digest(files_list_entry_t *entry);
+bool is_copy_checkpointed(files_list_entry_t *source_entry);
+void checkpoint_copy(files_list_entry_t *source_entry);
+off_t find_copy_progress(files_list_entry_t *source_entry);
+void checkpoint_copy_progress(files_list_entry_t *source_entry, off_t offset);
+int find_checkpoint_chunk(files_list_entry_t *entry, uint64_t chunk_index, uint8_t *md5sum);
+void checkpoint_chunk_digest(files_list_entry_t *entry, uint64_t chunk_index, uint8_t *md5sum);
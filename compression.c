@@ -0,0 +1,286 @@
+#include "compression.h"
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/xattr.h>
+#include <zlib.h>
+#include "throttle.h"
+#include "file-properties.h"
+
+// A chunk of a file, compressed by its own thread
+typedef struct {
+    uint8_t *input;
+    size_t input_size;
+    uint8_t *output;
+    size_t output_capacity;
+    size_t output_size;
+    int level;
+    int result;
+} compression_job_t;
+
+/*!
+ * @brief compress_chunk compresses a chunk into a complete gzip member
+ * It is the body of the compression threads.
+ * @param arg is a pointer to the compression job
+ * @return NULL, the result is stored in the job
+ */
+static void *compress_chunk(void *arg) {
+    compression_job_t *job = (compression_job_t *) arg;
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    job->result = -1;
+
+    // 15 + 16 : fenêtre maximale avec entête et contrôle gzip
+    if (deflateInit2(&stream, job->level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return NULL;
+    }
+
+    stream.next_in = job->input;
+    stream.avail_in = job->input_size;
+    stream.next_out = job->output;
+    stream.avail_out = job->output_capacity;
+    if (deflate(&stream, Z_FINISH) == Z_STREAM_END) {
+        job->output_size = job->output_capacity - stream.avail_out;
+        job->result = 0;
+    }
+
+    deflateEnd(&stream);
+    return NULL;
+}
+
+/*!
+ * @brief read_chunk reads a whole chunk of a file
+ * @param fd is the file descriptor
+ * @param buffer is the buffer receiving the data
+ * @param length is the size of the chunk
+ * @param offset is the position of the chunk in the file
+ * @return 0 in case of success, -1 else (including when the file is shorter than expected)
+ */
+static int read_chunk(int fd, uint8_t *buffer, size_t length, off_t offset) {
+    size_t done = 0;
+    while (done < length) {
+        size_t wanted = throttled_io_size(length - done);
+        throttle_io(wanted);
+        ssize_t read_bytes = pread(fd, buffer + done, wanted, offset + done);
+        if (read_bytes == -1 && errno == EINTR) {
+            continue;
+        }
+        if (read_bytes <= 0) {
+            return -1;
+        }
+        done += read_bytes;
+    }
+    return 0;
+}
+
+/*!
+ * @brief write_chunk writes a whole buffer to a file
+ * @param fd is the file descriptor
+ * @param buffer is the data to write
+ * @param length is the size of the data
+ * @return 0 in case of success, -1 else
+ */
+static int write_chunk(int fd, uint8_t *buffer, size_t length) {
+    size_t done = 0;
+    while (done < length) {
+        size_t wanted = throttled_io_size(length - done);
+        throttle_io(wanted);
+        ssize_t written_bytes = write(fd, buffer + done, wanted);
+        if (written_bytes == -1 && errno == EINTR) {
+            continue;
+        }
+        if (written_bytes <= 0) {
+            return -1;
+        }
+        done += written_bytes;
+    }
+    return 0;
+}
+
+/*!
+ * @brief compress_file_data writes the compressed content of a file
+ * The file is read by batches of chunks, which are compressed in parallel (one thread per chunk) and written in
+ * order as a sequence of gzip members: the result is a regular gzip file (gzip -d restores the original).
+ * The digest of the data actually read is computed on the way (@see init_file_digest), so that it matches what has
+ * been stored.
+ * @param source_fd is the file descriptor of the file to compress
+ * @param destination_fd is the file descriptor where the compressed data is written (at its current position)
+ * @param size is the size of the source file
+ * @param level is the compression level (1 to 9)
+ * @param md5sum receives the MD5 sum of the source data, can be NULL
+ * @return 0 in case of success, -1 else
+ */
+int compress_file_data(int source_fd, int destination_fd, off_t size, int level, uint8_t *md5sum) {
+    size_t chunks_count = size > 0 ? (size + COMPRESSION_CHUNK_SIZE - 1) / COMPRESSION_CHUNK_SIZE : 1;
+    long online_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t threads_count = online_cpus > 0 ? (size_t) online_cpus : 1;
+    if (threads_count > COMPRESSION_MAX_THREADS) {
+        threads_count = COMPRESSION_MAX_THREADS;
+    }
+    if (threads_count > chunks_count) {
+        threads_count = chunks_count;
+    }
+
+    // Un membre gzip ne dépasse ses données que de quelques octets par bloc, plus son entête
+    size_t input_capacity = size < COMPRESSION_CHUNK_SIZE ? (size_t) size : COMPRESSION_CHUNK_SIZE;
+    size_t output_capacity = compressBound(input_capacity) + 64;
+    compression_job_t *jobs = calloc(threads_count, sizeof(compression_job_t));
+    pthread_t *threads = calloc(threads_count, sizeof(pthread_t));
+    bool *is_threaded = calloc(threads_count, sizeof(bool));
+    file_digest_t digest;
+    bool has_digest = init_file_digest(&digest, size) == 0;
+    int result = (jobs != NULL && threads != NULL && is_threaded != NULL && has_digest) ? 0 : -1;
+    for (size_t i = 0; result == 0 && i < threads_count; i++) {
+        jobs[i].input = malloc(input_capacity > 0 ? input_capacity : 1);
+        jobs[i].output = malloc(output_capacity);
+        jobs[i].output_capacity = output_capacity;
+        jobs[i].level = level;
+        if (jobs[i].input == NULL || jobs[i].output == NULL) {
+            result = -1;
+        }
+    }
+
+    off_t offset = 0;
+    size_t chunk_index = 0;
+    while (result == 0 && chunk_index < chunks_count) {
+        // Lecture d'un lot de blocs (un fichier vide donne un unique bloc vide)
+        size_t batch = 0;
+        while (result == 0 && batch < threads_count && chunk_index < chunks_count) {
+            size_t length = size - offset < COMPRESSION_CHUNK_SIZE ? (size_t) (size - offset) : COMPRESSION_CHUNK_SIZE;
+            if (read_chunk(source_fd, jobs[batch].input, length, offset) == -1
+                || update_file_digest(&digest, jobs[batch].input, length) == -1) {
+                result = -1;
+            }
+            jobs[batch].input_size = length;
+            offset += length;
+            chunk_index++;
+            batch++;
+        }
+
+        // Compression en parallèle : le premier bloc est compressé par le thread appelant
+        for (size_t i = 1; result == 0 && i < batch; i++) {
+            is_threaded[i] = pthread_create(&threads[i], NULL, compress_chunk, &jobs[i]) == 0;
+            if (!is_threaded[i]) {
+                compress_chunk(&jobs[i]);
+            }
+        }
+        if (result == 0) {
+            compress_chunk(&jobs[0]);
+        }
+        for (size_t i = 1; i < batch; i++) {
+            if (is_threaded[i]) {
+                pthread_join(threads[i], NULL);
+                is_threaded[i] = false;
+            }
+        }
+
+        // Écriture des membres gzip dans l'ordre du fichier
+        for (size_t i = 0; result == 0 && i < batch; i++) {
+            if (jobs[i].result == -1 || write_chunk(destination_fd, jobs[i].output, jobs[i].output_size) == -1) {
+                result = -1;
+            }
+        }
+    }
+
+    uint8_t file_md5sum[16];
+    if (has_digest && final_file_digest(&digest, file_md5sum) == -1) {
+        result = -1;
+    }
+    if (result == 0 && md5sum != NULL) {
+        memcpy(md5sum, file_md5sum, sizeof(file_md5sum));
+    }
+
+    for (size_t i = 0; jobs != NULL && i < threads_count; i++) {
+        free(jobs[i].input);
+        free(jobs[i].output);
+    }
+    free(jobs);
+    free(threads);
+    free(is_threaded);
+    return result;
+}
+
+/*!
+ * @brief write_logical_properties saves the size and MD5 sum of the original content of a compressed file
+ * They are stored in an extended attribute of the compressed file, so that a scan of the destination compares
+ * the original content with the source instead of the compressed one.
+ * @param fd is the file descriptor of the compressed file
+ * @param size is the size of the original content
+ * @param md5sum is the MD5 sum of the original content
+ * @return 0 in case of success, -1 else
+ */
+int write_logical_properties(int fd, uint64_t size, uint8_t *md5sum) {
+    logical_properties_t properties;
+    memset(&properties, 0, sizeof(properties));
+    properties.size = size;
+    memcpy(properties.md5sum, md5sum, sizeof(properties.md5sum));
+    return fsetxattr(fd, LOGICAL_PROPERTIES_XATTR, &properties, sizeof(properties), 0);
+}
+
+/*!
+ * @brief read_logical_properties replaces the size and MD5 sum of an entry by those of its original content
+ * It only applies to files written by compress_file_data, which carry the logical properties extended attribute.
+ * @param entry is a pointer to the entry, whose stats have already been read
+ * @return 0 if the entry is a compressed file (its MD5 sum is then known), -1 else
+ */
+int read_logical_properties(files_list_entry_t *entry) {
+    logical_properties_t properties;
+    if (getxattr(entry->path_and_name, LOGICAL_PROPERTIES_XATTR, &properties, sizeof(properties)) != sizeof(properties)) {
+        return -1;
+    }
+
+    entry->size = properties.size;
+    memcpy(entry->md5sum, properties.md5sum, sizeof(entry->md5sum));
+    return 0;
+}
+
+/*!
+ * @brief digest_compressed_file computes the MD5 sum of the original content of a compressed file
+ * All the gzip members of the file are decompressed in order (@see compress_file_data).
+ * @param fd is the file descriptor of the compressed file, at its start, closed by the function
+ * @param size is the size of the original content
+ * @param md5sum receives the MD5 sum of the decompressed data
+ * @return 0 in case of success, -1 if the file could not be read or is not the expected size
+ */
+int digest_compressed_file(int fd, uint64_t size, uint8_t *md5sum) {
+    gzFile file = gzdopen(fd, "rb");
+    if (file == NULL) {
+        close(fd);
+        return -1;
+    }
+    gzbuffer(file, COMPRESSION_CHUNK_SIZE);
+
+    uint8_t *buffer = malloc(COMPRESSION_CHUNK_SIZE);
+    file_digest_t digest;
+    if (buffer == NULL || init_file_digest(&digest, size) == -1) {
+        free(buffer);
+        gzclose(file);
+        return -1;
+    }
+
+    int result = 0;
+    uint64_t total = 0;
+    int read_bytes;
+    while ((read_bytes = gzread(file, buffer, COMPRESSION_CHUNK_SIZE)) > 0) {
+        throttle_io(read_bytes);
+        total += read_bytes;
+        if (update_file_digest(&digest, buffer, read_bytes) == -1) {
+            result = -1;
+            break;
+        }
+    }
+    if (read_bytes < 0 || total != size) {
+        result = -1;
+    }
+    if (final_file_digest(&digest, md5sum) == -1) {
+        result = -1;
+    }
+
+    free(buffer);
+    gzclose(file);
+    return result;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "files-list.h"
+
+// Files are compressed by chunks of this size, each chunk being an independent gzip member
+#define COMPRESSION_CHUNK_SIZE (1024 * 1024)
+// Maximum number of chunks compressed at the same time
+#define COMPRESSION_MAX_THREADS 16
+// Extended attribute keeping the logical size and MD5 sum of a compressed destination file
+#define LOGICAL_PROPERTIES_XATTR "user.lp25-backup.logical"
+
+// Content of the logical properties extended attribute
+typedef struct {
+    uint64_t size;
+    uint8_t md5sum[16];
+} logical_properties_t;
+
+int compress_file_data(int source_fd, int destination_fd, off_t size, int level, uint8_t *md5sum);
+int write_logical_properties(int fd, uint64_t size, uint8_t *md5sum);
+int read_logical_properties(files_list_entry_t *entry);
+int digest_compressed_file(int fd, uint64_t size, uint8_t *md5sum);
@@ -0,0 +1,122 @@
+#include "concurrency.h"
+
+/*!
+ * @brief elapsed_seconds gives the time elapsed since a moment
+ * @param since is the moment, on the monotonic clock
+ * @param now is the current time, on the monotonic clock
+ * @return the elapsed time in seconds
+ */
+static double elapsed_seconds(struct timespec *since, struct timespec *now) {
+    return (now->tv_sec - since->tv_sec) + (now->tv_nsec - since->tv_nsec) / 1e9;
+}
+
+/*!
+ * @brief init_concurrency_controller starts a controller at its lowest limit
+ * @param controller is a pointer to the controller
+ * @param min_limit is the lowest number of jobs run at once
+ * @param max_limit is the highest number of jobs run at once (the number of workers)
+ */
+void init_concurrency_controller(concurrency_controller_t *controller, unsigned int min_limit, unsigned int max_limit) {
+    controller->max_limit = max_limit > 0 ? max_limit : 1;
+    controller->min_limit = min_limit < 1 ? 1 : min_limit > controller->max_limit ? controller->max_limit : min_limit;
+    controller->limit = controller->min_limit;
+    controller->is_slow_start = true;
+    clock_gettime(CLOCK_MONOTONIC, &controller->window_start);
+    controller->window_cost = 0;
+    controller->window_latency = 0;
+    controller->window_jobs = 0;
+    controller->previous_throughput = 0;
+    controller->previous_latency = 0;
+    controller->limits_sum = 0;
+    controller->windows_count = 0;
+    controller->best_throughput = 0;
+}
+
+/*!
+ * @brief concurrency_limit gives the number of jobs which may run at once
+ * @param controller is a pointer to the controller
+ * @return the current limit, between the bounds of the controller
+ */
+unsigned int concurrency_limit(concurrency_controller_t *controller) {
+    return (unsigned int) controller->limit;
+}
+
+/*!
+ * @brief adjust_limit updates the limit at the end of a measurement window
+ * The limit grows while the throughput grows, or while it is stable with a stable latency. When the throughput
+ * does not grow but jobs become slower, the workers compete for the disk: the limit is decreased by a factor.
+ * @param controller is a pointer to the controller
+ * @param throughput is the cost per second of the window
+ * @param latency is the time per unit of cost of the jobs of the window
+ */
+static void adjust_limit(concurrency_controller_t *controller, double throughput, double latency) {
+    bool is_faster = throughput > controller->previous_throughput * (1 + CONCURRENCY_TOLERANCE);
+    bool is_congested = !is_faster && controller->previous_throughput > 0
+                        && latency > controller->previous_latency * (1 + CONCURRENCY_TOLERANCE);
+
+    if (is_congested) {
+        controller->is_slow_start = false;
+        controller->limit *= CONCURRENCY_DECREASE_FACTOR;
+    } else if (controller->is_slow_start) {
+        controller->limit *= 2;
+    } else {
+        controller->limit += 1;
+    }
+
+    if (controller->limit < controller->min_limit) {
+        controller->limit = controller->min_limit;
+    }
+    if (controller->limit > controller->max_limit) {
+        controller->limit = controller->max_limit;
+    }
+    controller->previous_throughput = throughput;
+    controller->previous_latency = latency;
+}
+
+/*!
+ * @brief record_job_completion accounts a completed job, and updates the limit when the window is over
+ * A window lasts at least CONCURRENCY_WINDOW_MS and as many jobs as the limit, so that all the active workers
+ * are measured.
+ * @param controller is a pointer to the controller
+ * @param size is the number of bytes of the job
+ * @param started is the moment the job was sent, on the monotonic clock
+ */
+void record_job_completion(concurrency_controller_t *controller, uint64_t size, struct timespec *started) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    controller->window_cost += size + CONCURRENCY_JOB_COST;
+    controller->window_latency += elapsed_seconds(started, &now);
+    controller->window_jobs++;
+
+    double window_duration = elapsed_seconds(&controller->window_start, &now);
+    if (window_duration * 1000 < CONCURRENCY_WINDOW_MS || controller->window_jobs < concurrency_limit(controller)) {
+        return;
+    }
+
+    double throughput = controller->window_cost / window_duration;
+    double latency = controller->window_latency / controller->window_cost;
+    if (throughput > controller->best_throughput) {
+        controller->best_throughput = throughput;
+    }
+    controller->limits_sum += concurrency_limit(controller);
+    controller->windows_count++;
+    adjust_limit(controller, throughput, latency);
+
+    controller->window_start = now;
+    controller->window_cost = 0;
+    controller->window_latency = 0;
+    controller->window_jobs = 0;
+}
+
+/*!
+ * @brief make_concurrency_report gives the limits chosen by a controller
+ * @param controller is a pointer to the controller
+ * @param report receives the limits
+ */
+void make_concurrency_report(concurrency_controller_t *controller, concurrency_report_t *report) {
+    report->min_limit = controller->min_limit;
+    report->max_limit = controller->max_limit;
+    report->final_limit = concurrency_limit(controller);
+    report->mean_limit = controller->windows_count > 0 ? controller->limits_sum / controller->windows_count : controller->limit;
+    report->best_throughput = controller->best_throughput;
+}
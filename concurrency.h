@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+// Shortest measurement window of the controller, in milliseconds
+#define CONCURRENCY_WINDOW_MS 200
+// Fixed cost of a job, in bytes: opening a small file costs about as much as reading this many bytes
+#define CONCURRENCY_JOB_COST 65536
+// Relative change of the throughput or of the latency below which it is considered noise
+#define CONCURRENCY_TOLERANCE 0.05
+// Factor applied to the limit when more workers only made jobs slower
+#define CONCURRENCY_DECREASE_FACTOR 0.75
+
+// Limit of the jobs run at once by a pool of workers, tuned from the measured throughput and latency (AIMD)
+typedef struct {
+    unsigned int min_limit;
+    unsigned int max_limit;
+    double limit; // Current limit, its integer part is used
+    bool is_slow_start; // Set to true until the first congestion: the limit doubles instead of growing by one
+    struct timespec window_start;
+    uint64_t window_cost; // Cost of the jobs completed in the window (@see CONCURRENCY_JOB_COST)
+    double window_latency; // Total time of the jobs completed in the window, in seconds
+    unsigned int window_jobs;
+    double previous_throughput; // Cost per second of the previous window, 0 before the first one
+    double previous_latency; // Seconds per unit of cost of the previous window
+    double limits_sum; // Sum of the limits of the windows, for the report
+    unsigned int windows_count;
+    double best_throughput;
+} concurrency_controller_t;
+
+// Limits chosen by a controller, sent to the main process with the list
+typedef struct {
+    unsigned int min_limit;
+    unsigned int max_limit;
+    unsigned int final_limit;
+    double mean_limit;
+    double best_throughput; // Bytes per second, with the fixed cost of the jobs
+} concurrency_report_t;
+
+void init_concurrency_controller(concurrency_controller_t *controller, unsigned int min_limit, unsigned int max_limit);
+unsigned int concurrency_limit(concurrency_controller_t *controller);
+void record_job_completion(concurrency_controller_t *controller, uint64_t size, struct timespec *started);
+void make_concurrency_report(concurrency_controller_t *controller, concurrency_report_t *report);
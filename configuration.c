@@ -4,6 +4,8 @@
 #include <getopt.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <stdint.h>
 
 typedef enum {DATE_SIZE_ONLY, NO_PARALLEL} long_opt_values;
 
@@ -14,10 +16,75 @@ typedef enum {DATE_SIZE_ONLY, NO_PARALLEL} long_opt_values;
  */
 void display_help(char *my_name) {
     printf("%s [options] source_dir destination_dir\n", my_name);
-    printf("Options: \t-n <processes count>\tnumber of processes for file calculations\n");
+    printf("Options: \t-n <processes count>\tnumber of processes for file calculations (default: one per CPU)\n");
+    printf("         \t--min-processes <count>\tnumber of processes always hashing, the others are only used while they speed it up\n");
     printf("         \t-h display help (this text)\n");
     printf("         \t--date_size_only disables MD5 calculation for files\n");
     printf("         \t--no-parallel disables parallel computing (cancels values of option -n)\n");
+    printf("         \t--verify-destination scans the destination instead of trusting its manifest\n");
+    printf("         \t--verify reads each copied file back from the disk and copies it again when it differs from the source\n");
+    printf("         \t--delete removes from the destination the entries which are not in the source\n");
+    printf("         \t--delete-during (default) or --delete-after set when --delete removes entries\n");
+    printf("         \t--quick-check=<seconds|mtime|ctime|inode> compares files by size and mtime (to the second or nanosecond),\n");
+    printf("         \t          ctime and inode also skip hashing the files whose ctime (and inode) did not change since the last run\n");
+    printf("         \t--fsync=<none|file|batch> syncs each copied file, or the whole destination at the end\n");
+    printf("         \t--dedup=<none|reflink|link> writes files with the same content once (needs the MD5 sums, not with --date-size-only)\n");
+    printf("         \t--compress=gzip[:level] stores the destination files compressed (level 1 to 9, default 6)\n");
+    printf("         \t--bwlimit=<rate> limits the disk throughput, in bytes per second (suffixes K, M and G allowed)\n");
+    printf("         \t--iops-limit=<count> limits the number of disk reads and writes per second\n");
+    printf("         \t--io-idle only uses the disk when no other program needs it\n");
+    printf("         \t--resume restarts an interrupted synchronization from its checkpoint journal (large copies resume where they stopped with --fsync=file|batch)\n");
+    printf("         \t--watch keeps running and copies the source changes as they happen\n");
+    printf("         \t--reconcile-interval <duration> delay between two full synchronizations in watch mode (suffixes s, m, h and d)\n");
+    printf("         \t--include=<pattern> and --exclude=<pattern> keep or skip the matching entries, the first matching option applies\n");
+    printf("         \t          (a .syncignore file in a directory excludes the patterns it lists from its content)\n");
+    printf("         \t--min-size=<size> and --max-size=<size> skip the smaller or larger files (suffixes K, M and G allowed)\n");
+    printf("         \t--min-age=<duration> and --max-age=<duration> skip the files modified more recently or earlier (suffixes s, m, h and d)\n");
+    printf("         \t--memory-limit=<size> builds the files lists with this much memory, sorting them on disk (suffixes K, M and G allowed)\n");
+    printf("         \t          (the lists and their tables are then kept in temporary files, except the tables of the hard links, of --dedup\n");
+    printf("         \t          and of the updated directories, which take memory for each such entry)\n");
+    printf("         \t--link-dest=<previous backup> hard-links the files unchanged since this backup instead of copying them\n");
+    printf("         \t--cpus=<list> runs the workers on these CPUs only (such as 0-3,8)\n");
+    printf("         \t--numa-policy=<none|local|interleave> keeps each worker and its memory on one NUMA node, or spreads the memory\n");
+}
+
+/*!
+ * @brief parse_size reads a number of bytes (or of bytes per second), with an optional K, M or G suffix (powers of 1024)
+ * @param text is the value of the option
+ * @param rate receives the number of bytes
+ * @return 0 in case of success, -1 if the value is invalid or does not fit in 64 bits
+ */
+static int parse_size(char *text, uint64_t *rate) {
+    //strtoull accepte un signe moins, qui donnerait une très grande valeur
+    if (strchr(text, '-') != NULL) {
+        return -1;
+    }
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (end == text || errno == ERANGE) {
+        return -1;
+    }
+
+    unsigned long long unit = 1;
+    switch (*end) {
+        case 'G': case 'g':
+            unit *= 1024;
+            // fall through
+        case 'M': case 'm':
+            unit *= 1024;
+            // fall through
+        case 'K': case 'k':
+            unit *= 1024;
+            end++;
+            break;
+    }
+
+    if (*end != '\0' || value > UINT64_MAX / unit) {
+        return -1;
+    }
+    *rate = value * unit;
+    return 0;
 }
 
 /*!
@@ -27,22 +94,119 @@ void display_help(char *my_name) {
 void init_configuration(configuration_t *the_config) {
     the_config->source[0] = '\0';
     the_config->destination[0] = '\0';
-    the_config->processes_count = 1;
+    the_config->processes_count = 0;
+    the_config->min_processes_count = 1;
     the_config->is_parallel = true;
     the_config->uses_md5 = true;
     the_config->verbose = false;
     the_config->dry_run = false;
-
-    // Vérification des paramètres
-    if (the_config->processes_count < 1) {
-        the_config->processes_count = 1; // Au moins 1 processus
-    }
+    the_config->verify_destination = false;
+    the_config->verify = false;
+    the_config->delete_extraneous = false;
+    the_config->delete_after = false;
+    the_config->durability = DURABILITY_NONE;
+    the_config->dedup = DEDUP_NONE;
+    the_config->compress = false;
+    the_config->compression_level = 6;
+    the_config->bandwidth_limit = 0;
+    the_config->iops_limit = 0;
+    the_config->io_idle = false;
+    the_config->resume = false;
+    the_config->watch = false;
+    the_config->reconcile_interval = 3600;
+    the_config->cpus[0] = '\0';
+    the_config->numa_policy = NUMA_POLICY_NONE;
+    the_config->link_dest[0] = '\0';
+    the_config->filter_rules = NULL;
+    the_config->filter_rules_count = 0;
+    the_config->min_size = 0;
+    the_config->max_size = 0;
+    the_config->min_age = 0;
+    the_config->max_age = 0;
+    the_config->quick_check = QUICK_CHECK_MTIME;
+    the_config->memory_limit = 0;
 
     // Par défaut, MD5 et parallélisme sont actifs
     the_config->uses_md5 = true;
     the_config->is_parallel = true;
 }
 
+/*!
+ * @brief parse_duration reads a number of seconds, with an optional s, m, h or d suffix
+ * @param text is the value of the option
+ * @param duration receives the number of seconds
+ * @return 0 in case of success, -1 if the value is invalid
+ */
+static int parse_duration(char *text, unsigned int *duration) {
+    char *end;
+    unsigned long value = strtoul(text, &end, 10);
+    if (end == text) {
+        return -1;
+    }
+
+    switch (*end) {
+        case 'd':
+            value *= 24;
+            // fall through
+        case 'h':
+            value *= 60;
+            // fall through
+        case 'm':
+            value *= 60;
+            // fall through
+        case 's':
+            end++;
+            break;
+    }
+    if (*end != '\0' || value > UINT32_MAX) {
+        return -1;
+    }
+    *duration = value;
+    return 0;
+}
+
+/*!
+ * @brief parse_count reads a non negative number
+ * @param text is the value of the option
+ * @param count receives the number
+ * @return 0 in case of success, -1 if the value is invalid
+ */
+static int parse_count(char *text, unsigned int *count) {
+    char *end;
+    long value = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || value < 0 || value > UINT32_MAX) {
+        return -1;
+    }
+    *count = value;
+    return 0;
+}
+
+/*!
+ * @brief add_filter_option appends an --include or --exclude pattern to the filter rules
+ * @param the_config is a pointer to the configuration
+ * @param kind is '+' for an include pattern, '-' for an exclude pattern
+ * @param pattern is the pattern
+ * @return 0 in case of success, -1 else
+ */
+static int add_filter_option(configuration_t *the_config, char kind, char *pattern) {
+    char **rules = realloc(the_config->filter_rules, (the_config->filter_rules_count + 1) * sizeof(char *));
+    if (rules == NULL) {
+        fprintf(stderr, "Erreur: mémoire insuffisante pour les filtres\n");
+        return -1;
+    }
+    the_config->filter_rules = rules;
+
+    char *rule = malloc(strlen(pattern) + 2);
+    if (rule == NULL) {
+        fprintf(stderr, "Erreur: mémoire insuffisante pour les filtres\n");
+        return -1;
+    }
+    rule[0] = kind;
+    strcpy(rule + 1, pattern);
+    rules[the_config->filter_rules_count++] = rule;
+    return 0;
+}
+
 /*!
  * @brief set_configuration updates a configuration based on options and parameters passed to the program CLI
  * @param the_config is a pointer to the configuration to update
@@ -65,6 +229,32 @@ int set_configuration(configuration_t *the_config, int argc, char *argv[]) {
             {.name = "no-parallel", .has_arg = 0, .flag = 0, .val = 'c'},
             {.name = "v", .has_arg = 0, .flag = 0, .val = 'd'},
             {.name = "dry-run", .has_arg = 0, .flag = 0, .val = 'e'},
+            {.name = "verify-destination", .has_arg = 0, .flag = 0, .val = 'f'},
+            {.name = "watch", .has_arg = 0, .flag = 0, .val = 'g'},
+            {.name = "delete", .has_arg = 0, .flag = 0, .val = 'i'},
+            {.name = "delete-during", .has_arg = 0, .flag = 0, .val = 'j'},
+            {.name = "delete-after", .has_arg = 0, .flag = 0, .val = 'k'},
+            {.name = "fsync", .has_arg = 1, .flag = 0, .val = 'l'},
+            {.name = "dedup", .has_arg = 1, .flag = 0, .val = 'm'},
+            {.name = "compress", .has_arg = 1, .flag = 0, .val = 'o'},
+            {.name = "bwlimit", .has_arg = 1, .flag = 0, .val = 'p'},
+            {.name = "iops-limit", .has_arg = 1, .flag = 0, .val = 'q'},
+            {.name = "io-idle", .has_arg = 0, .flag = 0, .val = 'r'},
+            {.name = "resume", .has_arg = 0, .flag = 0, .val = 's'},
+            {.name = "reconcile-interval", .has_arg = 1, .flag = 0, .val = 'h'},
+            {.name = "cpus", .has_arg = 1, .flag = 0, .val = 't'},
+            {.name = "numa-policy", .has_arg = 1, .flag = 0, .val = 'u'},
+            {.name = "min-processes", .has_arg = 1, .flag = 0, .val = 'w'},
+            {.name = "link-dest", .has_arg = 1, .flag = 0, .val = 'x'},
+            {.name = "include", .has_arg = 1, .flag = 0, .val = 'y'},
+            {.name = "exclude", .has_arg = 1, .flag = 0, .val = 'z'},
+            {.name = "min-size", .has_arg = 1, .flag = 0, .val = 'A'},
+            {.name = "max-size", .has_arg = 1, .flag = 0, .val = 'B'},
+            {.name = "min-age", .has_arg = 1, .flag = 0, .val = 'C'},
+            {.name = "max-age", .has_arg = 1, .flag = 0, .val = 'D'},
+            {.name = "memory-limit", .has_arg = 1, .flag = 0, .val = 'E'},
+            {.name = "quick-check", .has_arg = 1, .flag = 0, .val = 'F'},
+            {.name = "verify", .has_arg = 0, .flag = 0, .val = 'G'},
             {.name = 0, .has_arg = 0, .flag = 0, .val = 0},
     };
 
@@ -91,9 +281,193 @@ int set_configuration(configuration_t *the_config, int argc, char *argv[]) {
             case 'e':
                 the_config->dry_run = true;
                 break;
+
+            case 'f':
+                the_config->verify_destination = true;
+                break;
+
+            case 'g':
+                the_config->watch = true;
+                break;
+
+            case 'h':
+                if (parse_duration(optarg, &the_config->reconcile_interval) == -1 || the_config->reconcile_interval == 0) {
+                    fprintf(stderr, "Erreur: intervalle de réconciliation invalide %s\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case 'i':
+                the_config->delete_extraneous = true;
+                break;
+
+            case 'j':
+                the_config->delete_extraneous = true;
+                the_config->delete_after = false;
+                break;
+
+            case 'k':
+                the_config->delete_extraneous = true;
+                the_config->delete_after = true;
+                break;
+
+            case 'l':
+                if (strcmp(optarg, "none") == 0) {
+                    the_config->durability = DURABILITY_NONE;
+                } else if (strcmp(optarg, "file") == 0) {
+                    the_config->durability = DURABILITY_FILE;
+                } else if (strcmp(optarg, "batch") == 0) {
+                    the_config->durability = DURABILITY_BATCH;
+                } else {
+                    fprintf(stderr, "Erreur: politique de synchronisation inconnue %s\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case 'm':
+                if (strcmp(optarg, "none") == 0) {
+                    the_config->dedup = DEDUP_NONE;
+                } else if (strcmp(optarg, "reflink") == 0) {
+                    the_config->dedup = DEDUP_REFLINK;
+                } else if (strcmp(optarg, "link") == 0) {
+                    the_config->dedup = DEDUP_LINK;
+                } else {
+                    fprintf(stderr, "Erreur: mode de dédoublonnage inconnu %s\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case 'o':
+                if (strncmp(optarg, "gzip", 4) != 0 || (optarg[4] != '\0' && optarg[4] != ':')) {
+                    fprintf(stderr, "Erreur: algorithme de compression inconnu %s\n", optarg);
+                    return -1;
+                }
+                the_config->compress = true;
+                if (optarg[4] == ':') {
+                    the_config->compression_level = atoi(optarg + 5);
+                    if (the_config->compression_level < 1 || the_config->compression_level > 9) {
+                        fprintf(stderr, "Erreur: niveau de compression invalide %s\n", optarg + 5);
+                        return -1;
+                    }
+                }
+                break;
+
+            case 'p':
+                if (parse_size(optarg, &the_config->bandwidth_limit) == -1) {
+                    fprintf(stderr, "Erreur: débit invalide %s\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case 'q':
+                if (parse_count(optarg, &the_config->iops_limit) == -1) {
+                    fprintf(stderr, "Erreur: nombre d'opérations invalide %s\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case 'r':
+                the_config->io_idle = true;
+                break;
+
+            case 's':
+                the_config->resume = true;
+                break;
+
+            case 't':
+                if (strlen(optarg) >= sizeof(the_config->cpus)) {
+                    fprintf(stderr, "Erreur: liste de CPUs trop longue\n");
+                    return -1;
+                }
+                strcpy(the_config->cpus, optarg);
+                break;
+
+            case 'u':
+                if (strcmp(optarg, "none") == 0) {
+                    the_config->numa_policy = NUMA_POLICY_NONE;
+                } else if (strcmp(optarg, "local") == 0) {
+                    the_config->numa_policy = NUMA_POLICY_LOCAL;
+                } else if (strcmp(optarg, "interleave") == 0) {
+                    the_config->numa_policy = NUMA_POLICY_INTERLEAVE;
+                } else {
+                    fprintf(stderr, "Erreur: politique NUMA inconnue %s\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case 'w':
+                if (atoi(optarg) < 1 || atoi(optarg) > UINT8_MAX) {
+                    fprintf(stderr, "Erreur: nombre de processus invalide %s\n", optarg);
+                    return -1;
+                }
+                the_config->min_processes_count = atoi(optarg);
+                break;
+
+            case 'x':
+                if (strlen(optarg) >= sizeof(the_config->link_dest)) {
+                    fprintf(stderr, "Erreur: Le chemin de la sauvegarde précédente doit avoir une taille inférieure à 1024 caractères.\n");
+                    return -1;
+                }
+                strcpy(the_config->link_dest, optarg);
+                break;
+
+            case 'y':
+            case 'z':
+                if (add_filter_option(the_config, opt == 'y' ? '+' : '-', optarg) == -1) {
+                    return -1;
+                }
+                break;
+
+            case 'A':
+            case 'B':
+                if (parse_size(optarg, opt == 'A' ? &the_config->min_size : &the_config->max_size) == -1) {
+                    fprintf(stderr, "Erreur: taille invalide %s\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case 'C':
+            case 'D':
+                if (parse_duration(optarg, opt == 'C' ? &the_config->min_age : &the_config->max_age) == -1) {
+                    fprintf(stderr, "Erreur: durée invalide %s\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case 'E':
+                if (parse_size(optarg, &the_config->memory_limit) == -1) {
+                    fprintf(stderr, "Erreur: taille invalide %s\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case 'F':
+                if (strcmp(optarg, "seconds") == 0) {
+                    the_config->quick_check = QUICK_CHECK_SECONDS;
+                } else if (strcmp(optarg, "mtime") == 0) {
+                    the_config->quick_check = QUICK_CHECK_MTIME;
+                } else if (strcmp(optarg, "ctime") == 0) {
+                    the_config->quick_check = QUICK_CHECK_CTIME;
+                } else if (strcmp(optarg, "inode") == 0) {
+                    the_config->quick_check = QUICK_CHECK_INODE;
+                } else {
+                    fprintf(stderr, "Erreur: mode de comparaison inconnu %s\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case 'G':
+                the_config->verify = true;
+                break;
         }
     }
 
+    // Le dédoublonnage regroupe les fichiers par somme MD5, qui n'est pas calculée avec --date-size-only
+    if (the_config->dedup != DEDUP_NONE && the_config->uses_md5 == false) {
+        fprintf(stderr, "Erreur: --dedup nécessite les sommes MD5, il est incompatible avec --date-size-only\n");
+        return -1;
+    }
+
     // Vérification des arguments restants
     if (optind + 1 >= argc) {
         fprintf(stderr, "Erreur: Il manque des arguments.\n");
@@ -1,16 +1,72 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
+// When destination writes are made durable
+typedef enum {
+    DURABILITY_NONE, // Left to the operating system
+    DURABILITY_FILE, // Each copied file is synced before being renamed
+    DURABILITY_BATCH // The destination file system is synced once at the end of the synchronization
+} durability_t;
+
+// How files with the same content are written to the destination
+typedef enum {
+    DEDUP_NONE, // Each file is copied
+    DEDUP_REFLINK, // Duplicates are clones sharing the blocks of the first copy (copied when unsupported)
+    DEDUP_LINK // Duplicates with the same mode and mtime are hard links to the first copy
+} dedup_mode_t;
+
+// Where the workers run and allocate their memory on machines with several NUMA nodes
+typedef enum {
+    NUMA_POLICY_NONE, // Left to the operating system
+    NUMA_POLICY_LOCAL, // Each worker runs on the CPUs of one node, which holds its memory
+    NUMA_POLICY_INTERLEAVE // The memory of the workers is spread over all the nodes
+} numa_policy_t;
+
+// How files are compared without reading them
+typedef enum {
+    QUICK_CHECK_SECONDS, // Size and mtime to the second, for destinations which do not keep finer times
+    QUICK_CHECK_MTIME, // Size and mtime to the nanosecond
+    QUICK_CHECK_CTIME, // Same, and the MD5 sum of a source file whose ctime did not change since the manifest is reused
+    QUICK_CHECK_INODE // Same as QUICK_CHECK_CTIME, and the file must also have kept its inode
+} quick_check_t;
+
 typedef struct {
     char source[1024];
     char destination[1024];
-    uint8_t processes_count;
+    uint8_t processes_count; // Analyzers per side, 0 for one per CPU (@see init_placement)
+    uint8_t min_processes_count; // Analyzers per side always active, the others are used while they help (@see concurrency.h)
     bool is_parallel;
     bool uses_md5;
     bool verbose;
     bool dry_run;
+    bool verify_destination;
+    bool verify; // Reads each copied file back from the disk, and copies it again when it differs from the source
+    bool delete_extraneous; // Removes the destination entries which do not exist in the source
+    bool delete_after; // Removes them after the copies instead of while copying
+    durability_t durability;
+    dedup_mode_t dedup;
+    bool compress; // Destination files are stored compressed (gzip)
+    int compression_level;
+    uint64_t bandwidth_limit; // Bytes per second read and written, 0 when unlimited
+    unsigned int iops_limit; // I/O operations per second, 0 when unlimited
+    bool io_idle; // Runs in the idle I/O priority class
+    bool resume; // Reuses the checkpoint journal of an interrupted synchronization
+    bool watch;
+    unsigned int reconcile_interval; // Seconds between two full synchronizations in watch mode
+    char cpus[256]; // CPUs of the workers, as a list such as 0-3,8 (empty for all the available CPUs)
+    numa_policy_t numa_policy;
+    char link_dest[1024]; // Previous backup whose unchanged files are hard-linked instead of copied (empty for none)
+    char **filter_rules; // Patterns of --include (prefixed by '+') and --exclude (prefixed by '-'), in order
+    size_t filter_rules_count;
+    uint64_t min_size; // Files smaller than this many bytes are skipped
+    uint64_t max_size; // Files larger than this many bytes are skipped, 0 when unlimited
+    unsigned int min_age; // Files modified less than this many seconds ago are skipped
+    unsigned int max_age; // Files modified more than this many seconds ago are skipped, 0 when unlimited
+    quick_check_t quick_check;
+    uint64_t memory_limit; // Bytes of memory of the listings, which sort on disk beyond it, 0 when unlimited
 } configuration_t;
 
 void init_configuration(configuration_t *the_config);
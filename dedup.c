@@ -0,0 +1,134 @@
+#include "dedup.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*!
+ * @brief compare_contents orders two files by content, then by path
+ * With DEDUP_LINK, duplicates share their inode in the destination, so they must also have the same mode and mtime.
+ * @param lhd is the first file
+ * @param rhd is the second file
+ * @param mode is the deduplication mode
+ * @param with_path is true to order files with the same content by path
+ * @return a negative value, 0 or a positive value, like strcmp
+ */
+static int compare_contents(files_list_entry_t *lhd, files_list_entry_t *rhd, dedup_mode_t mode, bool with_path) {
+    if (lhd->size != rhd->size) {
+        return lhd->size < rhd->size ? -1 : 1;
+    }
+
+    int order = memcmp(lhd->md5sum, rhd->md5sum, sizeof(lhd->md5sum));
+    if (order != 0) {
+        return order;
+    }
+
+    if (mode == DEDUP_LINK) {
+        if ((lhd->mode & 07777) != (rhd->mode & 07777)) {
+            return (lhd->mode & 07777) < (rhd->mode & 07777) ? -1 : 1;
+        }
+        if (lhd->mtime.tv_sec != rhd->mtime.tv_sec) {
+            return lhd->mtime.tv_sec < rhd->mtime.tv_sec ? -1 : 1;
+        }
+        if (lhd->mtime.tv_nsec != rhd->mtime.tv_nsec) {
+            return lhd->mtime.tv_nsec < rhd->mtime.tv_nsec ? -1 : 1;
+        }
+    }
+
+    return with_path ? strcmp(lhd->path_and_name, rhd->path_and_name) : 0;
+}
+
+/*!
+ * @brief compare_contents_for_copy is the qsort comparator of the index with DEDUP_REFLINK
+ * @param lhd is a pointer to the first content
+ * @param rhd is a pointer to the second content
+ * @return the order of the contents
+ */
+static int compare_contents_for_copy(const void *lhd, const void *rhd) {
+    return compare_contents(((content_t *) lhd)->entry, ((content_t *) rhd)->entry, DEDUP_REFLINK, true);
+}
+
+/*!
+ * @brief compare_contents_for_link is the qsort comparator of the index with DEDUP_LINK
+ * @param lhd is a pointer to the first content
+ * @param rhd is a pointer to the second content
+ * @return the order of the contents
+ */
+static int compare_contents_for_link(const void *lhd, const void *rhd) {
+    return compare_contents(((content_t *) lhd)->entry, ((content_t *) rhd)->entry, DEDUP_LINK, true);
+}
+
+/*!
+ * @brief make_contents_index builds the index of the files to copy, grouped by content
+ * Empty files are not indexed, there is nothing to save on them.
+ * @param index is a pointer to the index to build
+ * @param differences_list is the list of the differences, whose entries are referenced by the index
+ * @param mode is the deduplication mode, nothing is indexed with DEDUP_NONE
+ * @return 0 in case of success, -1 else (out of memory)
+ */
+int make_contents_index(contents_index_t *index, references_list_t *differences_list, dedup_mode_t mode) {
+    index->contents = NULL;
+    index->count = 0;
+    index->mode = mode;
+    if (mode == DEDUP_NONE) {
+        return 0;
+    }
+
+    size_t capacity = 0;
+    for (size_t i = 0; i < differences_list->count; i++) {
+        files_list_entry_t *cursor = differences_list->references[i].entry;
+        if (cursor->entry_type != FICHIER || differences_list->references[i].change_kind != CHANGE_CONTENT || cursor->size == 0) {
+            continue;
+        }
+        if (index->count == capacity) {
+            capacity = capacity == 0 ? 1024 : capacity * 2;
+            content_t *contents = realloc(index->contents, capacity * sizeof(content_t));
+            if (contents == NULL) {
+                clear_contents_index(index);
+                return -1;
+            }
+            index->contents = contents;
+        }
+        index->contents[index->count].entry = cursor;
+        index->contents[index->count].is_copied = false;
+        index->count++;
+    }
+
+    qsort(index->contents, index->count, sizeof(content_t), mode == DEDUP_LINK ? compare_contents_for_link : compare_contents_for_copy);
+    return 0;
+}
+
+/*!
+ * @brief find_content finds the first file (by path) with the same content as an entry
+ * Files are copied in path order, so it is the one copied first, from which the others are made.
+ * @param index is a pointer to the index
+ * @param entry is an entry of the differences list
+ * @return a pointer to the first file of the entry content (possibly the entry itself), NULL if the entry is not indexed
+ */
+content_t *find_content(contents_index_t *index, files_list_entry_t *entry) {
+    size_t low = 0;
+    size_t high = index->count;
+
+    // Recherche dichotomique du premier élément de même contenu
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (compare_contents(index->contents[middle].entry, entry, index->mode, false) < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    if (low < index->count && compare_contents(index->contents[low].entry, entry, index->mode, false) == 0) {
+        return &index->contents[low];
+    }
+    return NULL;
+}
+
+/*!
+ * @brief clear_contents_index frees an index (not the entries it references)
+ * @param index is a pointer to the index
+ */
+void clear_contents_index(contents_index_t *index) {
+    free(index->contents);
+    index->contents = NULL;
+    index->count = 0;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "files-list.h"
+#include "configuration.h"
+
+// A file to copy, in the index of the contents of the differences list
+typedef struct {
+    files_list_entry_t *entry;
+    bool is_copied; // Set once the entry is in the destination, so that its duplicates can be made from it
+} content_t;
+
+// Files to copy ordered by content (size and MD5 sum), so that duplicates are adjacent
+typedef struct {
+    content_t *contents;
+    size_t count;
+    dedup_mode_t mode;
+} contents_index_t;
+
+int make_contents_index(contents_index_t *index, references_list_t *differences_list, dedup_mode_t mode);
+content_t *find_content(contents_index_t *index, files_list_entry_t *entry);
+void clear_contents_index(contents_index_t *index);
@@ -1,3 +1,6 @@
 #pragma once
 
-#define PATH_SIZE 4096
\ No newline at end of file
+#define PATH_SIZE 4096
+
+// Files created by the program in the destination all start with this prefix, and are never synchronized
+#define RESERVED_FILES_PREFIX ".lp25-backup."
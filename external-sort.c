@@ -0,0 +1,480 @@
+#define _GNU_SOURCE
+#include "external-sort.h"
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "defines.h"
+#include "utility.h"
+
+// Memory of the sort of each listing, 0 when the lists are built in memory
+static size_t sort_memory = 0;
+// Directory of the temporary files: the destination, which is known to be writable
+static char spill_directory[PATH_SIZE];
+
+// Run being read by the merge, with its smallest unmerged key
+typedef struct {
+    FILE *run;
+    uint16_t length;
+    char key[PATH_SIZE];
+} run_cursor_t;
+
+/*!
+ * @brief create_spill_file creates an unnamed temporary file in the destination
+ * Files created with O_TMPFILE have no name, the others are removed at once: their blocks are freed when they are
+ * closed, even if the program is killed.
+ * @return the descriptor of the file, -1 in case of error
+ */
+static int create_spill_file() {
+    int fd = open(spill_directory, O_TMPFILE | O_RDWR, 0600);
+    if (fd != -1) {
+        return fd;
+    }
+
+    //Certains systèmes de fichiers ne supportent pas O_TMPFILE
+    char path[PATH_SIZE];
+    if (concat_path(path, spill_directory, RESERVED_FILES_PREFIX "spill-XXXXXX") == NULL) {
+        return -1;
+    }
+    fd = mkstemp(path);
+    if (fd == -1) {
+        perror("Erreur lors de la création d'un fichier temporaire");
+        return -1;
+    }
+    unlink(path);
+    return fd;
+}
+
+/*!
+ * @brief init_external_sort sets the memory of the listings from the configuration
+ * The limit is shared by the listings which run at once: source and destination (and previous backup) in parallel
+ * mode, a single one otherwise. A temporary file is created to check that the destination accepts them.
+ * @param the_config is a pointer to the configuration
+ * @return 0 in case of success, -1 if the temporary files cannot be created
+ */
+int init_external_sort(configuration_t *the_config) {
+    sort_memory = 0;
+    if (the_config->memory_limit == 0) {
+        return 0;
+    }
+
+    size_t listings_count = 1;
+    if (the_config->is_parallel) {
+        listings_count = the_config->link_dest[0] != '\0' ? 3 : 2;
+    }
+    size_t memory = the_config->memory_limit / listings_count;
+    if (memory < MIN_SORT_MEMORY) {
+        memory = MIN_SORT_MEMORY;
+    }
+    strcpy(spill_directory, the_config->destination);
+
+    int fd = create_spill_file();
+    if (fd == -1) {
+        return -1;
+    }
+    close(fd);
+    sort_memory = memory;
+    return 0;
+}
+
+/*!
+ * @brief is_sorting_out_of_core tells whether the lists are built with bounded memory
+ * @return true when a memory limit is set
+ */
+bool is_sorting_out_of_core() {
+    return sort_memory > 0;
+}
+
+/*!
+ * @brief map_spill_region maps a region backed by a temporary file
+ * The file is sparse: only the written pages take disk space. The pages are shared with the file, so the kernel
+ * writes them back and releases them instead of keeping them in memory.
+ * @param size is the size of the region
+ * @return the address of the region, NULL in case of error
+ */
+void *map_spill_region(size_t size) {
+    int fd = create_spill_file();
+    if (fd == -1) {
+        return NULL;
+    }
+    if (ftruncate(fd, size) == -1) {
+        perror("Erreur lors de l'agrandissement d'un fichier temporaire");
+        close(fd);
+        return NULL;
+    }
+    void *region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED) {
+        perror("Erreur lors de la projection d'un fichier temporaire");
+        return NULL;
+    }
+    return region;
+}
+
+/*!
+ * @brief alloc_spill_array allocates a zeroed array, backed by a temporary file when the memory is limited
+ * @param size is the size of the array, SPILL_REGION_SIZE for an array which is filled without being reallocated
+ * @return the address of the array, NULL in case of error
+ */
+void *alloc_spill_array(size_t size) {
+    return is_sorting_out_of_core() ? map_spill_region(size) : calloc(1, size);
+}
+
+/*!
+ * @brief free_spill_array releases an array allocated by alloc_spill_array
+ * @param array is the address of the array, NULL if it was not allocated
+ * @param size is the size it was allocated with
+ */
+void free_spill_array(void *array, size_t size) {
+    if (array == NULL) {
+        return;
+    }
+    if (is_sorting_out_of_core()) {
+        munmap(array, size);
+    } else {
+        free(array);
+    }
+}
+
+/*!
+ * @brief spill_files_list makes an empty list allocate its entries in a region backed by a temporary file
+ * @param list is a pointer to the list, which must be empty
+ * @return 0 in case of success, -1 in case of error
+ */
+int spill_files_list(files_list_t *list) {
+    void *region = map_spill_region(SPILL_REGION_SIZE);
+    if (region == NULL) {
+        return -1;
+    }
+    init_arena_region(&list->arena, region, SPILL_REGION_SIZE);
+    return 0;
+}
+
+/*!
+ * @brief release_spilled_files_list unmaps the region of a list, which becomes empty
+ * Nothing is done for a list whose entries are allocated in memory.
+ * @param list is a pointer to the list
+ */
+void release_spilled_files_list(files_list_t *list) {
+    if (!list->arena.is_region) {
+        return;
+    }
+    munmap(list->arena.blocks, SPILL_REGION_SIZE);
+    init_arena(&list->arena);
+    list->head = NULL;
+    list->tail = NULL;
+}
+
+/*!
+ * @brief init_entries_sorter allocates the buffer of a sort
+ * @param sorter is a pointer to the sort
+ * @return 0 in case of success, -1 when out of memory
+ */
+int init_entries_sorter(entries_sorter_t *sorter) {
+    //Les positions des enregistrements sont alignées depuis la fin du tampon
+    sorter->capacity = sort_memory - sort_memory % sizeof(size_t);
+    sorter->records_size = 0;
+    sorter->count = 0;
+    sorter->runs = NULL;
+    sorter->runs_count = 0;
+    sorter->buffer = malloc(sorter->capacity);
+    if (sorter->buffer == NULL) {
+        perror("Erreur lors de l'allocation du tampon de tri");
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief record_offsets gives the offsets of the records of the buffer, in any order
+ * @param sorter is a pointer to the sort
+ * @return the array of the offsets, at the end of the buffer
+ */
+static size_t *record_offsets(entries_sorter_t *sorter) {
+    return (size_t *) (sorter->buffer + sorter->capacity) - sorter->count;
+}
+
+/*!
+ * @brief compare_records orders two records of the buffer by their keys, like compare_entry_keys
+ * @param lhd is a pointer to the offset of the first record
+ * @param rhd is a pointer to the offset of the second record
+ * @param buffer is the buffer of the records
+ * @return the order of the records, like strcmp
+ */
+static int compare_records(const void *lhd, const void *rhd, void *buffer) {
+    uint8_t *left = (uint8_t *) buffer + *(const size_t *) lhd;
+    uint8_t *right = (uint8_t *) buffer + *(const size_t *) rhd;
+    uint16_t left_length, right_length;
+    memcpy(&left_length, left, sizeof(uint16_t));
+    memcpy(&right_length, right, sizeof(uint16_t));
+
+    int order = memcmp(left + sizeof(uint16_t), right + sizeof(uint16_t), left_length < right_length ? left_length : right_length);
+    if (order != 0) {
+        return order;
+    }
+    return (left_length > right_length) - (left_length < right_length);
+}
+
+/*!
+ * @brief sort_buffer sorts the records of the buffer
+ * @param sorter is a pointer to the sort
+ */
+static void sort_buffer(entries_sorter_t *sorter) {
+    qsort_r(record_offsets(sorter), sorter->count, sizeof(size_t), compare_records, sorter->buffer);
+}
+
+/*!
+ * @brief write_run sorts the buffer and writes its records to a new run, then empties it
+ * @param sorter is a pointer to the sort
+ * @return 0 in case of success, -1 in case of error
+ */
+static int write_run(entries_sorter_t *sorter) {
+    FILE **runs = realloc(sorter->runs, (sorter->runs_count + 1) * sizeof(FILE *));
+    if (runs == NULL) {
+        perror("Erreur lors de l'allocation des tris sur disque");
+        return -1;
+    }
+    sorter->runs = runs;
+
+    int fd = create_spill_file();
+    if (fd == -1) {
+        return -1;
+    }
+    FILE *run = fdopen(fd, "w+");
+    if (run == NULL) {
+        perror("Erreur lors de l'ouverture d'un tri sur disque");
+        close(fd);
+        return -1;
+    }
+    //Le même tampon sert à l'écriture puis à la lecture lors de la fusion
+    setvbuf(run, NULL, _IOFBF, RUN_BUFFER_SIZE);
+
+    sort_buffer(sorter);
+    size_t *offsets = record_offsets(sorter);
+    for (size_t i = 0; i < sorter->count; ++i) {
+        uint8_t *record = sorter->buffer + offsets[i];
+        uint16_t length;
+        memcpy(&length, record, sizeof(uint16_t));
+        if (fwrite(record, sizeof(uint16_t) + length, 1, run) != 1) {
+            perror("Erreur lors de l'écriture d'un tri sur disque");
+            fclose(run);
+            return -1;
+        }
+    }
+    if (fflush(run) == EOF) {
+        perror("Erreur lors de l'écriture d'un tri sur disque");
+        fclose(run);
+        return -1;
+    }
+
+    sorter->runs[sorter->runs_count++] = run;
+    sorter->records_size = 0;
+    sorter->count = 0;
+    return 0;
+}
+
+/*!
+ * @brief add_sorted_entry adds the key of an entry to a sort
+ * When the buffer is full, its records are written to a run first.
+ * @param sorter is a pointer to the sort
+ * @param key is the key of the entry, the path relative to the root of the list
+ * @return 0 in case of success, -1 in case of error
+ */
+int add_sorted_entry(entries_sorter_t *sorter, char *key) {
+    size_t length = strlen(key);
+    size_t record_size = sizeof(uint16_t) + length;
+    if (length >= PATH_SIZE) {
+        return -1;
+    }
+    if (sorter->records_size + record_size + (sorter->count + 1) * sizeof(size_t) > sorter->capacity) {
+        if (write_run(sorter) == -1) {
+            return -1;
+        }
+    }
+
+    uint16_t record_length = length;
+    memcpy(sorter->buffer + sorter->records_size, &record_length, sizeof(uint16_t));
+    memcpy(sorter->buffer + sorter->records_size + sizeof(uint16_t), key, length);
+    sorter->count++;
+    record_offsets(sorter)[0] = sorter->records_size;
+    sorter->records_size += record_size;
+    return 0;
+}
+
+/*!
+ * @brief append_sorted_entry adds an entry to the tail of a list from its key
+ * @param list is a pointer to the list
+ * @param entry is a buffer for the entry
+ * @param key is the key of the entry, null terminated
+ * @return 0 in case of success, -1 in case of error
+ */
+static int append_sorted_entry(files_list_t *list, files_list_entry_t *entry, char *key) {
+    memset(entry, 0, offsetof(files_list_entry_t, path_and_name));
+    if (concat_path(entry->path_and_name, list->root, key) == NULL) {
+        return -1;
+    }
+    return add_entry_to_tail(list, entry);
+}
+
+/*!
+ * @brief read_run_record reads the next key of a run
+ * @param cursor is a pointer to the cursor of the run
+ * @return 1 when a key was read, 0 at the end of the run, -1 in case of error
+ */
+static int read_run_record(run_cursor_t *cursor) {
+    if (fread(&cursor->length, sizeof(uint16_t), 1, cursor->run) != 1) {
+        return ferror(cursor->run) ? -1 : 0;
+    }
+    if (cursor->length >= PATH_SIZE || fread(cursor->key, cursor->length, 1, cursor->run) != 1) {
+        return -1;
+    }
+    cursor->key[cursor->length] = '\0';
+    return 1;
+}
+
+/*!
+ * @brief compare_cursors orders two runs by their current keys
+ * @param lhd is a pointer to the first cursor
+ * @param rhd is a pointer to the second cursor
+ * @return the order of the keys, like strcmp
+ */
+static int compare_cursors(run_cursor_t *lhd, run_cursor_t *rhd) {
+    int order = memcmp(lhd->key, rhd->key, lhd->length < rhd->length ? lhd->length : rhd->length);
+    if (order != 0) {
+        return order;
+    }
+    return (lhd->length > rhd->length) - (lhd->length < rhd->length);
+}
+
+/*!
+ * @brief sift_down restores the order of a heap of cursors whose top may be too large
+ * @param heap is the heap, the smallest key first
+ * @param count is the number of cursors of the heap
+ * @param position is the cursor to move down
+ */
+static void sift_down(run_cursor_t **heap, size_t count, size_t position) {
+    while (2 * position + 1 < count) {
+        size_t child = 2 * position + 1;
+        if (child + 1 < count && compare_cursors(heap[child + 1], heap[child]) < 0) {
+            child++;
+        }
+        if (compare_cursors(heap[position], heap[child]) <= 0) {
+            return;
+        }
+        run_cursor_t *swapped = heap[position];
+        heap[position] = heap[child];
+        heap[child] = swapped;
+        position = child;
+    }
+}
+
+/*!
+ * @brief merge_runs appends the keys of all the runs to a list, in order
+ * @param sorter is a pointer to the sort, whose buffer is empty
+ * @param list is a pointer to the list
+ * @param entry is a buffer for the entries
+ * @return 0 in case of success, -1 in case of error
+ */
+static int merge_runs(entries_sorter_t *sorter, files_list_t *list, files_list_entry_t *entry) {
+    run_cursor_t *cursors = malloc(sorter->runs_count * sizeof(run_cursor_t));
+    run_cursor_t **heap = malloc(sorter->runs_count * sizeof(run_cursor_t *));
+    if (cursors == NULL || heap == NULL) {
+        perror("Erreur lors de l'allocation de la fusion");
+        free(cursors);
+        free(heap);
+        return -1;
+    }
+
+    int result = 0;
+    size_t heap_count = 0;
+    for (size_t i = 0; i < sorter->runs_count && result == 0; ++i) {
+        cursors[i].run = sorter->runs[i];
+        rewind(cursors[i].run);
+        int status = read_run_record(&cursors[i]);
+        if (status == 1) {
+            heap[heap_count++] = &cursors[i];
+        } else if (status == -1) {
+            result = -1;
+        }
+    }
+    for (size_t i = heap_count / 2; i-- > 0;) {
+        sift_down(heap, heap_count, i);
+    }
+
+    while (heap_count > 0 && result == 0) {
+        if (append_sorted_entry(list, entry, heap[0]->key) == -1) {
+            result = -1;
+            break;
+        }
+        int status = read_run_record(heap[0]);
+        if (status == -1) {
+            result = -1;
+        } else if (status == 0) {
+            heap[0] = heap[--heap_count];
+        }
+        sift_down(heap, heap_count, 0);
+    }
+
+    if (result == -1) {
+        fprintf(stderr, "Erreur lors de la fusion des tris sur disque\n");
+    }
+    free(heap);
+    free(cursors);
+    return result;
+}
+
+/*!
+ * @brief merge_sorted_entries appends the entries of a sort to a list, ordered by their keys
+ * When nothing was written to disk, the buffer is sorted and appended directly. Otherwise it is written as the last
+ * run and released, then all the runs are merged at once.
+ * @param sorter is a pointer to the sort
+ * @param list is a pointer to the list, whose entries must all precede the ones of the sort
+ * @return 0 in case of success, -1 in case of error
+ */
+int merge_sorted_entries(entries_sorter_t *sorter, files_list_t *list) {
+    files_list_entry_t *entry = malloc(sizeof(files_list_entry_t));
+    if (entry == NULL) {
+        return -1;
+    }
+
+    int result = 0;
+    if (sorter->runs_count == 0) {
+        sort_buffer(sorter);
+        size_t *offsets = record_offsets(sorter);
+        char key[PATH_SIZE];
+        for (size_t i = 0; i < sorter->count && result == 0; ++i) {
+            uint16_t length;
+            memcpy(&length, sorter->buffer + offsets[i], sizeof(uint16_t));
+            memcpy(key, sorter->buffer + offsets[i] + sizeof(uint16_t), length);
+            key[length] = '\0';
+            result = append_sorted_entry(list, entry, key);
+        }
+    } else if (sorter->count > 0 && write_run(sorter) == -1) {
+        result = -1;
+    } else {
+        free(sorter->buffer);
+        sorter->buffer = NULL;
+        result = merge_runs(sorter, list, entry);
+    }
+
+    free(entry);
+    return result;
+}
+
+/*!
+ * @brief clear_entries_sorter releases the buffer and the runs of a sort
+ * @param sorter is a pointer to the sort
+ */
+void clear_entries_sorter(entries_sorter_t *sorter) {
+    free(sorter->buffer);
+    sorter->buffer = NULL;
+    for (size_t i = 0; i < sorter->runs_count; ++i) {
+        fclose(sorter->runs[i]);
+    }
+    free(sorter->runs);
+    sorter->runs = NULL;
+    sorter->runs_count = 0;
+    sorter->records_size = 0;
+    sorter->count = 0;
+}
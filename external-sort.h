@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "configuration.h"
+#include "files-list.h"
+
+// Address space of a spilled region, backed by a sparse temporary file: its pages are written back to the file
+// and released by the kernel when memory is short
+#define SPILL_REGION_SIZE (1ULL << 40)
+// Smallest sorting memory of a listing
+#define MIN_SORT_MEMORY (1024 * 1024)
+// Buffer of each run read by the merge
+#define RUN_BUFFER_SIZE (64 * 1024)
+
+// Entries of a listing sorted in bounded memory: the keys are gathered in a buffer, which is sorted and written
+// as a run to a temporary file each time it is full, then the runs are merged (@see merge_sorted_entries)
+typedef struct {
+    uint8_t *buffer; // Records from the start (16 bits length and key), their offsets from the end
+    size_t capacity;
+    size_t records_size;
+    size_t count;
+    FILE **runs;
+    size_t runs_count;
+} entries_sorter_t;
+
+int init_external_sort(configuration_t *the_config);
+bool is_sorting_out_of_core();
+void *map_spill_region(size_t size);
+void *alloc_spill_array(size_t size);
+void free_spill_array(void *array, size_t size);
+int spill_files_list(files_list_t *list);
+void release_spilled_files_list(files_list_t *list);
+int init_entries_sorter(entries_sorter_t *sorter);
+int add_sorted_entry(entries_sorter_t *sorter, char *key);
+int merge_sorted_entries(entries_sorter_t *sorter, files_list_t *list);
+void clear_entries_sorter(entries_sorter_t *sorter);
@@ -0,0 +1,136 @@
+#include "failures.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+// Operations of the current synchronization
+static failures_report_t failures_report;
+
+/*!
+ * @brief is_transient_error tells whether an operation which failed with an error may succeed later
+ * @param error is the errno of the failed operation
+ * @return true for interruptions, temporarily unavailable resources and a full destination
+ */
+static bool is_transient_error(int error) {
+    return error == EINTR || error == EAGAIN || error == EWOULDBLOCK || error == ENOSPC || error == EDQUOT
+           || error == ENOMEM || error == EBUSY || error == ETIMEDOUT;
+}
+
+/*!
+ * @brief retry_after_error waits before a new attempt of a failed operation, when its error is transient
+ * The delay doubles at each attempt. It starts longer when the destination is full, for space to be freed.
+ * errno is kept, it must be the error of the failed operation.
+ * @param attempt is the number of attempts already made
+ * @return true if the operation must be attempted again, false if it failed for good
+ */
+bool retry_after_error(int attempt) {
+    int error = errno;
+    if (attempt >= RETRY_MAX_ATTEMPTS || !is_transient_error(error)) {
+        return false;
+    }
+
+    long delay_ms = (error == ENOSPC || error == EDQUOT ? RETRY_NO_SPACE_DELAY_MS : RETRY_BASE_DELAY_MS) << (attempt - 1);
+    fprintf(stderr, "Erreur temporaire (%s), nouvel essai dans %ld ms\n", strerror(error), delay_ms);
+    struct timespec delay = {.tv_sec = delay_ms / 1000, .tv_nsec = (delay_ms % 1000) * 1000000};
+    while (nanosleep(&delay, &delay) == -1 && errno == EINTR) {
+    }
+
+    failures_report.retried_count++;
+    errno = error;
+    return true;
+}
+
+/*!
+ * @brief add_failure adds an entry to the failures listed in the report
+ * @param path is the path of the entry
+ * @param error is the errno of the failed operation, 0 when it is not a system error
+ */
+static void add_failure(char *path, int error) {
+    if (failures_report.failed_count < FAILURES_LISTED_MAX) {
+        failure_t *failure = &failures_report.failures[failures_report.failed_count];
+        failure->error = error;
+        failure->path = strdup(path);
+    }
+    failures_report.failed_count++;
+}
+
+/*!
+ * @brief record_entry_result accounts the outcome of the change attempted on an entry
+ * Each attempted entry (copy, link, metadata update or deletion) must be recorded once, so that
+ * succeeded_count + failed_count is the number of attempted entries.
+ * @param path is the path of the entry
+ * @param result is the result of the operation, 0 or -1
+ * @param error is the errno saved right after the failed operation (0 when it is not a system error)
+ * @return result
+ */
+int record_entry_result(char *path, int result, int error) {
+    if (result == 0) {
+        failures_report.succeeded_count++;
+        return 0;
+    }
+
+    add_failure(path, error);
+    return result;
+}
+
+/*!
+ * @brief record_entry_failure accounts a failure of a follow-up operation on an entry (e.g. the metadata of a directory)
+ * An entry already recorded as succeeded is counted as failed instead, it is not counted twice.
+ * @param path is the path of the entry
+ * @param error is the errno saved right after the failed operation (0 when it is not a system error)
+ * @param was_succeeded is true if the entry was already recorded as succeeded
+ */
+void record_entry_failure(char *path, int error, bool was_succeeded) {
+    if (was_succeeded && failures_report.succeeded_count > 0) {
+        failures_report.succeeded_count--;
+    }
+    add_failure(path, error);
+}
+
+/*!
+ * @brief record_cancellation accounts a synchronization which stopped before applying its changes
+ */
+void record_cancellation() {
+    failures_report.is_cancelled = true;
+}
+
+/*!
+ * @brief report_failures prints the entries which could not be synchronized, and gives the outcome of the synchronization
+ * @param verbose is true to also print the counts when all the entries were synchronized
+ * The outcome only depends on the attempted entries, whatever their change (copy, metadata update or deletion).
+ * @return SYNC_COMPLETE without failure, SYNC_FAILED when cancelled or when every attempted entry failed, SYNC_PARTIAL else
+ */
+sync_status_t report_failures(bool verbose) {
+    if (failures_report.failed_count == 0) {
+        if (verbose && failures_report.retried_count > 0) {
+            printf("%zu entrées synchronisées, %zu nouveaux essais après des erreurs temporaires\n",
+                   failures_report.succeeded_count, failures_report.retried_count);
+        }
+        return failures_report.is_cancelled ? SYNC_FAILED : SYNC_COMPLETE;
+    }
+
+    fprintf(stderr, "%zu entrées n'ont pas pu être synchronisées (%zu l'ont été) :\n",
+            failures_report.failed_count, failures_report.succeeded_count);
+    for (size_t i = 0; i < failures_report.failed_count && i < FAILURES_LISTED_MAX; i++) {
+        failure_t *failure = &failures_report.failures[i];
+        fprintf(stderr, "  %s : %s\n", failure->path != NULL ? failure->path : "?",
+                failure->error != 0 ? strerror(failure->error) : "échec");
+    }
+    if (failures_report.failed_count > FAILURES_LISTED_MAX) {
+        fprintf(stderr, "  ... et %zu autres\n", failures_report.failed_count - FAILURES_LISTED_MAX);
+    }
+
+    return failures_report.is_cancelled || failures_report.succeeded_count == 0 ? SYNC_FAILED : SYNC_PARTIAL;
+}
+
+/*!
+ * @brief clear_failures_report forgets the operations of the previous synchronization
+ */
+void clear_failures_report() {
+    for (size_t i = 0; i < failures_report.failed_count && i < FAILURES_LISTED_MAX; i++) {
+        free(failures_report.failures[i].path);
+    }
+    memset(&failures_report, 0, sizeof(failures_report));
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Attempts of an operation on an entry which fails with a transient error (@see retry_after_error)
+#define RETRY_MAX_ATTEMPTS 5
+// Delay before the first new attempt, doubled at each attempt
+#define RETRY_BASE_DELAY_MS 100
+// Delay before the first new attempt when the destination is full, to let space be freed
+#define RETRY_NO_SPACE_DELAY_MS 5000
+// Failed entries listed at the end of a synchronization, the others are only counted
+#define FAILURES_LISTED_MAX 20
+
+// Exit status of the program when some entries could not be synchronized, and when none could
+#define EXIT_PARTIAL_FAILURE 23
+#define EXIT_TOTAL_FAILURE 1
+
+// Outcome of a synchronization
+typedef enum {
+    SYNC_COMPLETE,
+    SYNC_PARTIAL, // Some entries could not be synchronized, the others were
+    SYNC_FAILED // No entry could be synchronized, or the synchronization was cancelled
+} sync_status_t;
+
+// Entry which could not be synchronized, with the error of its last attempt
+typedef struct {
+    char *path;
+    int error; // 0 when the error is not a system error
+} failure_t;
+
+// Operations on the entries of the current synchronization
+typedef struct {
+    size_t succeeded_count; // Attempted entries: succeeded_count + failed_count
+    size_t retried_count; // New attempts made after transient errors
+    size_t failed_count;
+    failure_t failures[FAILURES_LISTED_MAX]; // The first failures
+    bool is_cancelled; // Set to true when the changes could not be applied at all
+} failures_report_t;
+
+bool retry_after_error(int attempt);
+int record_entry_result(char *path, int result, int error);
+void record_entry_failure(char *path, int error, bool was_succeeded);
+void record_cancellation();
+sync_status_t report_failures(bool verbose);
+void clear_failures_report();
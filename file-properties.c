@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include "file-properties.h"
 
 #include <sys/stat.h>
@@ -8,9 +9,26 @@
 #include <assert.h>
 #include <string.h>
 #include "defines.h"
+#include "throttle.h"
 #include <fcntl.h>
 #include <stdio.h>
 #include "utility.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "checkpoint.h"
+
+#define HASH_BUFFER_SIZE 65536
+
+// Chunks of a file digested as a tree, shared by the threads hashing them
+typedef struct {
+    files_list_entry_t *entry;
+    uint8_t (*chunk_digests)[16];
+    uint64_t chunks_count;
+    uint64_t next_chunk;
+    pthread_mutex_t lock;
+    int result;
+} tree_hash_job_t;
 
 /*!
  * @brief get_file_stats gets all of the required information for a file (inc. directories)
@@ -29,29 +47,15 @@
  */
 
 int get_file_stats(files_list_entry_t *entry) {
-    struct stat file_info;
-
-    if (stat(entry->path_and_name, &file_info) == -1) {
-        perror("Erreur d'obtention des stats");
+    if (read_file_stats(entry) == -1) {
         return -1;
     }
 
-    entry->mode = file_info.st_mode;
-    entry->mtime.tv_sec = file_info.st_mtime;
-    entry->mtime.tv_nsec = file_info.st_mtimensec;
-    entry->size = file_info.st_size;
-
-    if (S_ISDIR(entry->mode)) {
-        entry->entry_type = DOSSIER;
-    } else if (S_ISREG(entry->mode)) {
-        entry->entry_type = FICHIER;
+    if (entry->entry_type == FICHIER) {
         if (compute_file_md5(entry) != 0) {
             perror("Erreur lors du calcul de la somme MD5");
             return -1;
         }
-    } else {
-        perror("Erreur");
-        return -1;
     }
 
     /*printf("Mode: %o\n", entry->mode);
@@ -68,24 +72,108 @@ int get_file_stats(files_list_entry_t *entry) {
 }
 
 /*!
- * @brief compute_file_md5 computes a file's MD5 sum
- * @param the pointer to the files list entry
+ * @brief digest_zeros adds zeros to a digest, without reading them from a file
+ * It is used for the holes of sparse files, which read as zeros.
+ * @param md5_ctx is the digest context
+ * @param length is the number of zeros to add
+ * @return 1 in case of success, 0 else (like EVP_DigestUpdate)
+ */
+static int digest_zeros(EVP_MD_CTX *md5_ctx, off_t length) {
+    static const unsigned char zeros[HASH_BUFFER_SIZE];
+
+    while (length > 0) {
+        size_t chunk = length < (off_t) sizeof(zeros) ? (size_t) length : sizeof(zeros);
+        if (EVP_DigestUpdate(md5_ctx, zeros, chunk) != 1) {
+            return 0;
+        }
+        length -= chunk;
+    }
+    return 1;
+}
+
+/*!
+ * @brief digest_file_range reads a range of a file into a digest
+ * @param md5_ctx is the digest context
+ * @param fd is the descriptor of the file
+ * @param offset is the start of the range
+ * @param end is the end of the range (excluded)
+ * @return 1 in case of success, 0 else (like EVP_DigestUpdate)
+ */
+static int digest_file_range(EVP_MD_CTX *md5_ctx, int fd, off_t offset, off_t end) {
+    unsigned char buffer[HASH_BUFFER_SIZE];
+
+    while (offset < end) {
+        size_t wanted = end - offset < (off_t) sizeof(buffer) ? (size_t) (end - offset) : sizeof(buffer);
+        wanted = throttled_io_size(wanted);
+        throttle_io(wanted);
+        ssize_t read_bytes = pread(fd, buffer, wanted, offset);
+        if (read_bytes == -1) {
+            return 0;
+        }
+        if (read_bytes == 0) {
+            break; // Fichier tronqué pendant la lecture
+        }
+        if (EVP_DigestUpdate(md5_ctx, buffer, read_bytes) != 1) {
+            return 0;
+        }
+        offset += read_bytes;
+    }
+    return 1;
+}
+
+/*!
+ * @brief read_file_stats gets the information of an entry given by stat, without computing its MD5 sum
+ * @param entry is a pointer to the files list entry
+ * It also keeps the device, inode and links count of the entry, to find hard links (@see hard-links.h)
  * @return -1 in case of error, 0 else
- * Use libcrypto functions from openssl/evp.h
  */
-int compute_file_md5(files_list_entry_t *entry) {
-    //Ouvrir le fichier en mode binaire
-    FILE *file = fopen(entry->path_and_name, "rb");
-    if (!file) {
-        perror("Error opening file");
+int read_file_stats(files_list_entry_t *entry) {
+    struct stat file_info;
+
+    if (stat(entry->path_and_name, &file_info) == -1) {
+        perror("Erreur d'obtention des stats");
+        return -1;
+    }
+
+    entry->mode = file_info.st_mode;
+    entry->mtime.tv_sec = file_info.st_mtime;
+    entry->mtime.tv_nsec = file_info.st_mtim.tv_nsec;
+    entry->ctime = file_info.st_ctim;
+    entry->size = file_info.st_size;
+    entry->device = file_info.st_dev;
+    entry->inode = file_info.st_ino;
+    entry->links_count = file_info.st_nlink;
+
+    if (S_ISDIR(entry->mode)) {
+        //La taille d'un dossier dépend du système de fichiers, elle n'est pas comparée
+        entry->entry_type = DOSSIER;
+        entry->size = 0;
+        memset(entry->md5sum, 0, sizeof(entry->md5sum));
+    } else if (S_ISREG(entry->mode)) {
+        entry->entry_type = FICHIER;
+    } else {
+        perror("Erreur");
         return -1;
     }
 
+    return 0;
+}
+
+/*!
+ * @brief digest_file_chunk computes the MD5 sum of a range of a file
+ * The holes of sparse files (@see SEEK_HOLE) are not read: zeros are added to the digest instead.
+ * @param fd is the descriptor of the file
+ * @param start is the start of the range
+ * @param end is the end of the range (excluded)
+ * @param is_sparse is true when the file has fewer allocated blocks than its size
+ * @param md5sum receives the MD5 sum
+ * @return -1 in case of error, 0 else
+ */
+static int digest_file_chunk(int fd, off_t start, off_t end, bool is_sparse, uint8_t *md5sum) {
     //Créer un context md5
     EVP_MD_CTX *md5_ctx = EVP_MD_CTX_new();
     if (!md5_ctx) {
         perror("Error creating MD5 context");
-        fclose(file);
         return -1;
     }
 
@@ -94,7 +182,6 @@ int compute_file_md5(files_list_entry_t *entry) {
     if (!md) {
         perror("MD5 not supported");
         EVP_MD_CTX_free(md5_ctx);
-        fclose(file);
         return -1;
     }
 
@@ -102,39 +189,346 @@ int compute_file_md5(files_list_entry_t *entry) {
     if (EVP_DigestInit_ex(md5_ctx, md, NULL) != 1) {
         perror("Error initializing MD5 digest");
         EVP_MD_CTX_free(md5_ctx);
-        fclose(file);
         return -1;
     }
 
-    //Lire le fichier par morceaux et mettre à jour le contexte MD5
-    size_t read_bytes;
-    unsigned char buffer[4096];
+    //Lire le fichier par morceaux et mettre à jour le contexte MD5, en sautant les trous des fichiers creux
+    off_t offset = start;
+    int updated = 1;
+    while (updated == 1 && offset < end) {
+        off_t data_start = offset;
+        off_t data_end = end;
+        if (is_sparse) {
+            data_start = lseek(fd, offset, SEEK_DATA);
+            if (data_start == -1 && errno == ENXIO) {
+                data_start = end; // Plus de données : la fin du fichier est un trou
+            } else if (data_start == -1) {
+                data_start = offset; // Pas de support des trous, lecture complète
+                is_sparse = false;
+            } else {
+                if (data_start > end) {
+                    data_start = end;
+                }
+                data_end = lseek(fd, data_start, SEEK_HOLE);
+                if (data_end == -1 || data_end > end) {
+                    data_end = end;
+                }
+            }
+        }
 
-    while ((read_bytes = fread(buffer, 1, sizeof(buffer), file)) > 0) {
-        if (EVP_DigestUpdate(md5_ctx, buffer, read_bytes) != 1) {
-            perror("Error updating MD5 digest");
-            EVP_MD_CTX_free(md5_ctx);
-            fclose(file);
-            return -1;
+        updated = digest_zeros(md5_ctx, data_start - offset);
+        if (updated == 1 && data_start < end) {
+            updated = digest_file_range(md5_ctx, fd, data_start, data_end);
         }
+        offset = data_end;
+    }
+
+    if (updated != 1) {
+        perror("Error updating MD5 digest");
+        EVP_MD_CTX_free(md5_ctx);
+        return -1;
     }
 
     //Finaliser le calcul du hachage MD5
-    if (EVP_DigestFinal_ex(md5_ctx, entry->md5sum, NULL) != 1) {
+    if (EVP_DigestFinal_ex(md5_ctx, md5sum, NULL) != 1) {
         perror("Error finalizing MD5 digest");
         EVP_MD_CTX_free(md5_ctx);
-        fclose(file);
         return -1;
     }
 
-    //Libérer les ressources et fermer le fichier
     EVP_MD_CTX_free(md5_ctx);
-    fclose(file);
+    return 0;
+}
+
+/*!
+ * @brief tree_hash_chunks_count gives the number of chunks of a file digested as a tree
+ * @param size is the size of the file
+ * @return the number of chunks, 0 when the file is small enough for a plain MD5 sum
+ */
+uint64_t tree_hash_chunks_count(uint64_t size) {
+    if (size <= TREE_HASH_THRESHOLD) {
+        return 0;
+    }
+    return (size + TREE_HASH_CHUNK_SIZE - 1) / TREE_HASH_CHUNK_SIZE;
+}
 
-    //success
+/*!
+ * @brief combine_chunk_digests computes the digest of a file from the digests of its chunks
+ * @param chunk_digests is the array of the MD5 sums of the chunks, in order
+ * @param chunks_count is the number of chunks
+ * @param md5sum receives the digest of the file (MD5 sum of the chunk digests)
+ * @return -1 in case of error, 0 else
+ */
+int combine_chunk_digests(uint8_t (*chunk_digests)[16], uint64_t chunks_count, uint8_t *md5sum) {
+    EVP_MD_CTX *md5_ctx = EVP_MD_CTX_new();
+    int result = md5_ctx != NULL && EVP_DigestInit_ex(md5_ctx, EVP_md5(), NULL) == 1
+                 && EVP_DigestUpdate(md5_ctx, chunk_digests, chunks_count * 16) == 1
+                 && EVP_DigestFinal_ex(md5_ctx, md5sum, NULL) == 1 ? 0 : -1;
+    EVP_MD_CTX_free(md5_ctx);
+    return result;
+}
+
+/*!
+ * @brief compute_chunk_md5 computes the MD5 sum of a chunk of a file digested as a tree
+ * Chunks are independent, so that several processes can hash a large file together.
+ * @param entry is a pointer to the files list entry, whose size is already known
+ * @param chunk_index is the index of the chunk
+ * @param md5sum receives the MD5 sum of the chunk
+ * @return -1 in case of error, 0 else
+ */
+int compute_chunk_md5(files_list_entry_t *entry, uint64_t chunk_index, uint8_t *md5sum) {
+    int fd = open(entry->path_and_name, O_RDONLY);
+    if (fd == -1) {
+        perror("Error opening file");
+        return -1;
+    }
+
+    struct stat file_info;
+    if (fstat(fd, &file_info) == -1) {
+        perror("Error reading file properties");
+        close(fd);
+        return -1;
+    }
+
+    off_t start = chunk_index * TREE_HASH_CHUNK_SIZE;
+    off_t end = start + TREE_HASH_CHUNK_SIZE < entry->size ? start + TREE_HASH_CHUNK_SIZE : (off_t) entry->size;
+    bool is_sparse = (off_t) file_info.st_blocks * 512 < file_info.st_size;
+    int result = digest_file_chunk(fd, start, end, is_sparse, md5sum);
+    close(fd);
+    return result;
+}
+
+/*!
+ * @brief hash_chunks hashes the chunks of a tree job until there is none left
+ * It is the body of the tree hashing threads: each one reads the file through its own descriptor.
+ * @param arg is a pointer to the tree hashing job
+ * @return NULL, errors are stored in the job
+ */
+static void *hash_chunks(void *arg) {
+    tree_hash_job_t *job = (tree_hash_job_t *) arg;
+    files_list_entry_t *entry = job->entry;
+    int fd = open(entry->path_and_name, O_RDONLY);
+    struct stat file_info;
+    if (fd == -1 || fstat(fd, &file_info) == -1) {
+        perror("Error opening file");
+        pthread_mutex_lock(&job->lock);
+        job->result = -1;
+        pthread_mutex_unlock(&job->lock);
+        if (fd != -1) {
+            close(fd);
+        }
+        return NULL;
+    }
+    bool is_sparse = (off_t) file_info.st_blocks * 512 < file_info.st_size;
+
+    while (true) {
+        pthread_mutex_lock(&job->lock);
+        uint64_t chunk_index = job->next_chunk++;
+        bool is_done = job->result == -1 || chunk_index >= job->chunks_count;
+        pthread_mutex_unlock(&job->lock);
+        if (is_done) {
+            break;
+        }
+
+        //Les morceaux hachés par une synchronisation interrompue ne sont pas relus
+        if (find_checkpoint_chunk(entry, chunk_index, job->chunk_digests[chunk_index]) == 0) {
+            continue;
+        }
+        off_t start = chunk_index * TREE_HASH_CHUNK_SIZE;
+        off_t end = start + TREE_HASH_CHUNK_SIZE < entry->size ? start + (off_t) TREE_HASH_CHUNK_SIZE : (off_t) entry->size;
+        if (digest_file_chunk(fd, start, end, is_sparse, job->chunk_digests[chunk_index]) == -1) {
+            pthread_mutex_lock(&job->lock);
+            job->result = -1;
+            pthread_mutex_unlock(&job->lock);
+            break;
+        }
+        checkpoint_chunk_digest(entry, chunk_index, job->chunk_digests[chunk_index]);
+    }
+
+    close(fd);
+    return NULL;
+}
+
+/*!
+ * @brief compute_chunk_digests computes the MD5 sums of all the chunks of a file digested as a tree
+ * Chunks are hashed in parallel by up to TREE_HASH_MAX_THREADS threads (no more than the online CPUs), and each
+ * chunk digest is recorded in the checkpoint journal, so that an interrupted hash is resumed chunk by chunk.
+ * The chunk digests are also what a transfer needs to find the chunks which changed.
+ * @param entry is a pointer to the files list entry, whose stats are already known
+ * @param chunk_digests receives the MD5 sums of the tree_hash_chunks_count(entry->size) chunks, in order
+ * @return -1 in case of error, 0 else
+ */
+int compute_chunk_digests(files_list_entry_t *entry, uint8_t (*chunk_digests)[16]) {
+    tree_hash_job_t job = {.entry = entry, .chunk_digests = chunk_digests,
+                           .chunks_count = tree_hash_chunks_count(entry->size), .next_chunk = 0, .result = 0};
+    long online_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t threads_count = online_cpus > 0 ? (size_t) online_cpus : 1;
+    if (threads_count > TREE_HASH_MAX_THREADS) {
+        threads_count = TREE_HASH_MAX_THREADS;
+    }
+    if (threads_count > job.chunks_count) {
+        threads_count = job.chunks_count;
+    }
+    if (pthread_mutex_init(&job.lock, NULL) != 0) {
+        return -1;
+    }
+
+    // Le thread appelant hache aussi des morceaux
+    pthread_t threads[TREE_HASH_MAX_THREADS];
+    size_t started = 0;
+    while (started + 1 < threads_count && pthread_create(&threads[started], NULL, hash_chunks, &job) == 0) {
+        started++;
+    }
+    hash_chunks(&job);
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&job.lock);
+    return job.result;
+}
+
+/*!
+ * @brief compute_file_md5 computes a file's MD5 sum
+ * @param the pointer to the files list entry
+ * @return -1 in case of error, 0 else
+ * Use libcrypto functions from openssl/evp.h
+ * The holes of sparse files (@see SEEK_HOLE) are not read: zeros are added to the digest instead.
+ * Files larger than TREE_HASH_THRESHOLD are digested as a tree, their chunks in parallel (@see compute_chunk_digests).
+ */
+int compute_file_md5(files_list_entry_t *entry) {
+    //Ouvrir le fichier
+    int fd = open(entry->path_and_name, O_RDONLY);
+    if (fd == -1) {
+        perror("Error opening file");
+        return -1;
+    }
+
+    struct stat file_info;
+    if (fstat(fd, &file_info) == -1) {
+        perror("Error reading file properties");
+        close(fd);
+        return -1;
+    }
+
+    off_t size = file_info.st_size;
+    bool is_sparse = (off_t) file_info.st_blocks * 512 < size;
+    uint64_t chunks_count = tree_hash_chunks_count(size);
+    if (chunks_count == 0) {
+        int result = digest_file_chunk(fd, 0, size, is_sparse, entry->md5sum);
+        close(fd);
+        return result;
+    }
+
+    close(fd);
+    if ((uint64_t) size != entry->size) {
+        fprintf(stderr, "Le fichier %s a changé pendant son analyse\n", entry->path_and_name);
+        return -1;
+    }
+
+    //Hachage en arbre : somme MD5 des sommes MD5 des morceaux, hachés en parallèle
+    uint8_t (*chunk_digests)[16] = malloc(chunks_count * 16);
+    if (chunk_digests == NULL) {
+        return -1;
+    }
+    int result = compute_chunk_digests(entry, chunk_digests);
+    if (result == 0) {
+        result = combine_chunk_digests(chunk_digests, chunks_count, entry->md5sum);
+    }
+
+    free(chunk_digests);
+    return result;
+}
+
+/*!
+ * @brief init_file_digest prepares the digest of a file whose content is read in order (while copying it for instance)
+ * It gives the same digest as compute_file_md5.
+ * @param digest is a pointer to the digest to initialize
+ * @param size is the size of the file
+ * @return -1 in case of error, 0 else
+ */
+int init_file_digest(file_digest_t *digest, uint64_t size) {
+    digest->chunk_filled = 0;
+    digest->chunk_ctx = EVP_MD_CTX_new();
+    digest->tree_ctx = tree_hash_chunks_count(size) > 0 ? EVP_MD_CTX_new() : NULL;
+    if (digest->chunk_ctx == NULL || EVP_DigestInit_ex(digest->chunk_ctx, EVP_md5(), NULL) != 1
+        || (tree_hash_chunks_count(size) > 0 && (digest->tree_ctx == NULL || EVP_DigestInit_ex(digest->tree_ctx, EVP_md5(), NULL) != 1))) {
+        EVP_MD_CTX_free(digest->chunk_ctx);
+        EVP_MD_CTX_free(digest->tree_ctx);
+        digest->chunk_ctx = NULL;
+        digest->tree_ctx = NULL;
+        return -1;
+    }
     return 0;
 }
 
+/*!
+ * @brief end_chunk_digest adds the digest of the current chunk to the tree digest, and starts the next chunk
+ * @param digest is a pointer to the digest
+ * @return -1 in case of error, 0 else
+ */
+static int end_chunk_digest(file_digest_t *digest) {
+    uint8_t chunk_md5sum[16];
+    digest->chunk_filled = 0;
+    return EVP_DigestFinal_ex(digest->chunk_ctx, chunk_md5sum, NULL) == 1
+           && EVP_DigestUpdate(digest->tree_ctx, chunk_md5sum, sizeof(chunk_md5sum)) == 1
+           && EVP_DigestInit_ex(digest->chunk_ctx, EVP_md5(), NULL) == 1 ? 0 : -1;
+}
+
+/*!
+ * @brief update_file_digest adds the next bytes of the file to its digest
+ * @param digest is a pointer to the digest
+ * @param data is the data read from the file
+ * @param length is the size of data
+ * @return -1 in case of error, 0 else
+ */
+int update_file_digest(file_digest_t *digest, const void *data, size_t length) {
+    if (digest->tree_ctx == NULL) {
+        return EVP_DigestUpdate(digest->chunk_ctx, data, length) == 1 ? 0 : -1;
+    }
+
+    const uint8_t *bytes = data;
+    while (length > 0) {
+        size_t part = TREE_HASH_CHUNK_SIZE - digest->chunk_filled < length ? TREE_HASH_CHUNK_SIZE - digest->chunk_filled : length;
+        if (EVP_DigestUpdate(digest->chunk_ctx, bytes, part) != 1) {
+            return -1;
+        }
+        digest->chunk_filled += part;
+        bytes += part;
+        length -= part;
+        if (digest->chunk_filled == TREE_HASH_CHUNK_SIZE && end_chunk_digest(digest) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*!
+ * @brief final_file_digest gives the digest of the file, and releases the digest
+ * @param digest is a pointer to the digest
+ * @param md5sum receives the digest of the file
+ * @return -1 in case of error, 0 else
+ */
+int final_file_digest(file_digest_t *digest, uint8_t *md5sum) {
+    int result = 0;
+    if (digest->tree_ctx == NULL) {
+        result = EVP_DigestFinal_ex(digest->chunk_ctx, md5sum, NULL) == 1 ? 0 : -1;
+    } else {
+        if (digest->chunk_filled > 0) {
+            result = end_chunk_digest(digest);
+        }
+        if (result == 0) {
+            result = EVP_DigestFinal_ex(digest->tree_ctx, md5sum, NULL) == 1 ? 0 : -1;
+        }
+    }
+
+    EVP_MD_CTX_free(digest->chunk_ctx);
+    EVP_MD_CTX_free(digest->tree_ctx);
+    digest->chunk_ctx = NULL;
+    digest->tree_ctx = NULL;
+    return result;
+}
+
 /*!
  * @brief directory_exists tests the existence of a directory
  * @path_to_dir a string with the path to the directory
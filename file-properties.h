@@ -2,9 +2,36 @@
 
 #include "files-list.h"
 #include <stdbool.h>
+#include <stdint.h>
+#include <openssl/evp.h>
 #include "configuration.h"
 
+// Files larger than this are digested as a tree: the MD5 sum of the MD5 sums of their chunks of
+// TREE_HASH_CHUNK_SIZE bytes, which can be hashed separately (@see compute_chunk_md5)
+// The tree digest takes the place of the MD5 sum of the file, it is not stored next to it: it is only compared
+// to other tree digests, files of the same size being digested the same way. The chunk digests are only kept
+// in the checkpoint journal while a synchronization is not complete (@see CHECKPOINT_CHUNK)
+#define TREE_HASH_THRESHOLD (256ULL * 1024 * 1024)
+#define TREE_HASH_CHUNK_SIZE (64ULL * 1024 * 1024)
+// Maximum number of threads hashing the chunks of a file
+#define TREE_HASH_MAX_THREADS 16
+
+// Digest of a file whose content is read in order
+typedef struct {
+    EVP_MD_CTX *chunk_ctx; // Digest of the current chunk, or of the whole file when it is not digested as a tree
+    EVP_MD_CTX *tree_ctx; // Digest of the chunk digests, NULL when the file is not digested as a tree
+    uint64_t chunk_filled;
+} file_digest_t;
+
 int get_file_stats(files_list_entry_t *entry);
+int read_file_stats(files_list_entry_t *entry);
 int compute_file_md5(files_list_entry_t *entry);
+uint64_t tree_hash_chunks_count(uint64_t size);
+int compute_chunk_md5(files_list_entry_t *entry, uint64_t chunk_index, uint8_t *md5sum);
+int compute_chunk_digests(files_list_entry_t *entry, uint8_t (*chunk_digests)[16]);
+int combine_chunk_digests(uint8_t (*chunk_digests)[16], uint64_t chunks_count, uint8_t *md5sum);
+int init_file_digest(file_digest_t *digest, uint64_t size);
+int update_file_digest(file_digest_t *digest, const void *data, size_t length);
+int final_file_digest(file_digest_t *digest, uint8_t *md5sum);
 bool directory_exists(char *path_to_dir);
 bool is_directory_writable(char *path_to_dir);
\ No newline at end of file
@@ -4,27 +4,113 @@
 #include <string.h>
 #include <stdio.h>
 #include "file-properties.h"
+#include "utility.h"
+#include "external-sort.h"
+#include <sys/mman.h>
+
+/*!
+ * @brief init_files_list initializes an empty files list
+ * @param list is a pointer to the list
+ * @param root is the directory whose entries the list holds, their keys are their paths relative to it
+ */
+void init_files_list(files_list_t *list, char *root) {
+    list->head = NULL;
+    list->tail = NULL;
+    init_arena(&list->arena);
+    list->root = root;
+    list->root_length = relative_path_start(root);
+}
 
 /*!
  * @brief clear_files_list clears a files list
  * @param list is a pointer to the list to be cleared
- * This function is provided, you don't need to implement nor modify it
+ * All its entries are released at once, with the arena they were allocated from.
  */
 void clear_files_list(files_list_t *list) {
-    while (list->head) {
-        files_list_entry_t *tmp = list->head;
-        list->head = tmp->next;
-        free(tmp);
+    clear_arena(&list->arena);
+    list->head = NULL;
+    list->tail = NULL;
+}
+
+/*!
+ * @brief files_list_entry_size gives the size of an entry, up to the end of its path
+ * Only this part of an entry is allocated in a list, or copied.
+ * @param entry is a pointer to the entry
+ * @return the size of the entry in bytes
+ */
+size_t files_list_entry_size(files_list_entry_t *entry) {
+    return offsetof(files_list_entry_t, path_and_name) + strlen(entry->path_and_name) + 1;
+}
+
+/*!
+ * @brief hash_key computes the hash of a key
+ * @param key is the key
+ * @param length is the length of the key
+ * @return the FNV-1a hash of the key
+ */
+static uint32_t hash_key(char *key, size_t length) {
+    uint32_t hash = 0x811C9DC5;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char) key[i]) * 0x01000193;
     }
+    return hash;
+}
+
+/*!
+ * @brief set_entry_key computes the key of an entry, with its length and hash
+ * It is done once when the entry is added to a list, so that comparing entries does not scan their paths again.
+ * @param entry is a pointer to the entry, whose path is set
+ * @param root_length is the position of the key in the path (@see relative_path_start)
+ */
+void set_entry_key(files_list_entry_t *entry, size_t root_length) {
+    size_t path_length = strlen(entry->path_and_name);
+    entry->key_offset = root_length < path_length ? root_length : path_length;
+    entry->key_length = path_length - entry->key_offset;
+    entry->key_hash = hash_key(entry->path_and_name + entry->key_offset, entry->key_length);
+}
+
+/*!
+ * @brief compare_entry_keys orders two entries by their keys
+ * The order is the one of strcmp on the keys, entries of different roots can be compared.
+ * @param lhd is a pointer to the first entry
+ * @param rhd is a pointer to the second entry
+ * @return the order of the entries, like strcmp
+ */
+int compare_entry_keys(files_list_entry_t *lhd, files_list_entry_t *rhd) {
+    size_t length = lhd->key_length < rhd->key_length ? lhd->key_length : rhd->key_length;
+    int order = memcmp(lhd->path_and_name + lhd->key_offset, rhd->path_and_name + rhd->key_offset, length);
+    if (order != 0) {
+        return order;
+    }
+    return (lhd->key_length > rhd->key_length) - (lhd->key_length < rhd->key_length);
+}
+
+/*!
+ * @brief new_files_list_entry allocates an entry in the arena of a list
+ * @param list is a pointer to the list which will own the entry
+ * @param path is the path of the entry
+ * @return a pointer to the entry, whose properties are zeroed, NULL if memory is exhausted
+ */
+static files_list_entry_t *new_files_list_entry(files_list_t *list, char *path) {
+    size_t path_length = strnlen(path, sizeof(((files_list_entry_t *) NULL)->path_and_name) - 1);
+    files_list_entry_t *entry = arena_alloc(&list->arena, offsetof(files_list_entry_t, path_and_name) + path_length + 1);
+    if (entry == NULL) {
+        return NULL;
+    }
+
+    memset(entry, 0, offsetof(files_list_entry_t, path_and_name));
+    memcpy(entry->path_and_name, path, path_length);
+    entry->path_and_name[path_length] = '\0';
+    set_entry_key(entry, list->root_length);
+    return entry;
 }
 
 /*!
  *  @brief add_file_entry adds a new file to the files list.
- *  It adds the file in an ordered manner (strcmp) and fills its properties
- *  by calling stat on the file.
+ *  It adds the file in the order of the keys (@see compare_entry_keys).
  *  Il the file already exists, it does nothing and returns 0
  *  @param list the list to add the file entry into
- *  @param file_path the full path (from the root of the considered tree) of the file
+ *  @param file_path the full path of the file, starting with the root of the list
  *  @return 0 if success, -1 else (out of memory)
  */
 files_list_entry_t *add_file_entry(files_list_t *list, char *file_path) {
@@ -32,24 +118,19 @@ files_list_entry_t *add_file_entry(files_list_t *list, char *file_path) {
         return NULL;
     }
 
-    files_list_entry_t *existing_entry = find_entry_by_name(list, file_path, 0, 0);
+    size_t path_length = strlen(file_path);
+    files_list_entry_t *existing_entry = find_entry_by_name(list, file_path + (list->root_length < path_length ? list->root_length : path_length));
     if (existing_entry != NULL) {
         return existing_entry;
     }
 
-    files_list_entry_t *new_entry = malloc(sizeof(files_list_entry_t));
+    files_list_entry_t *new_entry = new_files_list_entry(list, file_path);
 
     if (new_entry == NULL) {
         return NULL;
     }
 
-
-    strncpy(new_entry->path_and_name, file_path, sizeof(new_entry->path_and_name) - 1);
-    new_entry->path_and_name[sizeof(new_entry->path_and_name) - 1] = '\0';
-    new_entry->prev = NULL;
-    new_entry->next = NULL;
-
-    if (list->head == NULL || strcmp(file_path, list->head->path_and_name) < 0) {
+    if (list->head == NULL || compare_entry_keys(new_entry, list->head) < 0) {
         // Insérer au début de la liste (liste vide ou nouveau premier élément)
         new_entry->next = list->head;
         if (list->head != NULL) {
@@ -58,7 +139,7 @@ files_list_entry_t *add_file_entry(files_list_t *list, char *file_path) {
         list->head = new_entry;
     } else {
         files_list_entry_t *current = list->head;
-        while (current->next != NULL && strcmp(file_path, current->next->path_and_name) > 0) {
+        while (current->next != NULL && compare_entry_keys(new_entry, current->next) > 0) {
             current = current->next;
         }
 
@@ -71,15 +152,102 @@ files_list_entry_t *add_file_entry(files_list_t *list, char *file_path) {
 
         current->next = new_entry;
     }
+    if (new_entry->next == NULL) {
+        list->tail = new_entry;
+    }
 
     return new_entry;
 }
+
+/*!
+ * @brief append_file_entry adds a new file at the end of a list, without ordering it nor looking for it
+ * It is meant for listings, whose entries are all different: the list is then sorted once (@see sort_files_list).
+ * @param list the list to add the file entry into
+ * @param file_path the full path of the file, starting with the root of the list
+ * @return a pointer to the new entry, NULL if memory is exhausted
+ */
+files_list_entry_t *append_file_entry(files_list_t *list, char *file_path) {
+    if (list == NULL || file_path == NULL) {
+        return NULL;
+    }
+
+    files_list_entry_t *new_entry = new_files_list_entry(list, file_path);
+    if (new_entry == NULL) {
+        return NULL;
+    }
+
+    new_entry->prev = list->tail;
+    if (list->tail != NULL) {
+        list->tail->next = new_entry;
+    } else {
+        list->head = new_entry;
+    }
+    list->tail = new_entry;
+    return new_entry;
+}
+
+/*!
+ * @brief sort_files_list orders the entries of a list by their keys (@see compare_entry_keys)
+ * It is a bottom-up merge sort of the links, in O(n log n) without allocation; equal keys keep their order.
+ * @param list is a pointer to the list to sort
+ */
+void sort_files_list(files_list_t *list) {
+    files_list_entry_t *head = list->head;
+    for (size_t run_length = 1; head != NULL; run_length *= 2) {
+        files_list_entry_t *remaining = head;
+        files_list_entry_t *tail = NULL;
+        head = NULL;
+        size_t merges_count = 0;
+
+        //Fusion deux à deux des séries triées de run_length entrées
+        while (remaining != NULL) {
+            merges_count++;
+            files_list_entry_t *left = remaining;
+            size_t left_length = 0;
+            while (remaining != NULL && left_length < run_length) {
+                remaining = remaining->next;
+                left_length++;
+            }
+            files_list_entry_t *right = remaining;
+            size_t right_length = run_length;
+
+            while (left_length > 0 || (right_length > 0 && right != NULL)) {
+                files_list_entry_t *next;
+                if (left_length > 0 && (right_length == 0 || right == NULL || compare_entry_keys(left, right) <= 0)) {
+                    next = left;
+                    left = left->next;
+                    left_length--;
+                } else {
+                    next = right;
+                    right = right->next;
+                    right_length--;
+                }
+                if (tail != NULL) {
+                    tail->next = next;
+                } else {
+                    head = next;
+                }
+                next->prev = tail;
+                tail = next;
+            }
+            remaining = right;
+        }
+        tail->next = NULL;
+
+        if (merges_count <= 1) {
+            list->head = head;
+            list->tail = tail;
+            return;
+        }
+    }
+}
+
 /*!
  * @brief add_entry_to_tail adds an entry directly to the tail of the list
  * It supposes that the entries are provided already ordered, e.g. when a lister process sends its list's
  * elements to the main process.
  * @param list is a pointer to the list to which to add the element
- * @param entry is a pointer to the entry to add. The list becomes owner of the entry.
+ * @param entry is a pointer to the entry to add, which is copied into the list
  * @return 0 in case of success, -1 else
  */
 int add_entry_to_tail(files_list_t *list, files_list_entry_t *entry) {
@@ -87,8 +255,12 @@ int add_entry_to_tail(files_list_t *list, files_list_entry_t *entry) {
         return -1;
     }
 
-    files_list_entry_t *new_el = malloc(sizeof(*entry));
-    *new_el = *entry;
+    files_list_entry_t *new_el = arena_alloc(&list->arena, files_list_entry_size(entry));
+    if (new_el == NULL) {
+        return -1;
+    }
+    memcpy(new_el, entry, files_list_entry_size(entry));
+    set_entry_key(new_el, list->root_length);
 
     if (list->head == NULL) {
         list->head = new_el;
@@ -108,25 +280,23 @@ int add_entry_to_tail(files_list_t *list, files_list_entry_t *entry) {
 
 /*!
  *  @brief find_entry_by_name looks up for a file in a list
- *  The function uses the ordering of the entries to interrupt its search
+ *  Only the entries with the same key length and hash have their key compared.
  *  @param list the list to look into
- *  @param file_path the full path of the file to look for
- *  @param start_of_src the position of the name of the file in the source directory (removing the source path)
- *  @param start_of_dest the position of the name of the file in the destination dir (removing the dest path)
+ *  @param key the path of the file relative to the root of the list
  *  @return a pointer to the element found, NULL if none were found.
  */
-files_list_entry_t *find_entry_by_name(files_list_t *list, char *file_path, size_t start_of_src, size_t start_of_dest) {
-    if (list == NULL || file_path == NULL) {
+files_list_entry_t *find_entry_by_name(files_list_t *list, char *key) {
+    if (list == NULL || key == NULL) {
         return NULL;
     }
 
-    files_list_entry_t *actuel = list->head;
-
-    while (actuel != NULL) {
-        if (strcmp(actuel->path_and_name + start_of_src, file_path + start_of_dest) == 0) {
+    size_t length = strlen(key);
+    uint32_t hash = hash_key(key, length);
+    for (files_list_entry_t *actuel = list->head; actuel != NULL; actuel = actuel->next) {
+        if (actuel->key_length == length && actuel->key_hash == hash
+            && memcmp(actuel->path_and_name + actuel->key_offset, key, length) == 0) {
             return actuel;
         }
-        actuel = actuel->next;
     }
 
     return NULL;
@@ -160,3 +330,78 @@ void display_files_list_reversed(files_list_t *list) {
         printf("%s\n", cursor->path_and_name);
     }
 }
+
+/*!
+ * @brief init_references_list initializes an empty references list
+ * @param list is a pointer to the list
+ */
+void init_references_list(references_list_t *list) {
+    list->references = NULL;
+    list->count = 0;
+    list->capacity = 0;
+    list->is_region = false;
+}
+
+/*!
+ * @brief add_reference adds a reference to an entry at the end of a references list
+ * The entry is not copied: it must stay in its own list as long as the reference is used.
+ * With a memory limit, the references are written to a region backed by a temporary file, which is never moved.
+ * @param list is a pointer to the references list
+ * @param entry is a pointer to the entry
+ * @param change_kind is the change to apply to the entry
+ * @return 0 in case of success, -1 else (out of memory)
+ */
+int add_reference(references_list_t *list, files_list_entry_t *entry, change_kind_t change_kind) {
+    if (list->capacity == 0 && is_sorting_out_of_core()) {
+        list->references = map_spill_region(SPILL_REGION_SIZE);
+        if (list->references == NULL) {
+            return -1;
+        }
+        list->is_region = true;
+        list->capacity = SPILL_REGION_SIZE / sizeof(entry_reference_t);
+    }
+    if (list->count == list->capacity) {
+        if (list->is_region) {
+            return -1;
+        }
+        size_t capacity = list->capacity == 0 ? 1024 : list->capacity * 2;
+        entry_reference_t *references = realloc(list->references, capacity * sizeof(entry_reference_t));
+        if (references == NULL) {
+            return -1;
+        }
+        list->references = references;
+        list->capacity = capacity;
+    }
+
+    list->references[list->count].entry = entry;
+    list->references[list->count].change_kind = change_kind;
+    list->count++;
+    return 0;
+}
+
+/*!
+ * @brief clear_references_list releases a references list, the referenced entries being left untouched
+ * @param list is a pointer to the list
+ */
+void clear_references_list(references_list_t *list) {
+    if (list->is_region) {
+        munmap(list->references, SPILL_REGION_SIZE);
+    } else {
+        free(list->references);
+    }
+    init_references_list(list);
+}
+
+/*!
+ * @brief display_references_list displays the entries of a references list
+ * @param list is the pointer to the list to be displayed
+ */
+void display_references_list(references_list_t *list) {
+    if (!list)
+        return;
+    printf("\n----\n");
+    for (size_t i = 0; i < list->count; i++) {
+        printf("%s\n", list->references[i].entry->path_and_name);
+    }
+    printf("----\n");
+}
@@ -1,30 +1,75 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <time.h>
 #include <sys/types.h>
+#include "arena.h"
 
 typedef enum { FICHIER, DOSSIER } file_type_t;
 
+// Kind of change of a source entry compared to the destination, set on the entries of the differences list
+// (CHANGE_DELETE is the kind of the destination entries absent from the source, set on them once removed;
+// CHANGE_FAILED is set on the source entries whose change could not be applied, @see write_manifest)
+typedef enum { CHANGE_NONE, CHANGE_CONTENT, CHANGE_METADATA, CHANGE_DELETE, CHANGE_FAILED } change_kind_t;
+
+// The path is the last member: the entries of a list are cut after the end of their path (@see files_list_entry_size)
+// Entries are named by their key, the part of their path relative to the root of their list (@see set_entry_key)
 typedef struct _files_list_entry {
-  char path_and_name[4096];
   struct timespec mtime;
+  struct timespec ctime; // Change of the content or of the attributes, which cannot be set back (@see QUICK_CHECK_CTIME)
   uint64_t size;
-  uint8_t md5sum[16];
+  uint8_t md5sum[16]; // Tree digest for the files larger than TREE_HASH_THRESHOLD
   file_type_t entry_type;
   mode_t mode;
+  dev_t device;
+  ino_t inode;
+  nlink_t links_count;
+  change_kind_t change_kind;
   struct _files_list_entry *next;
   struct _files_list_entry *prev;
+  uint32_t key_hash;
+  uint16_t key_offset; // The key is path_and_name + key_offset
+  uint16_t key_length;
+  char path_and_name[4096];
 } files_list_entry_t;
 
 typedef struct {
   struct _files_list_entry *head;
   struct _files_list_entry *tail;
+  arena_t arena; // Memory of the entries, released at once by clear_files_list
+  char *root; // Directory whose entries are listed, it must outlive the list
+  size_t root_length; // Position of the keys in the paths of the entries (@see relative_path_start)
 } files_list_t;
 
+// A reference to an entry of a list, with the change to apply to it
+typedef struct {
+  files_list_entry_t *entry;
+  change_kind_t change_kind;
+} entry_reference_t;
+
+// Entries of another list, referenced in order without being copied (@see make_differences_list)
+typedef struct {
+  entry_reference_t *references;
+  size_t count;
+  size_t capacity;
+  bool is_region; // Set to true when the references are in a region backed by a temporary file (@see map_spill_region)
+} references_list_t;
+
+void init_files_list(files_list_t *list, char *root);
 void clear_files_list(files_list_t *list);
+size_t files_list_entry_size(files_list_entry_t *entry);
+void set_entry_key(files_list_entry_t *entry, size_t root_length);
+int compare_entry_keys(files_list_entry_t *lhd, files_list_entry_t *rhd);
 files_list_entry_t *add_file_entry(files_list_t *list, char *file_path);
+files_list_entry_t *append_file_entry(files_list_t *list, char *file_path);
+void sort_files_list(files_list_t *list);
 int add_entry_to_tail(files_list_t *list, files_list_entry_t *entry);
-files_list_entry_t *find_entry_by_name(files_list_t *list, char *file_path, size_t start_of_src, size_t start_of_dest);
+files_list_entry_t *find_entry_by_name(files_list_t *list, char *key);
 void display_files_list(files_list_t *list);
 void display_files_list_reversed(files_list_t *list);
+void init_references_list(references_list_t *list);
+int add_reference(references_list_t *list, files_list_entry_t *entry, change_kind_t change_kind);
+void clear_references_list(references_list_t *list);
+void display_references_list(references_list_t *list);
@@ -0,0 +1,457 @@
+#include "filter.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+
+// Rules given on the command line, checked first
+static filter_set_t command_line_rules;
+// Rules of the ignore files of the directories being walked, the deepest last
+static filter_set_t **ignore_rules = NULL;
+static size_t ignore_rules_count = 0;
+static size_t ignore_rules_capacity = 0;
+// Size and age limits of the files, 0 when unset
+static uint64_t min_size = 0;
+static uint64_t max_size = 0;
+static unsigned int min_age = 0;
+static unsigned int max_age = 0;
+
+/*!
+ * @brief init_filter_node initializes an empty trie node
+ * @param node is a pointer to the node
+ * @param component is the path component of the node (owned by the node), NULL for a root
+ */
+static void init_filter_node(filter_node_t *node, char *component) {
+    node->component = component;
+    node->children = NULL;
+    node->children_count = 0;
+    node->file_rule = -1;
+    node->directory_rule = -1;
+}
+
+/*!
+ * @brief clear_filter_node releases the children of a trie node and its component
+ * @param node is a pointer to the node
+ */
+static void clear_filter_node(filter_node_t *node) {
+    for (size_t i = 0; i < node->children_count; i++) {
+        clear_filter_node(&node->children[i]);
+    }
+    free(node->children);
+    free(node->component);
+    init_filter_node(node, NULL);
+}
+
+/*!
+ * @brief find_child_position searches the child of a node with a component
+ * @param node is a pointer to the node
+ * @param component is the component, which is not nul terminated
+ * @param length is the length of the component
+ * @param position receives the index of the child, or where it would be inserted
+ * @return true if the child exists
+ */
+static bool find_child_position(filter_node_t *node, char *component, size_t length, size_t *position) {
+    size_t low = 0;
+    size_t high = node->children_count;
+    while (low < high) {
+        size_t middle = (low + high) / 2;
+        char *candidate = node->children[middle].component;
+        int order = strncmp(candidate, component, length);
+        if (order == 0) {
+            order = candidate[length] == '\0' ? 0 : 1;
+        }
+        if (order == 0) {
+            *position = middle;
+            return true;
+        }
+        if (order < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    *position = low;
+    return false;
+}
+
+/*!
+ * @brief insert_literal adds the path of a rule without wildcards to a trie
+ * @param root is a pointer to the root of the trie
+ * @param rule is a pointer to the rule
+ * @param rule_index is the index of the rule
+ * @param is_last_match is true when the last rule of a path wins
+ * @return 0 in case of success, -1 else (out of memory)
+ */
+static int insert_literal(filter_node_t *root, filter_rule_t *rule, int rule_index, bool is_last_match) {
+    filter_node_t *node = root;
+    char *component = rule->pattern;
+    while (*component != '\0') {
+        size_t length = strcspn(component, "/");
+        size_t position;
+        if (!find_child_position(node, component, length, &position)) {
+            filter_node_t *children = realloc(node->children, (node->children_count + 1) * sizeof(filter_node_t));
+            char *name = strndup(component, length);
+            if (children == NULL || name == NULL) {
+                if (children != NULL) {
+                    node->children = children;
+                }
+                free(name);
+                return -1;
+            }
+            node->children = children;
+            memmove(&children[position + 1], &children[position], (node->children_count - position) * sizeof(filter_node_t));
+            init_filter_node(&children[position], name);
+            node->children_count++;
+        }
+        node = &node->children[position];
+        component += length;
+        while (*component == '/') {
+            component++;
+        }
+    }
+
+    if (node->directory_rule == -1 || is_last_match) {
+        node->directory_rule = rule_index;
+    }
+    if (!rule->is_directory_only && (node->file_rule == -1 || is_last_match)) {
+        node->file_rule = rule_index;
+    }
+    return 0;
+}
+
+/*!
+ * @brief find_literal looks a relative path up in a trie
+ * @param root is a pointer to the root of the trie
+ * @param path is the path
+ * @return the node of the path, NULL if it is not in the trie
+ */
+static filter_node_t *find_literal(filter_node_t *root, char *path) {
+    filter_node_t *node = root;
+    while (*path != '\0') {
+        size_t length = strcspn(path, "/");
+        size_t position;
+        if (!find_child_position(node, path, length, &position)) {
+            return NULL;
+        }
+        node = &node->children[position];
+        path += length;
+        while (*path == '/') {
+            path++;
+        }
+    }
+    return node;
+}
+
+/*!
+ * @brief parse_filter_rule reads a pattern, with the syntax of .gitignore files
+ * A pattern ending with '/' only matches directories. A pattern containing '/' (a leading one is removed) is
+ * matched against the path relative to the directory of the rule, else against the name of the entries.
+ * Patterns are globs (@see fnmatch), '*' does not match '/'.
+ * @param text is the pattern
+ * @param is_include is true when matching entries are kept
+ * @param rule receives the rule, whose pattern is allocated
+ * @return 0 in case of success, -1 if the pattern is empty or memory is exhausted
+ */
+static int parse_filter_rule(char *text, bool is_include, filter_rule_t *rule) {
+    size_t length = strlen(text);
+    rule->is_directory_only = false;
+    while (length > 0 && text[length - 1] == '/') {
+        rule->is_directory_only = true;
+        length--;
+    }
+    rule->is_anchored = false;
+    while (length > 0 && text[0] == '/') {
+        rule->is_anchored = true;
+        text++;
+        length--;
+    }
+    if (length == 0) {
+        return -1;
+    }
+
+    rule->pattern = strndup(text, length);
+    if (rule->pattern == NULL) {
+        return -1;
+    }
+    rule->is_include = is_include;
+    rule->is_anchored = rule->is_anchored || strchr(rule->pattern, '/') != NULL;
+    rule->has_wildcards = strpbrk(rule->pattern, "*?[\\") != NULL;
+    return 0;
+}
+
+/*!
+ * @brief add_filter_rule parses a rule and adds it to a set
+ * @param set is a pointer to the set
+ * @param text is the pattern
+ * @param is_include is true when matching entries are kept
+ * @return 0 in case of success, -1 else
+ */
+static int add_filter_rule(filter_set_t *set, char *text, bool is_include) {
+    filter_rule_t *rules = realloc(set->rules, (set->count + 1) * sizeof(filter_rule_t));
+    if (rules == NULL) {
+        return -1;
+    }
+    set->rules = rules;
+    filter_rule_t *rule = &rules[set->count];
+    if (parse_filter_rule(text, is_include, rule) == -1) {
+        return -1;
+    }
+
+    if (!rule->has_wildcards
+        && insert_literal(rule->is_anchored ? &set->paths : &set->names, rule, set->count, set->is_last_match) == -1) {
+        free(rule->pattern);
+        return -1;
+    }
+    set->count++;
+    return 0;
+}
+
+/*!
+ * @brief init_filter_set initializes an empty set of rules
+ * @param set is a pointer to the set
+ * @param is_last_match is true when the last matching rule wins
+ * @param prefix_length is the length of the relative path of the directory of the rules, with its separator
+ */
+static void init_filter_set(filter_set_t *set, bool is_last_match, size_t prefix_length) {
+    set->rules = NULL;
+    set->count = 0;
+    set->is_last_match = is_last_match;
+    init_filter_node(&set->paths, NULL);
+    init_filter_node(&set->names, NULL);
+    set->prefix_length = prefix_length;
+}
+
+/*!
+ * @brief clear_filter_set releases the rules of a set
+ * @param set is a pointer to the set
+ */
+static void clear_filter_set(filter_set_t *set) {
+    for (size_t i = 0; i < set->count; i++) {
+        free(set->rules[i].pattern);
+    }
+    free(set->rules);
+    clear_filter_node(&set->paths);
+    clear_filter_node(&set->names);
+    set->rules = NULL;
+    set->count = 0;
+}
+
+/*!
+ * @brief is_better_rule tells if a matching rule wins over the best one found so far
+ * @param set is a pointer to the set of the rules
+ * @param rule is the index of the matching rule, -1 for none
+ * @param best is the index of the best rule, -1 for none
+ * @return true if rule wins
+ */
+static bool is_better_rule(filter_set_t *set, int rule, int best) {
+    return rule != -1 && (best == -1 || (set->is_last_match ? rule > best : rule < best));
+}
+
+/*!
+ * @brief match_filter_set finds the rule of a set which applies to an entry
+ * The literals are looked up in the tries, then the globs are tried in order of priority, only as long as they
+ * could win over the literal found.
+ * @param set is a pointer to the set
+ * @param relative_path is the path of the entry, relative to the root of the walk
+ * @param is_directory is true for directories
+ * @return the index of the rule, -1 when no rule matches
+ */
+static int match_filter_set(filter_set_t *set, char *relative_path, bool is_directory) {
+    char *path = relative_path + set->prefix_length;
+    char *name = strrchr(path, '/');
+    name = name != NULL ? name + 1 : path;
+
+    int best = -1;
+    filter_node_t *node = find_literal(&set->paths, path);
+    if (node != NULL) {
+        best = is_directory ? node->directory_rule : node->file_rule;
+    }
+    node = find_literal(&set->names, name);
+    if (node != NULL && is_better_rule(set, is_directory ? node->directory_rule : node->file_rule, best)) {
+        best = is_directory ? node->directory_rule : node->file_rule;
+    }
+
+    for (size_t i = 0; i < set->count; i++) {
+        int index = set->is_last_match ? (int) (set->count - 1 - i) : (int) i;
+        if (!is_better_rule(set, index, best)) {
+            break;
+        }
+        filter_rule_t *rule = &set->rules[index];
+        if (rule->has_wildcards && (is_directory || !rule->is_directory_only)
+            && fnmatch(rule->pattern, rule->is_anchored ? path : name, rule->is_anchored ? FNM_PATHNAME : 0) == 0) {
+            return index;
+        }
+    }
+    return best;
+}
+
+/*!
+ * @brief init_filter compiles the filters of the configuration
+ * It must be called before any process is created, the listers use the same filters.
+ * @param the_config is a pointer to the configuration
+ * @return 0 in case of success, -1 if a rule is invalid
+ */
+int init_filter(configuration_t *the_config) {
+    init_filter_set(&command_line_rules, false, 0);
+    for (size_t i = 0; i < the_config->filter_rules_count; i++) {
+        char *text = the_config->filter_rules[i];
+        if (add_filter_rule(&command_line_rules, text + 1, text[0] == '+') == -1) {
+            fprintf(stderr, "Erreur: filtre invalide %s\n", text + 1);
+            return -1;
+        }
+    }
+
+    min_size = the_config->min_size;
+    max_size = the_config->max_size;
+    min_age = the_config->min_age;
+    max_age = the_config->max_age;
+    return 0;
+}
+
+/*!
+ * @brief enter_filter_directory reads the ignore file of a directory, whose rules apply until it is left
+ * @param directory_path is the path of the directory
+ * @param relative_path is the path of the directory relative to the root of the walk ("" for the root)
+ * @return true if the directory has an ignore file, which leave_filter_directory must then release
+ */
+bool enter_filter_directory(char *directory_path, char *relative_path) {
+    char ignore_path[PATH_SIZE];
+    if (snprintf(ignore_path, sizeof(ignore_path), "%s/%s", directory_path, IGNORE_FILE_NAME) >= PATH_SIZE) {
+        return false;
+    }
+    FILE *ignore_file = fopen(ignore_path, "r");
+    if (ignore_file == NULL) {
+        return false;
+    }
+
+    if (ignore_rules_count == ignore_rules_capacity) {
+        size_t capacity = ignore_rules_capacity * 2 + 8;
+        filter_set_t **sets = realloc(ignore_rules, capacity * sizeof(filter_set_t *));
+        if (sets == NULL) {
+            perror("Mémoire insuffisante pour les filtres");
+            fclose(ignore_file);
+            return false;
+        }
+        ignore_rules = sets;
+        ignore_rules_capacity = capacity;
+    }
+    filter_set_t *set = malloc(sizeof(filter_set_t));
+    if (set == NULL) {
+        perror("Mémoire insuffisante pour les filtres");
+        fclose(ignore_file);
+        return false;
+    }
+
+    size_t relative_length = strlen(relative_path);
+    init_filter_set(set, true, relative_length > 0 ? relative_length + 1 : 0);
+    char line[PATH_SIZE];
+    while (fgets(line, sizeof(line), ignore_file) != NULL) {
+        size_t length = strcspn(line, "\r\n");
+        while (length > 0 && line[length - 1] == ' ') {
+            length--;
+        }
+        line[length] = '\0';
+        if (length == 0 || line[0] == '#') {
+            continue;
+        }
+        bool is_include = line[0] == '!';
+        if (add_filter_rule(set, line + (is_include ? 1 : 0), is_include) == -1) {
+            fprintf(stderr, "Filtre invalide dans %s : %s\n", ignore_path, line);
+        }
+    }
+    fclose(ignore_file);
+
+    ignore_rules[ignore_rules_count++] = set;
+    return true;
+}
+
+/*!
+ * @brief leave_filter_directory releases the rules of the last ignore file read
+ */
+void leave_filter_directory() {
+    if (ignore_rules_count == 0) {
+        return;
+    }
+    filter_set_t *set = ignore_rules[--ignore_rules_count];
+    clear_filter_set(set);
+    free(set);
+}
+
+/*!
+ * @brief is_entry_excluded tells if an entry of the walked tree must be skipped (with its content)
+ * The rules of the command line are checked first, the first matching one applying. Without one, the ignore
+ * files are checked from the deepest directory. The size and age limits then apply to files, which are only
+ * stated when there are such limits.
+ * @param path is the path of the entry
+ * @param relative_start is the position of the path relative to the root of the walk
+ * @param is_directory is true for directories
+ * @return true if the entry is excluded
+ */
+bool is_entry_excluded(char *path, size_t relative_start, bool is_directory) {
+    char *relative_path = path + relative_start;
+    int rule = match_filter_set(&command_line_rules, relative_path, is_directory);
+    if (rule != -1) {
+        if (!command_line_rules.rules[rule].is_include) {
+            return true;
+        }
+    } else {
+        for (size_t i = ignore_rules_count; i > 0; i--) {
+            rule = match_filter_set(ignore_rules[i - 1], relative_path, is_directory);
+            if (rule != -1) {
+                if (!ignore_rules[i - 1]->rules[rule].is_include) {
+                    return true;
+                }
+                break;
+            }
+        }
+    }
+
+    if (is_directory || (min_size == 0 && max_size == 0 && min_age == 0 && max_age == 0)) {
+        return false;
+    }
+    struct stat entry_stat;
+    if (lstat(path, &entry_stat) == -1) {
+        return false;
+    }
+    time_t age = time(NULL) - entry_stat.st_mtime;
+    return (uint64_t) entry_stat.st_size < min_size || (max_size > 0 && (uint64_t) entry_stat.st_size > max_size)
+           || age < min_age || (max_age > 0 && age > max_age);
+}
+
+/*!
+ * @brief is_path_excluded tells if a path of a tree is excluded, by itself or by one of its parents
+ * The ignore files of its parents are read on the way, it is meant for single paths (@see process_journal).
+ * @param root is the root of the tree
+ * @param relative_path is the path relative to the root
+ * @param is_directory is true for directories
+ * @return true if the path is excluded
+ */
+bool is_path_excluded(char *root, char *relative_path, bool is_directory) {
+    char path[PATH_SIZE];
+    int relative_start = snprintf(path, sizeof(path), "%s/", root);
+    if (relative_start >= PATH_SIZE || relative_start + strlen(relative_path) >= PATH_SIZE) {
+        return false;
+    }
+    strcpy(path + relative_start, relative_path);
+
+    size_t entered_count = enter_filter_directory(root, "") ? 1 : 0;
+    bool is_excluded = false;
+    for (char *separator = strchr(path + relative_start, '/'); separator != NULL && !is_excluded; separator = strchr(separator + 1, '/')) {
+        *separator = '\0';
+        is_excluded = is_entry_excluded(path, relative_start, true);
+        if (!is_excluded && enter_filter_directory(path, path + relative_start)) {
+            entered_count++;
+        }
+        *separator = '/';
+    }
+    if (!is_excluded) {
+        is_excluded = is_entry_excluded(path, relative_start, is_directory);
+    }
+
+    for (; entered_count > 0; entered_count--) {
+        leave_filter_directory();
+    }
+    return is_excluded;
+}
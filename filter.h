@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "configuration.h"
+#include "defines.h"
+
+// File of a directory whose lines are exclude patterns for its content ("!pattern" includes, "#" comments)
+#define IGNORE_FILE_NAME ".syncignore"
+
+// Pattern of a filter rule (@see parse_filter_rule)
+typedef struct {
+    char *pattern;
+    bool is_include; // Set to true when matching entries are kept, false when they are excluded
+    bool is_directory_only; // Set to true when the pattern ends with '/'
+    bool is_anchored; // Set to true when the pattern contains '/': it matches the relative path, not the name
+    bool has_wildcards; // Set to false when the pattern is a literal, which is looked up in a trie
+} filter_rule_t;
+
+// Node of a trie of path components, for the rules without wildcards
+typedef struct _filter_node {
+    char *component;
+    struct _filter_node *children; // Ordered by component, for a binary search
+    size_t children_count;
+    int file_rule; // First rule of this path for files (last rule for ignore files), -1 when there is none
+    int directory_rule;
+} filter_node_t;
+
+// Compiled rules of the command line or of an ignore file
+typedef struct {
+    filter_rule_t *rules;
+    size_t count;
+    bool is_last_match; // Set to true for ignore files, where the last matching rule wins (the first one else)
+    filter_node_t paths; // Trie of the anchored literals
+    filter_node_t names; // Trie of the name literals, with a single level
+    size_t prefix_length; // Length of the relative path of the directory of the rules, with its separator
+} filter_set_t;
+
+int init_filter(configuration_t *the_config);
+bool enter_filter_directory(char *directory_path, char *relative_path);
+void leave_filter_directory();
+bool is_entry_excluded(char *path, size_t relative_start, bool is_directory);
+bool is_path_excluded(char *root, char *relative_path, bool is_directory);
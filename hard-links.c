@@ -0,0 +1,108 @@
+#include "hard-links.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+/*!
+ * @brief hard_link_slot gives the first slot to probe for an inode
+ * @param table is a pointer to the table (its capacity is a power of 2)
+ * @param device is the device of the inode
+ * @param inode is the inode number
+ * @return the index of the slot
+ */
+static size_t hard_link_slot(hard_links_table_t *table, dev_t device, ino_t inode) {
+    uint64_t hash = ((uint64_t) inode * 0x9E3779B97F4A7C15ULL) ^ ((uint64_t) device * 0xC2B2AE3D27D4EB4FULL);
+    return (hash ^ (hash >> 29)) & (table->capacity - 1);
+}
+
+/*!
+ * @brief init_hard_links_table initializes an empty table
+ * @param table is a pointer to the table to initialize
+ */
+void init_hard_links_table(hard_links_table_t *table) {
+    table->slots = NULL;
+    table->capacity = 0;
+    table->count = 0;
+}
+
+/*!
+ * @brief find_hard_link looks up an inode in the table
+ * @param table is a pointer to the table
+ * @param device is the device of the inode
+ * @param inode is the inode number
+ * @return a pointer to the inode slot, NULL if the inode is not in the table
+ * The pointer is valid until the next call to add_hard_link.
+ */
+hard_link_t *find_hard_link(hard_links_table_t *table, dev_t device, ino_t inode) {
+    if (table->capacity == 0) {
+        return NULL;
+    }
+
+    for (size_t index = hard_link_slot(table, device, inode); table->slots[index].entry != NULL; index = (index + 1) & (table->capacity - 1)) {
+        if (table->slots[index].device == device && table->slots[index].inode == inode) {
+            return &table->slots[index];
+        }
+    }
+    return NULL;
+}
+
+/*!
+ * @brief add_hard_link adds the inode of an entry to the table, if it is not already there
+ * The table is grown when half full.
+ * @param table is a pointer to the table
+ * @param entry is the entry whose inode to add
+ * @return a pointer to the inode slot (new or existing), NULL if out of memory
+ * The pointer is valid until the next call to add_hard_link.
+ */
+hard_link_t *add_hard_link(hard_links_table_t *table, files_list_entry_t *entry) {
+    hard_link_t *existing = find_hard_link(table, entry->device, entry->inode);
+    if (existing != NULL) {
+        return existing;
+    }
+
+    if ((table->count + 1) * 2 > table->capacity) {
+        hard_links_table_t grown;
+        grown.capacity = table->capacity == 0 ? 1024 : table->capacity * 2;
+        grown.count = table->count;
+        grown.slots = calloc(grown.capacity, sizeof(hard_link_t));
+        if (grown.slots == NULL) {
+            return NULL;
+        }
+
+        for (size_t i = 0; i < table->capacity; i++) {
+            if (table->slots[i].entry != NULL) {
+                size_t index = hard_link_slot(&grown, table->slots[i].device, table->slots[i].inode);
+                while (grown.slots[index].entry != NULL) {
+                    index = (index + 1) & (grown.capacity - 1);
+                }
+                grown.slots[index] = table->slots[i];
+            }
+        }
+        free(table->slots);
+        *table = grown;
+    }
+
+    size_t index = hard_link_slot(table, entry->device, entry->inode);
+    while (table->slots[index].entry != NULL) {
+        index = (index + 1) & (table->capacity - 1);
+    }
+
+    table->slots[index].device = entry->device;
+    table->slots[index].inode = entry->inode;
+    table->slots[index].entry = entry;
+    table->slots[index].destination_path = NULL;
+    table->count++;
+    return &table->slots[index];
+}
+
+/*!
+ * @brief clear_hard_links_table frees the table and the destination paths it owns
+ * @param table is a pointer to the table to clear
+ */
+void clear_hard_links_table(hard_links_table_t *table) {
+    for (size_t i = 0; i < table->capacity; i++) {
+        free(table->slots[i].destination_path);
+    }
+    free(table->slots);
+    init_hard_links_table(table);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "files-list.h"
+
+// An inode with several links in a tree, identified by its device and inode numbers
+typedef struct {
+    dev_t device;
+    ino_t inode;
+    files_list_entry_t *entry; // First entry found for the inode, whose MD5 sum is shared by the other links
+    char *destination_path; // Destination file holding the inode content, NULL until there is one
+} hard_link_t;
+
+// Hash table of the inodes, with open addressing
+typedef struct {
+    hard_link_t *slots;
+    size_t capacity;
+    size_t count;
+} hard_links_table_t;
+
+void init_hard_links_table(hard_links_table_t *table);
+hard_link_t *find_hard_link(hard_links_table_t *table, dev_t device, ino_t inode);
+hard_link_t *add_hard_link(hard_links_table_t *table, files_list_entry_t *entry);
+void clear_hard_links_table(hard_links_table_t *table);
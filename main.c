@@ -4,13 +4,18 @@
 #include <configuration.h>
 #include <file-properties.h>
 #include <processes.h>
+#include <watch.h>
+#include <throttle.h>
+#include <placement.h>
+#include <filter.h>
+#include <external-sort.h>
 #include <unistd.h>
 
 /*!
  * @brief main function, calling all the mechanics of the program
  * @param argc its number of arguments, including its own name
  * @param argv the array of arguments
- * @return 0 in case of success, -1 else
+ * @return 0 in case of success, EXIT_PARTIAL_FAILURE when some entries could not be synchronized, -1 else
  * Function is already provided with full implementation, you **shall not** modify it.
  */
 int main(int argc, char *argv[]) {
@@ -30,21 +35,57 @@ int main(int argc, char *argv[]) {
         printf("Either source or destination directory do not exist\nAborting\n");
         return -1;
     }
+    if (my_config.link_dest[0] != '\0' && !directory_exists(my_config.link_dest)) {
+        printf("Previous backup directory %s does not exist\nAborting\n", my_config.link_dest);
+        return -1;
+    }
     // Is destination writable?
     if (!is_directory_writable(my_config.destination)) {
         printf("Destination directory %s is not writable\n", my_config.destination);
         return -1;
     }
 
+    // I/O limits are shared by all the processes, so they are set before forking
+    if (init_io_scheduler(&my_config) == -1) {
+        return -1;
+    }
+
+    // Filters are compiled once, the listers inherit them
+    if (init_filter(&my_config) == -1) {
+        return -1;
+    }
+
+    // The memory of the listings is set before forking, their temporary files go to the destination
+    if (init_external_sort(&my_config) == -1) {
+        return -1;
+    }
+
+    // Workers are placed on their CPUs by the processes themselves, from the placement set before forking
+    if (init_placement(&my_config) == -1) {
+        return -1;
+    }
+
     // Prepare (fork, MQ) if parallel
     process_context_t processes_context;
-    prepare(&my_config, &processes_context);
+    if (prepare(&my_config, &processes_context) == -1) {
+        fprintf(stderr, "Les processus parallèles ne peuvent pas être créés, la synchronisation se fera sans eux\n");
+        stop_processes(&my_config, &processes_context);
+    }
 
-    // Run synchronize:
-    synchronize(&my_config, &processes_context);
+    // Run synchronize (continuously in watch mode):
+    sync_status_t status = SYNC_COMPLETE;
+    if (my_config.watch) {
+        watch_source(&my_config, &processes_context);
+    } else {
+        status = synchronize(&my_config, &processes_context);
+    }
     
     // Clean resources
     clean_processes(&my_config, &processes_context);
 
-    return 0;
+    // The exit code tells scripts whether the destination is a complete copy
+    if (status == SYNC_PARTIAL) {
+        return EXIT_PARTIAL_FAILURE;
+    }
+    return status == SYNC_FAILED ? EXIT_TOTAL_FAILURE : 0;
 }
@@ -0,0 +1,362 @@
+#include "manifest.h"
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "defines.h"
+#include "utility.h"
+
+// Manifest of the destination mapped during the listing of the source, whose MD5 sums are reused
+static uint8_t *digests_mapping = NULL;
+static size_t digests_mapping_size = 0;
+static quick_check_t digests_quick_check = QUICK_CHECK_MTIME;
+
+/*!
+ * @brief map_manifest maps the manifest stored at the root of a destination and checks its header
+ * @param root is the destination directory containing the manifest
+ * @param manifest_size receives the size of the mapping
+ * @return the mapping, NULL if there is no usable manifest
+ */
+static uint8_t *map_manifest(char *root, size_t *manifest_size) {
+    char manifest_path[PATH_SIZE];
+    if (snprintf(manifest_path, sizeof(manifest_path), "%s/%s", root, MANIFEST_FILE_NAME) >= PATH_SIZE) {
+        return NULL;
+    }
+
+    int fd = open(manifest_path, O_RDONLY);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    struct stat manifest_stat;
+    if (fstat(fd, &manifest_stat) == -1 || (size_t) manifest_stat.st_size < sizeof(manifest_header_t)) {
+        close(fd);
+        return NULL;
+    }
+
+    *manifest_size = manifest_stat.st_size;
+    uint8_t *mapping = mmap(NULL, *manifest_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        perror("Erreur lors du mappage du manifeste");
+        return NULL;
+    }
+
+    // Vérification de l'entête avant toute lecture des enregistrements
+    manifest_header_t *header = (manifest_header_t *) mapping;
+    size_t records_size = (size_t) header->entries_count * sizeof(manifest_record_t);
+    if (memcmp(header->magic, MANIFEST_MAGIC, sizeof(header->magic)) != 0 || header->version != MANIFEST_VERSION
+        || header->strings_offset != sizeof(manifest_header_t) + records_size
+        || header->strings_offset + header->strings_size != *manifest_size) {
+        fprintf(stderr, "Manifeste %s invalide, la destination sera parcourue\n", manifest_path);
+        munmap(mapping, *manifest_size);
+        return NULL;
+    }
+
+    return mapping;
+}
+
+/*!
+ * @brief load_manifest builds a files list from the manifest stored at the root of a destination
+ * The manifest is mapped in memory and its records are appended in order, with their path prefixed by root,
+ * so that the resulting list is identical to the one make_files_list would have built.
+ * @param list is a pointer to the (empty) list to fill
+ * @param root is the destination directory containing the manifest
+ * @return 0 if the list was loaded, -1 if there is no usable manifest (the caller must scan the destination)
+ */
+int load_manifest(files_list_t *list, char *root) {
+    size_t manifest_size;
+    uint8_t *mapping = map_manifest(root, &manifest_size);
+    if (mapping == NULL) {
+        return -1;
+    }
+
+    manifest_header_t *header = (manifest_header_t *) mapping;
+    manifest_record_t *records = (manifest_record_t *) (mapping + sizeof(manifest_header_t));
+    char *strings = (char *) (mapping + header->strings_offset);
+    size_t root_length = relative_path_start(root);
+    files_list_entry_t entry;
+    memset(&entry, 0, sizeof(entry));
+
+    for (uint32_t i = 0; i < header->entries_count; i++) {
+        manifest_record_t *record = &records[i];
+        if (record->path_offset + record->path_length > header->strings_size
+            || root_length + record->path_length >= sizeof(entry.path_and_name)) {
+            fprintf(stderr, "Manifeste de %s corrompu, la destination sera parcourue\n", root);
+            clear_files_list(list);
+            list->head = NULL;
+            list->tail = NULL;
+            munmap(mapping, manifest_size);
+            return -1;
+        }
+
+        snprintf(entry.path_and_name, sizeof(entry.path_and_name), "%s%s%.*s", root,
+                 root_length > strlen(root) ? "/" : "", (int) record->path_length, strings + record->path_offset);
+        entry.mode = record->mode;
+        entry.size = record->size;
+        entry.mtime.tv_sec = record->mtime_sec;
+        entry.mtime.tv_nsec = record->mtime_nsec;
+        memcpy(entry.md5sum, record->md5sum, sizeof(entry.md5sum));
+        entry.entry_type = S_ISDIR(entry.mode) ? DOSSIER : FICHIER;
+        //Une liste tronquée ferait recopier ou supprimer des entrées à tort
+        if (add_entry_to_tail(list, &entry) == -1) {
+            fprintf(stderr, "Mémoire insuffisante pour le manifeste de %s, la destination sera parcourue\n", root);
+            clear_files_list(list);
+            munmap(mapping, manifest_size);
+            return -1;
+        }
+    }
+
+    munmap(mapping, manifest_size);
+    return 0;
+}
+
+/*!
+ * @brief fill_manifest_record fills a record from a files list entry
+ * @param record is a pointer to the record to fill
+ * @param entry is the entry whose properties are saved
+ * @param path_offset is the offset of the entry relative path in the strings pool
+ * @param path_length is the length of this relative path
+ */
+static void fill_manifest_record(manifest_record_t *record, files_list_entry_t *entry, uint64_t path_offset, uint32_t path_length) {
+    memset(record, 0, sizeof(*record));
+    record->path_offset = path_offset;
+    record->path_length = path_length;
+    record->mode = entry->mode;
+    record->size = entry->size;
+    record->mtime_sec = entry->mtime.tv_sec;
+    record->mtime_nsec = entry->mtime.tv_nsec;
+    record->ctime_sec = entry->ctime.tv_sec;
+    record->ctime_nsec = entry->ctime.tv_nsec;
+    record->inode = entry->inode;
+    memcpy(record->md5sum, entry->md5sum, sizeof(record->md5sum));
+}
+
+/*!
+ * @brief next_manifest_entry picks the next entry to save, merging source and destination lists by relative path
+ * Source entries win over destination ones with the same name, since they have just been copied. A source entry
+ * which could not be written leaves the destination entry as it was (writes are atomic, @see copy_entry_to_destination),
+ * and the destination entries which were removed are skipped.
+ * @param source_cursor is a pointer to the current position in the source list (advanced by the function)
+ * @param destination_cursor is a pointer to the current position in the destination list (advanced by the function)
+ * @return the entry to save (its key is its relative path), NULL when both lists are exhausted
+ */
+static files_list_entry_t *next_manifest_entry(files_list_entry_t **source_cursor, files_list_entry_t **destination_cursor) {
+    while (*source_cursor != NULL || *destination_cursor != NULL) {
+        files_list_entry_t *source = *source_cursor;
+        files_list_entry_t *destination = *destination_cursor;
+
+        int order = 0;
+        if (source == NULL) {
+            order = 1;
+        } else if (destination == NULL) {
+            order = -1;
+        } else {
+            order = compare_entry_keys(source, destination);
+        }
+
+        files_list_entry_t *entry = source;
+        if (order > 0) {
+            *destination_cursor = destination->next;
+            entry = destination;
+        } else {
+            *source_cursor = source->next;
+            if (order == 0) {
+                *destination_cursor = destination->next;
+                if (source->change_kind == CHANGE_FAILED) {
+                    entry = destination;
+                }
+            }
+        }
+
+        if (entry->change_kind != CHANGE_DELETE && entry->change_kind != CHANGE_FAILED) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/*!
+ * @brief write_manifest saves the state of the destination at the end of a synchronization
+ * The destination now contains every entry of the source list, except the ones whose change failed, plus its own
+ * entries which do not exist in the source and were not removed (@see next_manifest_entry). The manifest is
+ * written and synced next to the final one, then renamed: it is complete, even after a power loss.
+ * @param source_list is the list of the source entries (already copied to the destination)
+ * @param destination_list is the list of the destination entries before synchronization, can be NULL
+ * @param destination_root is the destination directory, where the manifest is written
+ * @return 0 in case of success, -1 else
+ */
+int write_manifest(files_list_t *source_list, files_list_t *destination_list, char *destination_root) {
+    char manifest_path[PATH_SIZE];
+    char temporary_path[PATH_SIZE];
+    if (snprintf(manifest_path, sizeof(manifest_path), "%s/%s", destination_root, MANIFEST_FILE_NAME) >= PATH_SIZE
+        || snprintf(temporary_path, sizeof(temporary_path), "%s.tmp", manifest_path) >= PATH_SIZE) {
+        return -1;
+    }
+
+    files_list_entry_t *source_cursor = source_list->head;
+    files_list_entry_t *destination_cursor = destination_list != NULL ? destination_list->head : NULL;
+    files_list_entry_t *entry;
+
+    // Premier passage : dénombrement des entrées et taille de la table des chaînes
+    manifest_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MANIFEST_MAGIC, sizeof(header.magic));
+    header.version = MANIFEST_VERSION;
+    while ((entry = next_manifest_entry(&source_cursor, &destination_cursor)) != NULL) {
+        header.entries_count++;
+        header.strings_size += entry->key_length;
+    }
+    header.strings_offset = sizeof(manifest_header_t) + (uint64_t) header.entries_count * sizeof(manifest_record_t);
+
+    FILE *manifest = fopen(temporary_path, "wb");
+    if (manifest == NULL) {
+        perror("Erreur lors de la création du manifeste");
+        return -1;
+    }
+
+    int result = fwrite(&header, sizeof(header), 1, manifest) == 1 ? 0 : -1;
+
+    // Second passage : enregistrements, puis troisième passage : table des chaînes
+    uint64_t path_offset = 0;
+    manifest_record_t record;
+    source_cursor = source_list->head;
+    destination_cursor = destination_list != NULL ? destination_list->head : NULL;
+    while (result == 0 && (entry = next_manifest_entry(&source_cursor, &destination_cursor)) != NULL) {
+        uint32_t path_length = entry->key_length;
+        fill_manifest_record(&record, entry, path_offset, path_length);
+        path_offset += path_length;
+        if (fwrite(&record, sizeof(record), 1, manifest) != 1) {
+            result = -1;
+        }
+    }
+
+    source_cursor = source_list->head;
+    destination_cursor = destination_list != NULL ? destination_list->head : NULL;
+    while (result == 0 && (entry = next_manifest_entry(&source_cursor, &destination_cursor)) != NULL) {
+        size_t path_length = entry->key_length;
+        if (fwrite(entry->path_and_name + entry->key_offset, 1, path_length, manifest) != path_length) {
+            result = -1;
+        }
+    }
+
+    if (result == 0 && (fflush(manifest) != 0 || fsync(fileno(manifest)) == -1)) {
+        result = -1;
+    }
+    if (fclose(manifest) != 0) {
+        result = -1;
+    }
+
+    if (result == 0 && rename(temporary_path, manifest_path) == -1) {
+        result = -1;
+    }
+
+    if (result == -1) {
+        perror("Erreur lors de l'écriture du manifeste");
+        unlink(temporary_path);
+    }
+
+    return result;
+}
+
+/*!
+ * @brief remove_manifest invalidates the manifest of a destination
+ * It must be called when the destination is modified outside of synchronize, so that the next run scans it.
+ * @param root is the destination directory containing the manifest
+ * @return 0 in case of success (or if there was no manifest), -1 else
+ */
+int remove_manifest(char *root) {
+    char manifest_path[PATH_SIZE];
+    if (snprintf(manifest_path, sizeof(manifest_path), "%s/%s", root, MANIFEST_FILE_NAME) >= PATH_SIZE) {
+        return -1;
+    }
+
+    if (unlink(manifest_path) == -1 && errno != ENOENT) {
+        perror("Erreur lors de la suppression du manifeste");
+        return -1;
+    }
+
+    return 0;
+}
+
+/*!
+ * @brief open_manifest_digests maps the manifest of a destination, to reuse its MD5 sums while listing the source
+ * The manifest records the source files as they were copied: a file whose size, mtime and ctime did not change
+ * since has the same content, since the ctime of a file cannot be set back like its mtime.
+ * Nothing is mapped with the quick checks which do not compare the ctime.
+ * @param root is the destination directory containing the manifest
+ * @param quick_check is the comparison of the files with their records
+ * @return 0 if the manifest was mapped, -1 else
+ */
+int open_manifest_digests(char *root, quick_check_t quick_check) {
+    close_manifest_digests();
+    if (quick_check != QUICK_CHECK_CTIME && quick_check != QUICK_CHECK_INODE) {
+        return -1;
+    }
+    digests_mapping = map_manifest(root, &digests_mapping_size);
+    digests_quick_check = quick_check;
+    return digests_mapping != NULL ? 0 : -1;
+}
+
+/*!
+ * @brief find_manifest_digest gives a file the MD5 sum recorded in the manifest, if the file did not change since
+ * The records are sorted by key (@see write_manifest), they are searched by dichotomy.
+ * @param entry is the source file, with its properties (@see read_file_stats)
+ * @return 0 if the MD5 sum was set, -1 if the file must be hashed
+ */
+int find_manifest_digest(files_list_entry_t *entry) {
+    if (digests_mapping == NULL) {
+        return -1;
+    }
+
+    manifest_header_t *header = (manifest_header_t *) digests_mapping;
+    manifest_record_t *records = (manifest_record_t *) (digests_mapping + sizeof(manifest_header_t));
+    char *strings = (char *) (digests_mapping + header->strings_offset);
+    char *key = entry->path_and_name + entry->key_offset;
+
+    size_t low = 0;
+    size_t high = header->entries_count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        manifest_record_t *record = &records[middle];
+        if (record->path_offset + record->path_length > header->strings_size) {
+            return -1;
+        }
+        size_t length = record->path_length < entry->key_length ? record->path_length : entry->key_length;
+        int order = memcmp(strings + record->path_offset, key, length);
+        if (order == 0) {
+            order = (record->path_length > entry->key_length) - (record->path_length < entry->key_length);
+        }
+        if (order < 0) {
+            low = middle + 1;
+        } else if (order > 0) {
+            high = middle;
+        } else {
+            static const uint8_t no_digest[16] = {0};
+            if (!S_ISREG(record->mode) || record->size != entry->size
+                || record->mtime_sec != entry->mtime.tv_sec || record->mtime_nsec != entry->mtime.tv_nsec
+                || record->ctime_sec != entry->ctime.tv_sec || record->ctime_nsec != entry->ctime.tv_nsec
+                || (digests_quick_check == QUICK_CHECK_INODE && record->inode != entry->inode)
+                || memcmp(record->md5sum, no_digest, sizeof(no_digest)) == 0) {
+                return -1;
+            }
+            memcpy(entry->md5sum, record->md5sum, sizeof(entry->md5sum));
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/*!
+ * @brief close_manifest_digests unmaps the manifest opened by open_manifest_digests, if any
+ */
+void close_manifest_digests() {
+    if (digests_mapping != NULL) {
+        munmap(digests_mapping, digests_mapping_size);
+        digests_mapping = NULL;
+    }
+}
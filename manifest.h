@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "files-list.h"
+#include "configuration.h"
+#include "defines.h"
+
+#define MANIFEST_FILE_NAME RESERVED_FILES_PREFIX "manifest"
+#define MANIFEST_MAGIC "LP25MAN"
+// Version 2: the MD5 sums of large files are tree digests (@see TREE_HASH_THRESHOLD)
+// Version 3: the ctime and inode of the source files are recorded (@see find_manifest_digest)
+#define MANIFEST_VERSION 3
+
+// The manifest is a header, followed by an array of fixed size records (sorted by relative path),
+// followed by the pool of relative paths they point into. It is meant to be mapped as is.
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t entries_count;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+} manifest_header_t;
+
+typedef struct {
+    uint64_t path_offset; // Offset of the relative path in the strings pool
+    uint32_t path_length;
+    uint32_t mode;
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t ctime_sec;
+    int64_t ctime_nsec;
+    uint64_t inode;
+    uint8_t md5sum[16];
+} manifest_record_t;
+
+int load_manifest(files_list_t *list, char *root);
+int write_manifest(files_list_t *source_list, files_list_t *destination_list, char *destination_root);
+int remove_manifest(char *root);
+int open_manifest_digests(char *root, quick_check_t quick_check);
+int find_manifest_digest(files_list_entry_t *entry);
+void close_manifest_digests();
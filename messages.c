@@ -1,6 +1,8 @@
 #include "messages.h"
 #include <sys/msg.h>
 #include <string.h>
+#include <stdio.h>
+#include <errno.h>
 
 // Functions in this file are required for inter processes communication
 
@@ -17,16 +19,40 @@ int send_file_entry(int msg_queue, int recipient, files_list_entry_t *file_entry
     files_list_entry_transmit_t entree_fichier_transmis;
     entree_fichier_transmis.mtype = recipient;
     entree_fichier_transmis.op_code = cmd_code;
-    entree_fichier_transmis.payload = *file_entry;
-    
-    int result = msgsnd(msg_queue, &entree_fichier_transmis, sizeof(files_list_entry_transmit_t), 0);
-    
+    memcpy(&entree_fichier_transmis.payload, file_entry, files_list_entry_size(file_entry));
+    entree_fichier_transmis.reply_to = 0;
+
+    int result = msgsnd(msg_queue, &entree_fichier_transmis, sizeof(files_list_entry_transmit_t) - sizeof(long), 0);
+
     if (result == -1) {
        perror("Erreur dans msgsnd");
     }
     return result;
 }
 
+/*!
+ * @brief send_job_message sends a hashing job to the analyzers, or its result to the lister
+ * @param msg_queue the MQ identifier through which to send the job
+ * @param recipient is the id of the recipient (as specified by mtype)
+ * @param sender is the id the sender listens to, so that the recipient knows where to answer
+ * @param cmd_code is the cmd code of the message
+ * @param job is a pointer to the job, whose entry, digest address, index and chunk are sent
+ * @param flags are the flags of msgsnd (IPC_NOWAIT to fail instead of waiting when the MQ is full)
+ * @return the result of the msgsnd function
+ */
+int send_job_message(int msg_queue, int recipient, int sender, int cmd_code, analyze_job_message_t *job, int flags) {
+    job->mtype = recipient;
+    job->op_code = cmd_code;
+    job->reply_to = sender;
+
+    int result = msgsnd(msg_queue, job, sizeof(analyze_job_message_t) - sizeof(long), flags);
+
+    if (result == -1 && !(flags & IPC_NOWAIT && errno == EAGAIN)) {
+       perror("Erreur dans msgsnd");
+    }
+    return result;
+}
+
 /*!
  * @brief send_analyze_dir_command sends a command to analyze a directory
  * @param msg_queue is the id of the MQ used to send the command
@@ -41,7 +67,7 @@ int send_analyze_dir_command(int msg_queue, int recipient, char *target_dir) {
     command.op_code =  COMMAND_CODE_ANALYZE_DIR;
     strcpy(command.target, target_dir);
     
-    int result = msgsnd(msg_queue, &command, sizeof(command.target), 0);
+    int result = msgsnd(msg_queue, &command, sizeof(command) - sizeof(long), 0);
     if (result == -1) {
        perror("Erreur dans msgsnd");
     }
@@ -102,6 +128,35 @@ int send_list_end(int msg_queue, int recipient) {
 
 }
 
+/*!
+ * @brief send_list_complete sends the end of the list of a lister to the main process
+ * The list itself is not sent: its entries are in the entry table of the lister, shared with the main process.
+ * @param msg_queue is the id of the MQ used to send the message
+ * @param recipient is the destination of the message
+ * @param sender is the id the lister listens to
+ * @param list is a pointer to the list, whose entries are in the entry table
+ * @param is_complete is false when entries are missing from the list
+ * @param concurrency is a pointer to the report of the concurrency controller of the lister
+ * @return the result of msgsnd
+ */
+int send_list_complete(int msg_queue, int recipient, int sender, files_list_t *list, bool is_complete,
+                       concurrency_report_t *concurrency) {
+    list_complete_message_t message;
+    message.mtype = recipient;
+    message.op_code = COMMAND_CODE_LIST_COMPLETE;
+    message.reply_to = sender;
+    message.is_complete = is_complete;
+    message.head = list->head;
+    message.tail = list->tail;
+    message.concurrency = *concurrency;
+
+    int result = msgsnd(msg_queue, &message, sizeof(message) - sizeof(long), 0);
+    if (result == -1) {
+       perror("Erreur dans msgsnd");
+    }
+    return result;
+}
+
 /*!
  * @brief send_terminate_command sends a terminate command to a child process so it stops
  * @param msg_queue is the MQ id used to send the command
@@ -1,6 +1,10 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
 #include "files-list.h"
+#include "concurrency.h"
 #include "defines.h"
 
 #define COMMAND_CODE_TERMINATE 0x0
@@ -16,6 +20,7 @@
 #define MSG_TYPE_TO_DESTINATION_LISTER 3
 #define MSG_TYPE_TO_SOURCE_ANALYZERS 4
 #define MSG_TYPE_TO_DESTINATION_ANALYZERS 5
+#define MSG_TYPE_TO_PREVIOUS_LISTER 6
 
 typedef struct {
     long mtype;
@@ -35,6 +40,31 @@ typedef struct {
     int reply_to; // MQ id of the sender, to build either source or destination list
 } files_list_entry_transmit_t;
 
+// A hashing job of a lister, or its result: the entry and its digest are in the entry table of the lister, which
+// is mapped at the same address in all the processes (@see ENTRY_TABLE_SIZE), so only their addresses are sent
+typedef struct {
+    long mtype;
+    char op_code; // Contains the analyze file opcode, or the file analyzed opcode
+    int reply_to; // MQ id of the sender
+    uint32_t job_index; // Index of the entry in the list of the lister
+    int32_t chunk_index; // Chunk of the file to hash (@see TREE_HASH_CHUNK_SIZE), -1 for the whole file
+    uint64_t size; // Number of bytes to hash
+    struct timespec sent_at; // When the lister sent the job, to measure its latency (@see concurrency.h)
+    files_list_entry_t *entry;
+    uint8_t *md5sum; // Where the analyzer writes the MD5 sum of the job
+} analyze_job_message_t;
+
+// End of the list of a lister, whose entries are in its entry table
+typedef struct {
+    long mtype;
+    char op_code; // Contains the list complete opcode
+    int reply_to; // MQ id of the lister, to tell the source list from the destination one
+    bool is_complete; // Set to false when entries could not be listed (the list must not be used)
+    files_list_entry_t *head;
+    files_list_entry_t *tail;
+    concurrency_report_t concurrency; // Number of analyzers chosen by the lister
+} list_complete_message_t;
+
 typedef struct {
     long mtype;
     char op_code; // Contains the analyze dir opcode
@@ -46,13 +76,18 @@ typedef union {
     analyze_file_command_t analyze_file_command;
     analyze_dir_command_t analyze_dir_command;
     files_list_entry_transmit_t list_entry;
+    analyze_job_message_t analyze_job;
+    list_complete_message_t list_complete;
 } any_message_t;
 
 int send_analyze_dir_command(int msg_queue, int recipient, char *target_dir);
 int send_file_entry(int msg_queue, int recipient, files_list_entry_t *file_entry, int cmd_code);
+int send_job_message(int msg_queue, int recipient, int sender, int cmd_code, analyze_job_message_t *job, int flags);
 int send_analyze_file_command(int msg_queue, int recipient, files_list_entry_t *file_entry);
 int send_analyze_file_response(int msg_queue, int recipient, files_list_entry_t *file_entry);
 int send_files_list_element(int msg_queue, int recipient, files_list_entry_t *file_entry);
 int send_list_end(int msg_queue, int recipient);
+int send_list_complete(int msg_queue, int recipient, int sender, files_list_t *list, bool is_complete,
+                       concurrency_report_t *concurrency);
 int send_terminate_command(int msg_queue, int recipient);
 int send_terminate_confirm(int msg_queue, int recipient);
\ No newline at end of file
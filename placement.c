@@ -0,0 +1,273 @@
+#define _GNU_SOURCE
+#include "placement.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "defines.h"
+
+// CPUs of a NUMA node on which the workers may run
+typedef struct {
+    int node; // Number of the node, below PLACEMENT_MAX_NODES
+    cpu_set_t cpus;
+} placement_node_t;
+
+// Placement of the workers, set before the processes are created
+typedef struct {
+    bool is_set; // Set to false when the workers are left to the scheduler of the system
+    numa_policy_t policy;
+    cpu_set_t cpus; // CPUs of all the workers
+    placement_node_t nodes[PLACEMENT_MAX_NODES]; // Nodes with some of these CPUs, in order
+    int nodes_count;
+    unsigned int analyzers_count; // Analyzers of each lister, they follow the listers in the numbers of the workers
+} placement_t;
+
+static placement_t placement = {.is_set = false};
+
+/*!
+ * @brief parse_cpus_list reads a list of CPUs, such as 0-3,8,10-11 (the format of the kernel)
+ * @param text is the list, it may end with a new line
+ * @param cpus receives the CPUs of the list
+ * @return 0 in case of success, -1 if the list is invalid
+ */
+static int parse_cpus_list(char *text, cpu_set_t *cpus) {
+    CPU_ZERO(cpus);
+    char *cursor = text;
+    while (*cursor != '\0' && *cursor != '\n') {
+        char *end;
+        long first = strtol(cursor, &end, 10);
+        if (end == cursor || first < 0 || first >= CPU_SETSIZE) {
+            return -1;
+        }
+        long last = first;
+        if (*end == '-') {
+            cursor = end + 1;
+            last = strtol(cursor, &end, 10);
+            if (end == cursor || last < first || last >= CPU_SETSIZE) {
+                return -1;
+            }
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            CPU_SET(cpu, cpus);
+        }
+
+        cursor = end;
+        if (*cursor == ',') {
+            cursor++;
+        } else if (*cursor != '\0' && *cursor != '\n') {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*!
+ * @brief compare_nodes orders the nodes by number, for qsort
+ */
+static int compare_nodes(const void *first, const void *second) {
+    return ((placement_node_t *) first)->node - ((placement_node_t *) second)->node;
+}
+
+/*!
+ * @brief read_nodes finds the NUMA nodes of the CPUs of the workers
+ * When the kernel does not describe its nodes, all the CPUs make up a single node.
+ */
+static void read_nodes() {
+    placement.nodes_count = 0;
+    DIR *dir = opendir("/sys/devices/system/node");
+    struct dirent *dent;
+    while (dir != NULL && (dent = readdir(dir)) != NULL && placement.nodes_count < PLACEMENT_MAX_NODES) {
+        int node;
+        char path[PATH_SIZE];
+        char cpus_list[4096];
+        if (sscanf(dent->d_name, "node%d", &node) != 1 || node < 0 || node >= PLACEMENT_MAX_NODES) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "/sys/devices/system/node/%s/cpulist", dent->d_name);
+        FILE *file = fopen(path, "r");
+        if (file == NULL) {
+            continue;
+        }
+
+        placement_node_t *current = &placement.nodes[placement.nodes_count];
+        if (fgets(cpus_list, sizeof(cpus_list), file) != NULL && parse_cpus_list(cpus_list, &current->cpus) == 0) {
+            //Seuls comptent les nœuds qui ont des CPUs des travailleurs
+            CPU_AND(&current->cpus, &current->cpus, &placement.cpus);
+            if (CPU_COUNT(&current->cpus) > 0) {
+                current->node = node;
+                placement.nodes_count++;
+            }
+        }
+        fclose(file);
+    }
+    if (dir != NULL) {
+        closedir(dir);
+    }
+
+    if (placement.nodes_count == 0) {
+        placement.nodes[0].node = 0;
+        placement.nodes[0].cpus = placement.cpus;
+        placement.nodes_count = 1;
+    }
+    qsort(placement.nodes, placement.nodes_count, sizeof(placement_node_t), compare_nodes);
+}
+
+/*!
+ * @brief worker_home_node gives the node a worker is placed on first
+ * The listers are spread over the nodes in turn, and the analyzers of a lister go to the node of their lister.
+ * @param worker_index is the number of the worker
+ * @return the index of the node in placement.nodes
+ */
+static int worker_home_node(unsigned int worker_index) {
+    if (worker_index < FIRST_ANALYZER_WORKER_INDEX || placement.analyzers_count == 0) {
+        return worker_index % placement.nodes_count;
+    }
+    unsigned int lister_index = (worker_index - FIRST_ANALYZER_WORKER_INDEX) / placement.analyzers_count;
+    return lister_index % placement.nodes_count;
+}
+
+/*!
+ * @brief find_worker_cpu chooses the CPU of a worker
+ * The workers take, in the order of their numbers, the next free CPU of their home node, or of the next node with a
+ * free CPU when all of those of their node are taken. Once every CPU is taken, the CPUs are shared from the start.
+ * @param worker_index is the number of the worker
+ * @param node_index receives the index of the node of the CPU in placement.nodes
+ * @return the number of the CPU
+ */
+static int find_worker_cpu(unsigned int worker_index, int *node_index) {
+    int taken[PLACEMENT_MAX_NODES] = {0};
+    int taken_count = 0;
+    int cpus_count = 0;
+    for (int i = 0; i < placement.nodes_count; i++) {
+        cpus_count += CPU_COUNT(&placement.nodes[i].cpus);
+    }
+    int node = 0;
+    int rank = 0;
+
+    for (unsigned int worker = 0; worker <= worker_index; worker++) {
+        if (taken_count == cpus_count) {
+            memset(taken, 0, sizeof(taken));
+            taken_count = 0;
+        }
+        node = worker_home_node(worker);
+        while (taken[node] == CPU_COUNT(&placement.nodes[node].cpus)) {
+            node = (node + 1) % placement.nodes_count;
+        }
+        rank = taken[node]++;
+        taken_count++;
+    }
+
+    *node_index = node;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &placement.nodes[node].cpus) && rank-- == 0) {
+            return cpu;
+        }
+    }
+    return -1;
+}
+
+/*!
+ * @brief set_memory_policy sets the nodes where the memory of the calling process is allocated
+ * @param node is the preferred node with the local policy
+ */
+static void set_memory_policy(placement_node_t *node) {
+    unsigned long nodes_mask[(PLACEMENT_MAX_NODES + 8 * sizeof(unsigned long) - 1) / (8 * sizeof(unsigned long))] = {0};
+    int mode;
+    if (placement.policy == NUMA_POLICY_LOCAL) {
+        mode = MPOL_PREFERRED;
+        nodes_mask[node->node / (8 * sizeof(unsigned long))] |= 1UL << (node->node % (8 * sizeof(unsigned long)));
+    } else if (placement.policy == NUMA_POLICY_INTERLEAVE) {
+        mode = MPOL_INTERLEAVE;
+        for (int i = 0; i < placement.nodes_count; i++) {
+            int number = placement.nodes[i].node;
+            nodes_mask[number / (8 * sizeof(unsigned long))] |= 1UL << (number % (8 * sizeof(unsigned long)));
+        }
+    } else {
+        return;
+    }
+    // Le noyau ignore le dernier bit du nombre de nœuds qui lui est passé
+    if (syscall(SYS_set_mempolicy, mode, nodes_mask, PLACEMENT_MAX_NODES + 1) == -1) {
+        perror("Erreur lors du choix des nœuds mémoire");
+    }
+}
+
+/*!
+ * @brief init_placement sets the CPUs and the memory nodes of the workers from the configuration
+ * It must be called before any process is created. The calling process, which copies the files and hashes them
+ * with threads without analyzers, keeps all the CPUs of its node (of the workers with the interleave policy).
+ * Without a process count, there is one analyzer per CPU of the workers on each side.
+ * @param the_config is a pointer to the configuration
+ * @return 0 in case of success, -1 if the CPUs are invalid
+ */
+int init_placement(configuration_t *the_config) {
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &placement.cpus) == -1) {
+        perror("Erreur lors de la lecture des CPUs disponibles");
+        CPU_ZERO(&placement.cpus);
+        for (long cpu = 0; cpu < sysconf(_SC_NPROCESSORS_ONLN) && cpu < CPU_SETSIZE; cpu++) {
+            CPU_SET(cpu, &placement.cpus);
+        }
+    }
+
+    if (the_config->cpus[0] != '\0') {
+        cpu_set_t wanted;
+        if (parse_cpus_list(the_config->cpus, &wanted) == -1) {
+            fprintf(stderr, "Erreur: liste de CPUs invalide %s\n", the_config->cpus);
+            return -1;
+        }
+        CPU_AND(&placement.cpus, &placement.cpus, &wanted);
+        if (CPU_COUNT(&placement.cpus) == 0) {
+            fprintf(stderr, "Erreur: aucun des CPUs %s n'est disponible\n", the_config->cpus);
+            return -1;
+        }
+    }
+    placement.policy = the_config->numa_policy;
+    placement.is_set = the_config->cpus[0] != '\0' || the_config->numa_policy != NUMA_POLICY_NONE;
+    read_nodes();
+
+    if (the_config->processes_count == 0) {
+        int cpus_count = CPU_COUNT(&placement.cpus);
+        the_config->processes_count = cpus_count < PLACEMENT_MAX_DEFAULT_PROCESSES ? cpus_count : PLACEMENT_MAX_DEFAULT_PROCESSES;
+    }
+    placement.analyzers_count = the_config->processes_count;
+
+    if (placement.is_set) {
+        placement_node_t *node = &placement.nodes[0];
+        cpu_set_t *cpus = placement.policy == NUMA_POLICY_LOCAL ? &node->cpus : &placement.cpus;
+        if (sched_setaffinity(0, sizeof(cpu_set_t), cpus) == -1) {
+            perror("Erreur lors du placement sur les CPUs");
+        }
+        set_memory_policy(node);
+    }
+    return 0;
+}
+
+/*!
+ * @brief place_worker pins the calling process to the CPU of a worker, and sets its memory policy
+ * Each worker runs on one CPU of the set (@see find_worker_cpu): the analyzers of a lister are placed on the node
+ * of their lister first. With the local policy, a worker allocates its memory (hashing buffers, chunk digests,
+ * entries it lists) on the node of its CPU; with the interleave policy, its memory is spread over the nodes.
+ * Threads and children inherit both.
+ * @param worker_index is the number of the worker: 0 to 2 for the listers, then the analyzers of each lister in turn
+ * (@see FIRST_ANALYZER_WORKER_INDEX)
+ */
+void place_worker(unsigned int worker_index) {
+    if (placement.is_set == false) {
+        return;
+    }
+
+    int node_index;
+    int cpu = find_worker_cpu(worker_index, &node_index);
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    if (cpu != -1) {
+        CPU_SET(cpu, &cpus);
+    }
+    if (cpu != -1 && sched_setaffinity(0, sizeof(cpu_set_t), &cpus) == -1) {
+        perror("Erreur lors du placement sur les CPUs");
+    }
+    set_memory_policy(&placement.nodes[node_index]);
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdbool.h>
+#include "configuration.h"
+
+// Largest number of NUMA nodes the workers are spread over
+#define PLACEMENT_MAX_NODES 64
+// Number of the first analyzer worker (@see place_worker): the listers are the workers 0 to 2
+#define FIRST_ANALYZER_WORKER_INDEX 3
+// Largest default number of analyzers per side (@see init_placement)
+#define PLACEMENT_MAX_DEFAULT_PROCESSES 64
+
+int init_placement(configuration_t *the_config);
+void place_worker(unsigned int worker_index);
@@ -6,13 +6,41 @@
 #include "messages.h"
 #include "file-properties.h"
 #include "sync.h"
+#include "hard-links.h"
+#include "compression.h"
+#include "checkpoint.h"
+#include "manifest.h"
+#include "placement.h"
+#include "concurrency.h"
+#include "external-sort.h"
 #include <string.h>
 #include <errno.h>
 #include <signal.h>
-#include <sys/wait.h> 
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <sys/mman.h>
+
+/*!
+ * @brief map_entry_table maps the entry table of a lister, before the processes are created
+ * With a memory limit, the table is backed by a temporary file, so that its pages can be written back and released.
+ * @param size is the size of the table
+ * @return the address of the table, NULL in case of error
+ */
+static void *map_entry_table(size_t size) {
+    if (is_sorting_out_of_core()) {
+        return map_spill_region(size);
+    }
+    void *table = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (table == MAP_FAILED) {
+        perror("Erreur lors de la création des tables des entrées");
+        return NULL;
+    }
+    return table;
+}
 
 /*!
  * @brief prepare prepares (only when parallel is enabled) the processes used for the synchronization.
+ * In case of error, what was prepared is kept in the context, for stop_processes to release it.
  * @param the_config is a pointer to the program configuration
  * @param p_context is a pointer to the program processes context
  * @return 0 if all went good, -1 else
@@ -21,58 +49,123 @@ int prepare(configuration_t *the_config, process_context_t *p_context) {
     if (the_config->is_parallel) {
         p_context->processes_count = the_config->processes_count;
         p_context->main_process_pid = getpid();
+        p_context->source_lister_pid = -1;
+        p_context->destination_lister_pid = -1;
+        p_context->previous_lister_pid = -1;
+        p_context->message_queue_id = -1;
+        p_context->source_entry_table = NULL;
+        p_context->destination_entry_table = NULL;
+        p_context->previous_entry_table = NULL;
 
         p_context->source_analyzers_pids = (pid_t *)malloc(sizeof(pid_t) *p_context->processes_count);
         p_context->destination_analyzers_pids = (pid_t *)malloc(sizeof(pid_t) *p_context->processes_count);
+        if (p_context->source_analyzers_pids == NULL || p_context->destination_analyzers_pids == NULL) {
+            perror("Memory allocation failed");
+            p_context->processes_count = 0;
+            return -1;
+        }
+        for (int i = 0; i < p_context->processes_count; i++) {
+            p_context->source_analyzers_pids[i] = -1;
+            p_context->destination_analyzers_pids[i] = -1;
+        }
 
-        key_t my_key = ftok("processes.c", 25);
-        int msg_id = msgget(my_key, 0666 | IPC_CREAT);
+        // La file n'est partagée qu'avec les processus enfants, qui héritent de son identifiant
+        int msg_id = msgget(IPC_PRIVATE, 0600 | IPC_CREAT);
+        if (msg_id == -1) {
+            perror("Erreur lors de la création de la file de messages");
+            return -1;
+        }
 
-        p_context->shared_key = my_key;
+        p_context->shared_key = IPC_PRIVATE;
         p_context->message_queue_id = msg_id;
 
-        if (p_context->source_analyzers_pids == NULL || p_context->destination_analyzers_pids == NULL) {
-            perror("Memory allocation failed");
+        // Les tables des entrées sont projetées avant la création des processus, à la même adresse dans chacun
+        p_context->entry_table_size = is_sorting_out_of_core() ? SPILL_REGION_SIZE : ENTRY_TABLE_SIZE;
+        p_context->source_entry_table = map_entry_table(p_context->entry_table_size);
+        p_context->destination_entry_table = map_entry_table(p_context->entry_table_size);
+        if (p_context->source_entry_table == NULL || p_context->destination_entry_table == NULL) {
             return -1;
         }
+        if (the_config->link_dest[0] != '\0') {
+            p_context->previous_entry_table = map_entry_table(p_context->entry_table_size);
+            if (p_context->previous_entry_table == NULL) {
+                return -1;
+            }
+        }
 
         lister_configuration_t source_lister_config;
-        source_lister_config.my_recipient_id = 1;//J'envoie à lui
-        source_lister_config.my_receiver_id = 2;//Je reçois de lui
+        source_lister_config.my_recipient_id = MSG_TYPE_TO_SOURCE_ANALYZERS;//J'envoie à lui
+        source_lister_config.my_receiver_id = MSG_TYPE_TO_SOURCE_LISTER;//Je reçois de lui
         source_lister_config.analyzers_count = the_config->processes_count;
+        source_lister_config.min_analyzers_count = the_config->min_processes_count;
         source_lister_config.mq_key = p_context->shared_key;
-
-        lister_configuration_t destination_lister_config;
-        destination_lister_config.my_recipient_id = 3;//J'envoie à lui
-        destination_lister_config.my_receiver_id = 4;//Je reçois de lui
-        destination_lister_config.analyzers_count = the_config->processes_count;
-        destination_lister_config.mq_key = p_context->shared_key;
-
+        source_lister_config.message_queue_id = msg_id;
+        source_lister_config.use_md5 = the_config->uses_md5;
+        source_lister_config.resume = the_config->resume;
+        source_lister_config.checkpoint_root = the_config->destination;
+        source_lister_config.has_checkpoint = !the_config->dry_run;
+        source_lister_config.entry_table = p_context->source_entry_table;
+        source_lister_config.entry_table_size = p_context->entry_table_size;
+        source_lister_config.digests_root = the_config->uses_md5 && !the_config->verify_destination ? the_config->destination : NULL;
+        source_lister_config.quick_check = the_config->quick_check;
+        source_lister_config.worker_index = 0;
+
+        lister_configuration_t destination_lister_config = source_lister_config;
+        destination_lister_config.entry_table = p_context->destination_entry_table;
+        destination_lister_config.digests_root = NULL;
+        destination_lister_config.worker_index = 1;
+        destination_lister_config.my_recipient_id = MSG_TYPE_TO_DESTINATION_ANALYZERS;//J'envoie à lui
+        destination_lister_config.my_receiver_id = MSG_TYPE_TO_DESTINATION_LISTER;//Je reçois de lui
 
         p_context->source_lister_pid = make_process(p_context,lister_process_loop, (void *)&source_lister_config);
         p_context->destination_lister_pid = make_process(p_context,lister_process_loop, (void *)&destination_lister_config);
+        if (p_context->source_lister_pid == -1 || p_context->destination_lister_pid == -1) {
+            return -1;
+        }
+
+        // La sauvegarde précédente est sur le même disque que la destination : elle partage ses analyseurs
+        p_context->previous_lister_pid = -1;
+        if (p_context->previous_entry_table != NULL) {
+            lister_configuration_t previous_lister_config = destination_lister_config;
+            previous_lister_config.entry_table = p_context->previous_entry_table;
+            previous_lister_config.my_receiver_id = MSG_TYPE_TO_PREVIOUS_LISTER;
+            previous_lister_config.worker_index = 2;
+            p_context->previous_lister_pid = make_process(p_context, lister_process_loop, (void *)&previous_lister_config);
+            if (p_context->previous_lister_pid == -1) {
+                return -1;
+            }
+        }
 
 
         // Creer un analyseur de source
         analyzer_configuration_t source_analyzer_config;
-        source_analyzer_config.my_recipient_id = 1;
-        source_analyzer_config.my_receiver_id = 2;
+        source_analyzer_config.my_recipient_id = MSG_TYPE_TO_SOURCE_LISTER;
+        source_analyzer_config.my_receiver_id = MSG_TYPE_TO_SOURCE_ANALYZERS;
         source_analyzer_config.mq_key = p_context->shared_key;
+        source_analyzer_config.message_queue_id = msg_id;
         source_analyzer_config.use_md5 = the_config->uses_md5;
 
+        // Les analyseurs sont répartis sur les CPUs après le processus principal et les listeurs, ceux de la destination
+        // après ceux de la source
         for (int i = 0; i < p_context->processes_count; i++) {
+            source_analyzer_config.worker_index = FIRST_ANALYZER_WORKER_INDEX + i;
             p_context->source_analyzers_pids[i] = make_process(p_context, analyzer_process_loop, (void *)&source_analyzer_config);
+            if (p_context->source_analyzers_pids[i] == -1) {
+                return -1;
+            }
         }
 
         // Creer un analyseur de destination
-        analyzer_configuration_t destination_analyzer_config;
-        destination_analyzer_config.my_recipient_id = 3;
-        destination_analyzer_config.my_receiver_id = 4;
-        destination_analyzer_config.mq_key = p_context->shared_key;
-        destination_analyzer_config.use_md5 = the_config->uses_md5;
+        analyzer_configuration_t destination_analyzer_config = source_analyzer_config;
+        destination_analyzer_config.my_recipient_id = MSG_TYPE_TO_DESTINATION_LISTER;
+        destination_analyzer_config.my_receiver_id = MSG_TYPE_TO_DESTINATION_ANALYZERS;
 
         for (int i = 0; i < p_context->processes_count; i++) {
+            destination_analyzer_config.worker_index = FIRST_ANALYZER_WORKER_INDEX + p_context->processes_count + i;
             p_context->destination_analyzers_pids[i] = make_process(p_context, analyzer_process_loop, (void *)&destination_analyzer_config);
+            if (p_context->destination_analyzers_pids[i] == -1) {
+                return -1;
+            }
         }
 
         return 0; // Success
@@ -89,6 +182,8 @@ int prepare(configuration_t *the_config, process_context_t *p_context) {
  * @return the PID of the child process (it never returns in the child process)
  */
 int make_process(process_context_t *p_context, process_loop_t func, void *parameters) {
+    // Les sorties en attente ne doivent pas être écrites aussi par l'enfant
+    fflush(NULL);
     pid_t pid = fork();
 
     if (pid == -1) {
@@ -97,12 +192,248 @@ int make_process(process_context_t *p_context, process_loop_t func, void *parame
     }
 
     if (pid == 0) {
-        // Code exécuté par le processus enfant
+        // Code exécuté par le processus enfant : il est arrêté par le processus principal (commande de terminaison),
+        // qui reçoit seul les interruptions, ou s'arrête avec lui
+        signal(SIGINT, SIG_IGN);
+        signal(SIGTERM, SIG_IGN);
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
         func(parameters); // Appel de la fonction avec les paramètres spécifiés
-        //_exit(0); // Fin du processus enfant
+        exit(EXIT_SUCCESS); // Fin du processus enfant
+    }
+
+    return pid; // Retourne le PID du processus enfant au parent
+}
+
+/*!
+ * @brief receive_message waits for the next message of a recipient
+ * @param msg_queue is the MQ id
+ * @param recipient is the id to listen to (mtype)
+ * @param message is a pointer to the message received
+ * @return 0 in case of success, -1 else
+ */
+static int receive_message(int msg_queue, int recipient, any_message_t *message) {
+    while (msgrcv(msg_queue, message, sizeof(any_message_t) - sizeof(long), recipient, 0) == -1) {
+        if (errno != EINTR) {
+            perror("Erreur dans msgrcv");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Files list of a lister, with the progress of the analysis of its entries
+typedef struct {
+    files_list_entry_t **entries; // Entries of the list, in order
+    uint8_t (**chunk_digests)[16]; // MD5 sums of the chunks of the entries digested as a tree, NULL for the others
+    hard_link_t **hard_links; // First link of the inode of each entry with several links, NULL for the others
+} lister_list_t;
+
+/*!
+ * @brief receive_element_details waits for an analyzer response and records its result
+ * @param msg_queue is the MQ id
+ * @param cfg is a pointer to the lister configuration
+ * @param controller is a pointer to the concurrency controller of the lister, which measures the job
+ * @return 0 in case of success, -1 else
+ */
+static int receive_element_details(int msg_queue, lister_configuration_t *cfg, concurrency_controller_t *controller) {
+    any_message_t message;
+    do {
+        if (receive_message(msg_queue, cfg->my_receiver_id, &message) == -1) {
+            return -1;
+        }
+    } while (message.analyze_job.op_code != COMMAND_CODE_FILE_ANALYZED);
+
+    // Le résultat est déjà dans la table des entrées
+    analyze_job_message_t *response = &message.analyze_job;
+    record_job_completion(controller, response->size, &response->sent_at);
+    if (response->chunk_index < 0) {
+        checkpoint_digest(response->entry);
     } else {
-        return pid; // Retourne le PID du processus enfant au parent
+        checkpoint_chunk_digest(response->entry, response->chunk_index, response->md5sum);
     }
+    return 0;
+}
+
+/*!
+ * @brief analyze_directory lists a directory, gets its files analyzed and sends the list to the main process
+ * The entries are stated by the lister, then files are hashed by the analyzers, in the order given by
+ * schedule_jobs: large files are split in chunk jobs and the active analyzers are kept busy until the end. How
+ * many analyzers are active is tuned while hashing (@see concurrency_controller_t).
+ * The file and chunk digests are recorded in the checkpoint journal as they arrive (@see attach_checkpoint). When the
+ * hashing is interrupted by a message queue error, the list is incomplete and no tree digest is assembled.
+ * The list is built in the entry table of the lister, where analyzers write their digests and where the main
+ * process reads it: only its ends are sent. The table is emptied by the next listing.
+ * @param cfg is a pointer to the lister configuration
+ * @param target is the directory to list
+ */
+static void analyze_directory(lister_configuration_t *cfg, char *target) {
+    int msg_queue = cfg->message_queue_id;
+    files_list_t files_list;
+    init_files_list(&files_list, target);
+    init_arena_region(&files_list.arena, cfg->entry_table, cfg->entry_table_size);
+    bool is_complete = make_list(&files_list, target) == 0;
+
+    size_t entries_count = 0;
+    for (files_list_entry_t *cursor = files_list.head; cursor != NULL; cursor = cursor->next) {
+        entries_count++;
+    }
+
+    //Avec une limite de mémoire, les tableaux de la liste et des travaux sont projetés sur des fichiers temporaires
+    lister_list_t list;
+    size_t slots_count = entries_count + 1;
+    list.entries = alloc_spill_array(slots_count * sizeof(files_list_entry_t *));
+    list.chunk_digests = alloc_spill_array(slots_count * sizeof(*list.chunk_digests));
+    list.hard_links = alloc_spill_array(slots_count * sizeof(hard_link_t *));
+    analyze_job_t *jobs = NULL;
+    size_t jobs_count = 0;
+    size_t jobs_capacity = 0;
+    if (is_sorting_out_of_core()) {
+        jobs = alloc_spill_array(SPILL_REGION_SIZE);
+        jobs_capacity = jobs != NULL ? SPILL_REGION_SIZE / sizeof(analyze_job_t) : 0;
+    }
+    hard_links_table_t hard_links;
+    init_hard_links_table(&hard_links);
+    if (cfg->resume) {
+        read_checkpoint(cfg->checkpoint_root);
+    }
+    if (cfg->has_checkpoint) {
+        attach_checkpoint(cfg->checkpoint_root);
+    }
+    if (cfg->digests_root != NULL) {
+        open_manifest_digests(cfg->digests_root, cfg->quick_check);
+    }
+
+    if (list.entries == NULL || list.chunk_digests == NULL || list.hard_links == NULL) {
+        perror("Mémoire insuffisante pour la liste");
+        entries_count = 0;
+        is_complete = false;
+    }
+
+    // Propriétés de chaque entrée, et travaux de hachage des fichiers
+    files_list_entry_t *cursor = files_list.head;
+    for (size_t i = 0; i < entries_count; i++, cursor = cursor->next) {
+        list.entries[i] = cursor;
+        if (read_file_stats(cursor) == -1) {
+            perror("Impossible de récupérer les informations du fichier a");
+            continue;
+        }
+        if (cursor->entry_type != FICHIER || !cfg->use_md5 || read_logical_properties(cursor) == 0
+            || find_checkpoint_digest(cursor) == 0 || find_manifest_digest(cursor) == 0) {
+            continue;
+        }
+
+        //Les liens physiques d'un même inode ne sont hachés qu'une fois
+        if (cursor->links_count > 1) {
+            hard_link_t *hard_link = add_hard_link(&hard_links, cursor);
+            if (hard_link != NULL && hard_link->entry != cursor) {
+                list.hard_links[i] = hard_link;
+                continue;
+            }
+        }
+
+        uint64_t chunks_count = tree_hash_chunks_count(cursor->size);
+        if (jobs_count + (chunks_count > 0 ? chunks_count : 1) > jobs_capacity) {
+            if (is_sorting_out_of_core()) {
+                fprintf(stderr, "La table des travaux d'analyse est pleine\n");
+                is_complete = false;
+                continue;
+            }
+            size_t new_capacity = (jobs_capacity + chunks_count + 1) * 2;
+            analyze_job_t *new_jobs = realloc(jobs, new_capacity * sizeof(analyze_job_t));
+            if (new_jobs == NULL) {
+                //Le fichier n'est pas haché : la liste est incomplète, mais toutes ses entrées sont remplies
+                perror("Mémoire insuffisante pour les travaux d'analyse");
+                is_complete = false;
+                continue;
+            }
+            jobs = new_jobs;
+            jobs_capacity = new_capacity;
+        }
+        if (chunks_count == 0) {
+            jobs[jobs_count++] = (analyze_job_t) {.entry_index = i, .chunk_index = -1, .size = cursor->size};
+            continue;
+        }
+        //Les sommes des morceaux sont écrites par les analyseurs dans la table des entrées
+        list.chunk_digests[i] = arena_alloc(&files_list.arena, chunks_count * 16);
+        if (list.chunk_digests[i] == NULL) {
+            fprintf(stderr, "La table des entrées est pleine\n");
+            is_complete = false;
+        }
+        for (uint64_t chunk = 0; list.chunk_digests[i] != NULL && chunk < chunks_count; chunk++) {
+            //Les morceaux hachés par une synchronisation interrompue ne sont pas relus
+            if (find_checkpoint_chunk(cursor, chunk, list.chunk_digests[i][chunk]) == 0) {
+                continue;
+            }
+            uint64_t chunk_size = cursor->size - chunk * TREE_HASH_CHUNK_SIZE;
+            jobs[jobs_count++] = (analyze_job_t) {.entry_index = i, .chunk_index = chunk,
+                                                  .size = chunk_size < TREE_HASH_CHUNK_SIZE ? chunk_size : TREE_HASH_CHUNK_SIZE};
+        }
+    }
+
+    // Répartition des travaux, dans l'ordre de l'ordonnanceur, sans dépasser un travail par analyseur actif
+    schedule_jobs(jobs, jobs_count);
+    concurrency_controller_t controller;
+    init_concurrency_controller(&controller, cfg->min_analyzers_count, cfg->analyzers_count);
+    int current_analyzers = 0;
+    size_t next_job = 0;
+    while (next_job < jobs_count || current_analyzers > 0) {
+        while (next_job < jobs_count && current_analyzers < (int) concurrency_limit(&controller)) {
+            size_t entry_index = jobs[next_job].entry_index;
+            uint8_t *md5sum = jobs[next_job].chunk_index < 0 ? list.entries[entry_index]->md5sum
+                                                               : list.chunk_digests[entry_index][jobs[next_job].chunk_index];
+            if (request_element_details(msg_queue, list.entries[entry_index], md5sum, &jobs[next_job], cfg, &current_analyzers) == -1) {
+                break;
+            }
+            next_job++;
+        }
+
+        if (current_analyzers == 0) {
+            if (errno != EAGAIN) {
+                break;
+            }
+            usleep(1000); // File pleine des messages des autres processus
+            continue;
+        }
+        if (receive_element_details(msg_queue, cfg, &controller) == -1) {
+            break;
+        }
+        current_analyzers--;
+    }
+
+    //Une erreur de la file de messages interrompt le hachage : des sommes manquent, celles des morceaux reçus sont
+    //déjà dans le journal, mais aucune somme incomplète ne doit y être assemblée ni copiée
+    bool is_hashed = next_job == jobs_count && current_analyzers == 0;
+    if (!is_hashed) {
+        fprintf(stderr, "Le hachage de %s a été interrompu\n", target);
+        is_complete = false;
+    }
+
+    // Assemblage des hachages en arbre, puis copie des sommes vers les autres liens des inodes
+    for (size_t i = 0; is_hashed && i < entries_count; i++) {
+        if (list.chunk_digests[i] != NULL) {
+            combine_chunk_digests(list.chunk_digests[i], tree_hash_chunks_count(list.entries[i]->size), list.entries[i]->md5sum);
+            checkpoint_digest(list.entries[i]);
+        }
+    }
+    for (size_t i = 0; is_hashed && i < entries_count; i++) {
+        if (list.hard_links[i] != NULL) {
+            memcpy(list.entries[i]->md5sum, list.hard_links[i]->entry->md5sum, sizeof(list.entries[i]->md5sum));
+            checkpoint_digest(list.entries[i]);
+        }
+    }
+
+    // La liste reste dans la table des entrées, où le processus principal la lit
+    close_checkpoint(false);
+    close_manifest_digests();
+    concurrency_report_t report;
+    make_concurrency_report(&controller, &report);
+    send_list_complete(msg_queue, MSG_TYPE_TO_MAIN, cfg->my_receiver_id, &files_list, is_complete, &report);
+
+    free_spill_array(list.chunk_digests, slots_count * sizeof(*list.chunk_digests));
+    free_spill_array(list.hard_links, slots_count * sizeof(hard_link_t *));
+    free_spill_array(list.entries, slots_count * sizeof(files_list_entry_t *));
+    free_spill_array(jobs, is_sorting_out_of_core() ? SPILL_REGION_SIZE : jobs_capacity * sizeof(analyze_job_t));
+    clear_hard_links_table(&hard_links);
 }
 
 /*!
@@ -111,19 +442,18 @@ int make_process(process_context_t *p_context, process_loop_t func, void *parame
  */
 void lister_process_loop(void *parameters) {
     lister_configuration_t *config = (lister_configuration_t *)parameters;
+    any_message_t message;
+    place_worker(config->worker_index);
 
-    int my_recipient_id = config->my_recipient_id;
-    int my_receiver_id = config->my_receiver_id;
-    int analyzers_count = config->analyzers_count;
-    key_t mq_key = config->mq_key;
-
-    // Example: Print information
-    printf("Lister_process:\n");
-    printf("my_recipient_id: %d\n", my_recipient_id);
-    printf("my_receiver_id: %d\n", my_receiver_id);
-    printf("analyzers_count: %d\n", analyzers_count);
-    printf("mq_key: %d\n", mq_key);
-
+    while (receive_message(config->message_queue_id, config->my_receiver_id, &message) == 0) {
+        if (message.simple_command.message == COMMAND_CODE_TERMINATE) {
+            send_terminate_confirm(config->message_queue_id, MSG_TYPE_TO_MAIN);
+            break;
+        }
+        if (message.analyze_dir_command.op_code == COMMAND_CODE_ANALYZE_DIR) {
+            analyze_directory(config, message.analyze_dir_command.target);
+        }
+    }
 }
 
 /*!
@@ -132,71 +462,180 @@ void lister_process_loop(void *parameters) {
  */
 void analyzer_process_loop(void *parameters) {
     analyzer_configuration_t *config = (analyzer_configuration_t *)parameters;
+    any_message_t message;
+    place_worker(config->worker_index);
 
-    int my_recipient_id = config->my_recipient_id;
-    int my_receiver_id = config->my_receiver_id;
-    key_t mq_key = config->mq_key;
-    bool use_md5 = config->use_md5;
+    while (receive_message(config->message_queue_id, config->my_receiver_id, &message) == 0) {
+        if (message.simple_command.message == COMMAND_CODE_TERMINATE) {
+            send_terminate_confirm(config->message_queue_id, MSG_TYPE_TO_MAIN);
+            break;
+        }
+        if (message.analyze_job.op_code != COMMAND_CODE_ANALYZE_FILE) {
+            continue;
+        }
 
-    // Example: Print information
-    printf("Analyzer_process: \n");
-    printf("my_recipient_id: %d\n", my_recipient_id);
-    printf("my_receiver_id: %d\n", my_receiver_id);
-    printf("mq_key: %d\n", mq_key);
-    printf("use_md5: %s\n", use_md5 ? "true" : "false");
+        // L'entrée et sa somme sont lues et écrites directement dans la table des entrées du listeur
+        analyze_job_message_t *job = &message.analyze_job;
+        int result = 0;
+        if (job->chunk_index >= 0) {
+            result = compute_chunk_md5(job->entry, job->chunk_index, job->md5sum);
+        } else if (config->use_md5) {
+            result = compute_file_md5(job->entry);
+        }
+        if (result == -1) {
+            perror("Impossible de calculer la somme MD5 du fichier");
+        }
+
+        send_job_message(config->message_queue_id, job->reply_to, config->my_receiver_id, COMMAND_CODE_FILE_ANALYZED, job, 0);
+    }
+}
+
+/*!
+ * @brief wait_process waits for the end of a child process
+ * @param pid is a pointer to the PID of the process, set to -1 once it is waited for (nothing is done if it is -1)
+ */
+static void wait_process(pid_t *pid) {
+    if (*pid != -1) {
+        waitpid(*pid, NULL, 0);
+        *pid = -1;
+    }
+}
 
+/*!
+ * @brief is_process_stopped checks, without waiting, whether a child process has ended
+ * @param pid is a pointer to the PID of the process, set to -1 when it has ended (nothing is done if it is -1)
+ * @return true if the process has ended
+ */
+static bool is_process_stopped(pid_t *pid) {
+    if (*pid != -1 && waitpid(*pid, NULL, WNOHANG) == *pid) {
+        *pid = -1;
+        return true;
+    }
+    return false;
 }
 
 /*!
  * @brief clean_processes cleans the processes by sending them a terminate command and waiting to the confirmation
+ * It also releases a context which prepare could not complete: the processes which were not created are skipped.
  * @param the_config is a pointer to the program configuration
  * @param p_context is a pointer to the processes context
  */
 void clean_processes(configuration_t *the_config, process_context_t *p_context) {
     // Do nothing if not parallel
     if (the_config->is_parallel) {
-    // Send terminate
-        for (int i = 0; i < p_context->processes_count; ++i) {
-            kill(p_context->source_analyzers_pids[i], SIGTERM);
-            kill(p_context->destination_analyzers_pids[i], SIGTERM);
+        // Send terminate
+        int msg_queue = p_context->message_queue_id;
+        if (msg_queue != -1) {
+            send_terminate_command(msg_queue, MSG_TYPE_TO_SOURCE_LISTER);
+            send_terminate_command(msg_queue, MSG_TYPE_TO_DESTINATION_LISTER);
+            if (p_context->previous_lister_pid != -1) {
+                send_terminate_command(msg_queue, MSG_TYPE_TO_PREVIOUS_LISTER);
+            }
+            for (int i = 0; i < p_context->processes_count; ++i) {
+                send_terminate_command(msg_queue, MSG_TYPE_TO_SOURCE_ANALYZERS);
+                send_terminate_command(msg_queue, MSG_TYPE_TO_DESTINATION_ANALYZERS);
+            }
         }
 
-        // Wait for for responses
+        // Wait for the processes (their confirmations are removed with the MQ)
+        wait_process(&p_context->source_lister_pid);
+        wait_process(&p_context->destination_lister_pid);
+        wait_process(&p_context->previous_lister_pid);
         for (int i = 0; i < p_context->processes_count; ++i) {
-            int status;
-            waitpid(p_context->source_analyzers_pids[i], &status, 0);
-            if (WIFEXITED(status)) {
-                printf("Process %d exited with status %d\n", p_context->source_analyzers_pids[i], WEXITSTATUS(status));
-            } else if (WIFSIGNALED(status)) {
-                printf("Process %d terminated by signal %d\n", p_context->source_analyzers_pids[i], WTERMSIG(status));
-            }
-
-            waitpid(p_context->destination_analyzers_pids[i], &status, 0);
-            if (WIFEXITED(status)) {
-                printf("Process %d exited with status %d\n", p_context->destination_analyzers_pids[i], WEXITSTATUS(status));
-            } else if (WIFSIGNALED(status)) {
-                printf("Process %d terminated by signal %d\n", p_context->destination_analyzers_pids[i], WTERMSIG(status));
-            }
+            wait_process(&p_context->source_analyzers_pids[i]);
+            wait_process(&p_context->destination_analyzers_pids[i]);
         }
 
         // Free allocated memory
         free(p_context->source_analyzers_pids);
         free(p_context->destination_analyzers_pids);
+        p_context->processes_count = 0;
+        if (p_context->source_entry_table != NULL) {
+            munmap(p_context->source_entry_table, p_context->entry_table_size);
+        }
+        if (p_context->destination_entry_table != NULL) {
+            munmap(p_context->destination_entry_table, p_context->entry_table_size);
+        }
+        if (p_context->previous_entry_table != NULL) {
+            munmap(p_context->previous_entry_table, p_context->entry_table_size);
+        }
 
         // Free the MQ
-        if (msgctl(p_context->message_queue_id, IPC_RMID, NULL) == -1) {
+        if (msg_queue != -1 && msgctl(msg_queue, IPC_RMID, NULL) == -1) {
             perror("Error deleting message queue");
         }
     }
+}
 
-    // Do nothing if not parallel
-    // Send terminate
-    // Wait for responses
-    // Free allocated memory
-    // Free the MQ
+/*!
+ * @brief has_stopped_process checks, without waiting, whether a child process has ended
+ * A process which ended before being terminated never answers: the processes waiting for it would wait forever.
+ * The ended processes are waited for, their PID is set to -1 in the context.
+ * @param p_context is a pointer to the processes context
+ * @return true if a process has ended
+ */
+bool has_stopped_process(process_context_t *p_context) {
+    //Tous les processus arrêtés sont attendus, sans s'arrêter au premier
+    bool is_stopped = is_process_stopped(&p_context->source_lister_pid) | is_process_stopped(&p_context->destination_lister_pid)
+                      | is_process_stopped(&p_context->previous_lister_pid);
+    for (int i = 0; i < p_context->processes_count; i++) {
+        is_stopped |= is_process_stopped(&p_context->source_analyzers_pids[i]);
+        is_stopped |= is_process_stopped(&p_context->destination_analyzers_pids[i]);
+    }
+    return is_stopped;
+}
+/*!
+ * @brief stop_processes kills the child processes and releases the context, the program then runs without them
+ * It is used when the processes cannot be created or stopped working: the ones still running may be waiting for
+ * an answer which will never come, so they are killed instead of being sent a terminate command.
+ * @param the_config is a pointer to the program configuration, whose parallel mode is disabled
+ * @param p_context is a pointer to the processes context
+ */
+void stop_processes(configuration_t *the_config, process_context_t *p_context) {
+    if (the_config->is_parallel == false) {
+        return;
+    }
+    pid_t *pids[3] = {&p_context->source_lister_pid, &p_context->destination_lister_pid, &p_context->previous_lister_pid};
+    for (int i = 0; i < 3; i++) {
+        if (*pids[i] != -1) {
+            kill(*pids[i], SIGKILL);
+        }
+    }
+    for (int i = 0; i < p_context->processes_count; i++) {
+        if (p_context->source_analyzers_pids[i] != -1) {
+            kill(p_context->source_analyzers_pids[i], SIGKILL);
+        }
+        if (p_context->destination_analyzers_pids[i] != -1) {
+            kill(p_context->destination_analyzers_pids[i], SIGKILL);
+        }
+    }
+    clean_processes(the_config, p_context);
+    the_config->is_parallel = false;
 }
 
+/*!
+ * @brief request_element_details sends a hashing job to the analyzers of a lister, without waiting
+ * @param msg_queue is the MQ id
+ * @param entry is a pointer to the entry to analyze, in the entry table of the lister
+ * @param md5sum is where the analyzer must write the digest of the job, in the entry table of the lister
+ * @param job is a pointer to the job (the whole entry, or one of its chunks)
+ * @param cfg is a pointer to the lister configuration
+ * @param current_analyzers is a pointer to the number of busy analyzers, incremented when the job is sent
+ * @return 0 if the job was sent, -1 if all analyzers are busy or if the MQ is full (responses must be read first)
+ */
+int request_element_details(int msg_queue, files_list_entry_t *entry, uint8_t *md5sum, analyze_job_t *job, lister_configuration_t *cfg,
+                            int *current_analyzers) {
+    if (*current_analyzers >= cfg->analyzers_count) {
+        return -1;
+    }
 
-void request_element_details(int msg_queue, files_list_entry_t *entry, lister_configuration_t *cfg, int *current_analyzers){
+    analyze_job_message_t message = {.job_index = job->entry_index, .chunk_index = job->chunk_index, .size = job->size,
+                                     .entry = entry, .md5sum = md5sum};
+    clock_gettime(CLOCK_MONOTONIC, &message.sent_at);
+    if (send_job_message(msg_queue, cfg->my_recipient_id, cfg->my_receiver_id, COMMAND_CODE_ANALYZE_FILE, &message, IPC_NOWAIT) == -1) {
+        return -1;
+    }
 
+    (*current_analyzers)++;
+    return 0;
 }
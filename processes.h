@@ -4,31 +4,57 @@
 #include <sys/ipc.h>
 #include <sys/types.h>
 #include "files-list.h"
+#include "scheduler.h"
+#include "placement.h"
 #include <stdbool.h>
 
+// Address space reserved for the entry table of each lister: the entries of its list, written by the lister and
+// completed by its analyzers, then read in place by the main process. Its pages are only allocated when written.
+#define ENTRY_TABLE_SIZE (16ULL * 1024 * 1024 * 1024)
+// Delay between two checks of the child processes while waiting for their lists (@see has_stopped_process)
+#define PROCESSES_POLL_DELAY_MS 10
+
 typedef struct {
     uint8_t processes_count;
     pid_t main_process_pid;
     pid_t source_lister_pid;
     pid_t destination_lister_pid;
+    pid_t previous_lister_pid; // Lister of the previous backup (@see link_dest), -1 when there is none
     pid_t *source_analyzers_pids;
     pid_t *destination_analyzers_pids;
     key_t shared_key;
     int message_queue_id;
+    void *source_entry_table; // Shared with all the processes (@see ENTRY_TABLE_SIZE)
+    void *destination_entry_table;
+    void *previous_entry_table; // NULL when there is no previous backup
+    size_t entry_table_size; // Larger when the tables are backed by temporary files (@see map_entry_table)
 } process_context_t;
 
 typedef struct {
     int my_recipient_id; // Id of analyzers' MQ topic
     int my_receiver_id; // Id of MQ topic to listen to
     int analyzers_count; // Number of analyzers available
+    int min_analyzers_count; // Number of analyzers always kept busy, the others are used when they help (@see concurrency.h)
     key_t mq_key;
+    int message_queue_id;
+    bool use_md5; // Set to true when files must be hashed by the analyzers
+    bool resume; // Set to true to reuse the MD5 sums of the checkpoint journal
+    char *checkpoint_root; // Directory of the checkpoint journal (the destination)
+    bool has_checkpoint; // Set to true when the main process writes a checkpoint journal, where digests are recorded
+    void *entry_table; // Memory where the list is built, shared with the analyzers and the main process
+    size_t entry_table_size;
+    char *digests_root; // Destination whose manifest gives the MD5 sums of the unchanged files, NULL to hash them all
+    quick_check_t quick_check;
+    unsigned int worker_index; // Place of the lister on the CPUs (@see place_worker)
 } lister_configuration_t;
 
 typedef struct {
-    int my_recipient_id; // Id of my lister
+    int my_recipient_id; // Id of my lister (responses go to the sender of each job, which may be another lister)
     int my_receiver_id; // Id I must listen to
     key_t mq_key;
+    int message_queue_id;
     bool use_md5; // Set to true when computing MD5sum for files
+    unsigned int worker_index; // Place of the analyzer on the CPUs (@see place_worker)
 } analyzer_configuration_t;
 
 typedef void (*process_loop_t)(void *);
@@ -38,4 +64,7 @@ int make_process(process_context_t *p_context, process_loop_t func, void *parame
 void lister_process_loop(void *parameters);
 void analyzer_process_loop(void *parameters);
 void clean_processes(configuration_t *the_config, process_context_t *p_context);
-void request_element_details(int msg_queue, files_list_entry_t *entry, lister_configuration_t *cfg, int *current_analyzers);
\ No newline at end of file
+bool has_stopped_process(process_context_t *p_context);
+void stop_processes(configuration_t *the_config, process_context_t *p_context);
+int request_element_details(int msg_queue, files_list_entry_t *entry, uint8_t *md5sum, analyze_job_t *job, lister_configuration_t *cfg,
+                            int *current_analyzers);
\ No newline at end of file
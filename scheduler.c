@@ -0,0 +1,56 @@
+#include "scheduler.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*!
+ * @brief compare_jobs orders jobs by decreasing size, then in list order
+ * @param lhd is a pointer to the first job
+ * @param rhd is a pointer to the second job
+ * @return the order of the jobs, like strcmp
+ */
+static int compare_jobs(const void *lhd, const void *rhd) {
+    const analyze_job_t *left = lhd;
+    const analyze_job_t *right = rhd;
+
+    if (left->size != right->size) {
+        return left->size > right->size ? -1 : 1;
+    }
+    if (left->entry_index != right->entry_index) {
+        return left->entry_index < right->entry_index ? -1 : 1;
+    }
+    return left->chunk_index < right->chunk_index ? -1 : (left->chunk_index > right->chunk_index);
+}
+
+/*!
+ * @brief schedule_jobs orders the jobs of a lister for its analyzers
+ * The largest jobs are dispatched first, so that a huge file found late does not keep a single analyzer busy
+ * while the others are idle, and each of them is followed by one of the smallest jobs: analyzers alternate long
+ * sequential reads with small files, and the small files left at the end even out the finishing times.
+ * Files digested as a tree come as several chunk jobs, which are no larger than TREE_HASH_CHUNK_SIZE.
+ * @param jobs is the array of the jobs, reordered in place
+ * @param count is the number of jobs
+ * @return 0 in case of success, -1 if memory is exhausted (jobs are then only sorted by size)
+ */
+int schedule_jobs(analyze_job_t *jobs, size_t count) {
+    if (count < 2) {
+        return 0;
+    }
+
+    qsort(jobs, count, sizeof(analyze_job_t), compare_jobs);
+
+    analyze_job_t *sorted_jobs = malloc(count * sizeof(analyze_job_t));
+    if (sorted_jobs == NULL) {
+        return -1;
+    }
+    memcpy(sorted_jobs, jobs, count * sizeof(analyze_job_t));
+
+    // Alternance entre le plus grand et le plus petit des travaux restants
+    size_t largest = 0;
+    size_t smallest = count - 1;
+    for (size_t i = 0; i < count; i++) {
+        jobs[i] = i % 2 == 0 ? sorted_jobs[largest++] : sorted_jobs[smallest--];
+    }
+
+    free(sorted_jobs);
+    return 0;
+}
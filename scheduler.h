@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A hashing job of a lister: a whole file, or a chunk of a file digested as a tree (@see TREE_HASH_THRESHOLD)
+typedef struct {
+    uint32_t entry_index; // Index of the entry in the list of the lister
+    int32_t chunk_index; // -1 for a whole file
+    uint64_t size; // Number of bytes to hash
+} analyze_job_t;
+
+int schedule_jobs(analyze_job_t *jobs, size_t count);
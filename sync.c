@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include "sync.h"
 #include <dirent.h>
 #include <string.h>
@@ -5,6 +6,17 @@
 #include "utility.h"
 #include "messages.h"
 #include "file-properties.h"
+#include "manifest.h"
+#include "hard-links.h"
+#include "dedup.h"
+#include "compression.h"
+#include "throttle.h"
+#include "checkpoint.h"
+#include "filter.h"
+#include "external-sort.h"
+#include "verify.h"
+#include "failures.h"
+#include "defines.h"
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <fcntl.h>
@@ -16,188 +28,813 @@
 #include <stdio.h>
 #include <sys/time.h>
 #include <sys/wait.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <ftw.h>
+#include <limits.h>
 
 /*!
  * @brief synchronize is the main function for synchronization
  * It will build the lists (source and destination), then make a third list with differences, and apply differences to the destination
  * It must adapt to the parallel or not operation of the program.
+ * The destination list is loaded from the destination manifest when there is one (and --verify-destination is not set),
+ * and the manifest is rewritten after each successful synchronization.
+ * An entry which cannot be synchronized does not stop the synchronization: its operation is attempted again after
+ * transient errors, then its failure is recorded and reported at the end (@see failures.h).
  * @param the_config is a pointer to the configuration
  * @param p_context is a pointer to the processes context
+ * @return SYNC_COMPLETE, SYNC_PARTIAL when some entries could not be synchronized, SYNC_FAILED when none could
  */
-//A FAIRE
-void synchronize(configuration_t *the_config, process_context_t *p_context) {
+sync_status_t synchronize(configuration_t *the_config, process_context_t *p_context) {
+    clear_failures_report();
 
     //Création des trois listes
     files_list_t *source_list = malloc(sizeof(files_list_t));
-    source_list->head = NULL;
-    source_list->tail = NULL;
+    init_files_list(source_list, the_config->source);
     files_list_t *destination_list = malloc(sizeof(files_list_t));
-    destination_list->head = NULL;
-    destination_list->tail = NULL;
-    files_list_t *differences_list = malloc(sizeof(files_list_t));
-    differences_list->head = NULL;
-    differences_list->tail = NULL;
+    init_files_list(destination_list, the_config->destination);
+    references_list_t differences_list;
+    init_references_list(&differences_list);
+    //Sauvegarde précédente, dont les fichiers inchangés sont liés plutôt que copiés (vide sans --link-dest)
+    files_list_t previous_list;
+    init_files_list(&previous_list, the_config->link_dest);
+    bool has_previous = the_config->link_dest[0] != '\0';
+
+    //Avec une limite de mémoire, les entrées des listes sont placées dans des fichiers temporaires
+    if (is_sorting_out_of_core() && (spill_files_list(source_list) == -1 || spill_files_list(destination_list) == -1
+                                     || (has_previous && spill_files_list(&previous_list) == -1))) {
+        fprintf(stderr, "Les listes des fichiers ne peuvent pas être créées, la synchronisation est annulée\n");
+        release_spilled_files_list(source_list);
+        free(source_list);
+        release_spilled_files_list(destination_list);
+        free(destination_list);
+        release_spilled_files_list(&previous_list);
+        return SYNC_FAILED;
+    }
+
+    //Le point de reprise enregistre les sommes MD5 et les copies faites, pour reprendre une synchronisation interrompue
+    if (the_config->dry_run == false) {
+        open_checkpoint(the_config);
+    }
+
+    //Le manifeste évite de parcourir (et de hacher) toute la destination
+    bool destination_from_manifest = false;
+    if (the_config->verify_destination == false && load_manifest(destination_list, the_config->destination) == 0) {
+        destination_from_manifest = true;
+        if (the_config->verbose == true) {
+            printf("Destination chargée depuis son manifeste\n");
+        }
+    }
 
+    bool previous_from_manifest = false;
+    if (has_previous && the_config->verify_destination == false && load_manifest(&previous_list, the_config->link_dest) == 0) {
+        previous_from_manifest = true;
+    }
+
+    clear_verify_report();
+
+    //Remplissage des listes
+    int listing_result = 0;
     if (the_config->is_parallel == false) {
+        //Les sommes MD5 du manifeste sont reprises pour les fichiers source inchangés depuis (@see QUICK_CHECK_CTIME)
+        if (the_config->uses_md5 && the_config->verify_destination == false) {
+            open_manifest_digests(the_config->destination, the_config->quick_check);
+        }
+        listing_result = make_files_list(source_list, the_config->source);
+        close_manifest_digests();
+        if (destination_from_manifest == false && make_files_list(destination_list, the_config->destination) == -1) {
+            listing_result = -1;
+        }
+        if (has_previous && previous_from_manifest == false && make_files_list(&previous_list, the_config->link_dest) == -1) {
+            listing_result = -1;
+        }
+    } else {
+        listing_result = make_files_lists_parallel(source_list, destination_from_manifest ? NULL : destination_list,
+                                                   has_previous && !previous_from_manifest ? &previous_list : NULL,
+                                                   the_config, p_context);
+    }
 
-        //Remplissage des listes
-        make_files_list(source_list, the_config->source);
-        make_files_list(destination_list, the_config->destination);
+    //Une liste incomplète ferait supprimer ou recopier des fichiers à tort
+    if (listing_result == -1) {
+        fprintf(stderr, "Les listes des fichiers sont incomplètes, la synchronisation est annulée\n");
+        close_checkpoint(false);
+        clear_files_list(source_list);
+        release_spilled_files_list(source_list);
+        free(source_list);
+        clear_files_list(destination_list);
+        release_spilled_files_list(destination_list);
+        free(destination_list);
+        clear_files_list(&previous_list);
+        release_spilled_files_list(&previous_list);
+        return SYNC_FAILED;
+    }
 
-	if (the_config->verbose == true) {
-		printf("Liste source :\n");
-		display_files_list(source_list);
-		printf("Liste destination :\n");
-		display_files_list(destination_list);
-	}
+    if (the_config->verbose == true) {
+        printf("Liste source :\n");
+        display_files_list(source_list);
+        printf("Liste destination :\n");
+        display_files_list(destination_list);
+    }
 
-        if (source_list == NULL) {
-            return;
+    //Une seule passe sur les deux listes triées donne les différences et les entrées en trop dans la destination
+    int failures_count = 0;
+    references_list_t extraneous_list;
+    init_references_list(&extraneous_list);
+    bool has_differences = make_differences_list(source_list, destination_list, &differences_list, &extraneous_list, the_config) == 0;
+    if (!has_differences) {
+        fprintf(stderr, "Mémoire insuffisante pour la liste des différences\n");
+        clear_references_list(&differences_list);
+        clear_references_list(&extraneous_list);
+        record_cancellation();
+        failures_count++;
+    }
+
+    //Le manifeste ne décrit plus la destination dès sa première modification : il est retiré jusqu'à sa réécriture
+    if (the_config->dry_run == false
+        && (differences_list.count > 0 || (the_config->delete_extraneous && extraneous_list.count > 0))) {
+        remove_manifest(the_config->destination);
+    }
+
+    if (the_config->verbose == true) {
+        printf("Liste des differences :\n");
+        display_references_list(&differences_list);
+        if (the_config->delete_extraneous == true) {
+            printf("Liste des suppressions :\n");
+            display_references_list(&extraneous_list);
+        }
+    }
+
+    //Les liens physiques de la source sont recréés dans la destination à partir d'un fichier déjà à jour
+    hard_links_table_t hard_links;
+    init_hard_links_table(&hard_links);
+    for (files_list_entry_t *cursor = source_list->head; cursor != NULL; cursor = cursor->next) {
+        if (cursor->entry_type == FICHIER && cursor->links_count > 1) {
+            hard_link_t *hard_link = add_hard_link(&hard_links, cursor);
+            if (hard_link != NULL && hard_link->destination_path == NULL && cursor->change_kind == CHANGE_NONE) {
+                char destination_path[PATH_SIZE];
+                if (make_destination_path(destination_path, cursor, the_config) == 0) {
+                    hard_link->destination_path = strdup(destination_path);
+                }
+            }
         }
+    }
 
-        //Création d'une variable de parcours
-        files_list_entry_t *current_source = source_list->head;
+    //Les fichiers de même contenu ne sont copiés qu'une fois, s'ils ont été hachés
+    contents_index_t contents;
+    if (make_contents_index(&contents, &differences_list, the_config->uses_md5 ? the_config->dedup : DEDUP_NONE) == -1) {
+        fprintf(stderr, "Mémoire insuffisante, les fichiers identiques seront copiés\n");
+    }
 
-        //Si la taille de la liste source est plus grande que la taille de la liste destination
-        if (destination_list == NULL) {
-            //ajout des elements dans la liste des differences
-            while (current_source != NULL) {
-                add_entry_to_tail(differences_list,current_source);
+    //Parcours de la liste des differences
+    size_t current_extraneous = the_config->delete_extraneous ? 0 : extraneous_list.count;
+    files_list_entry_t *current_previous = previous_list.head;
+    for (size_t i = 0; i < differences_list.count; i++) {
+        files_list_entry_t *current_difference = differences_list.references[i].entry;
+        //Les suppressions qui précèdent la copie dans l'ordre de l'arborescence sont faites d'abord
+        if (the_config->delete_after == false) {
+            failures_count += delete_extraneous_entries(&extraneous_list, &current_extraneous, current_difference, the_config);
+        }
 
-                current_source = current_source->next;
+        //Un changement d'attributs ne nécessite pas de recopier les données
+        if (differences_list.references[i].change_kind == CHANGE_METADATA) {
+            if (the_config->verbose == true) {
+                printf("Mise à jour des attributs de %s\n", current_difference->path_and_name);
             }
-        } else {
-            //Parcours des deux listes
-            while (current_source != NULL) {
-
-                files_list_entry_t *current_destination = destination_list->head;
-                int i = 0;
-                int j = 0;
-                while (current_destination != NULL) {
-                    //S'il y a une difference, on l'ajoute à la liste des differences
-                    if (mismatch(current_source,current_destination, the_config->uses_md5) == true) {
-                        i++;
-                    }
-                    j++;
-
-                    current_destination = current_destination->next;
+            if (the_config->dry_run == false && current_difference->entry_type == FICHIER) {
+                int result;
+                int attempt = 0;
+                do {
+                    errno = 0;
+                    result = update_entry_metadata(current_difference, the_config);
+                } while (result == -1 && retry_after_error(++attempt));
+                if (record_entry_result(current_difference->path_and_name, result, errno) == -1) {
+                    current_difference->change_kind = CHANGE_FAILED;
+                    failures_count++;
                 }
+            }
+        } else {
+            //Une erreur temporaire (disque plein, ressource occupée) ne fait échouer l'entrée qu'après plusieurs essais
+            files_list_entry_t *previous_entry = find_unchanged_previous_entry(&current_previous, current_difference, the_config);
+            int result;
+            int attempt = 0;
+            do {
+                errno = 0;
+                result = apply_content_change(current_difference, previous_entry, &hard_links, &contents, the_config);
+            } while (result == -1 && retry_after_error(++attempt));
+            if (record_entry_result(current_difference->path_and_name, result, errno) == -1) {
+                current_difference->change_kind = CHANGE_FAILED;
+                failures_count++;
+            }
+        }
+    }
+    clear_hard_links_table(&hard_links);
+    clear_contents_index(&contents);
+    failures_count += delete_extraneous_entries(&extraneous_list, &current_extraneous, NULL, the_config);
+    if (the_config->delete_extraneous == true) {
+        failures_count += delete_extraneous_directories(&extraneous_list, the_config);
+    }
 
-            	if (i == j) {
-                        add_entry_to_tail(differences_list,current_source);
-            	}
+    //Les attributs des dossiers sont appliqués en dernier, car leur contenu modifie leur mtime
+    if (the_config->dry_run == false) {
+        failures_count += update_directories_metadata(source_list, &differences_list,
+                                                      the_config->delete_extraneous ? &extraneous_list : NULL, the_config);
+    }
 
-            	current_source = current_source->next;
-            }
+    if (the_config->verify == true && the_config->dry_run == false) {
+        verify_report_t verify_report;
+        make_verify_report(&verify_report);
+        printf("Vérification : %zu copies identiques à la source, %zu refaites, %zu en échec\n",
+               verify_report.verified_count, verify_report.retried_count, verify_report.failed_count);
+    }
+
+    sync_status_t status = report_failures(the_config->verbose);
+
+    //Le manifeste est réécrit, sans les entrées en échec ; le point de reprise n'est plus utile si tout a été écrit
+    bool is_complete = false;
+    if (the_config->dry_run == false && has_differences) {
+        is_complete = write_manifest(source_list, destination_list, the_config->destination) == 0 && failures_count == 0;
+    }
+    sync_destination(the_config);
+    close_checkpoint(is_complete);
+
+    //Les entrées de chaque liste sont libérées en une fois
+    clear_references_list(&differences_list);
+    clear_references_list(&extraneous_list);
+    clear_files_list(source_list);
+    release_spilled_files_list(source_list);
+    free(source_list);
+    clear_files_list(destination_list);
+    release_spilled_files_list(destination_list);
+    free(destination_list);
+    clear_files_list(&previous_list);
+    release_spilled_files_list(&previous_list);
+    return status;
+}
+
+/*!
+ * @brief find_unchanged_previous_entry finds the file of the previous backup identical to a source file
+ * The previous list is walked along the differences, which are in the same order.
+ * @param cursor is a pointer to the current entry of the previous list, moved forward
+ * @param source_entry is the source file
+ * @param the_config is a pointer to the configuration
+ * @return the entry of the previous backup, NULL if it does not exist or if it differs from the source file
+ */
+files_list_entry_t *find_unchanged_previous_entry(files_list_entry_t **cursor, files_list_entry_t *source_entry,
+                                                  configuration_t *the_config) {
+    while (*cursor != NULL && compare_entry_keys(*cursor, source_entry) < 0) {
+        *cursor = (*cursor)->next;
+    }
+    if (*cursor == NULL || compare_entry_keys(*cursor, source_entry) != 0 || source_entry->entry_type != FICHIER
+        || mismatch(source_entry, *cursor, the_config->uses_md5, the_config->quick_check)) {
+        return NULL;
+    }
+    return *cursor;
+}
+
+/*!
+ * @brief remove_tree_entry removes an entry of a tree walked by nftw, after its content
+ * @return 0 in case of success, -1 to stop the walk
+ */
+static int remove_tree_entry(const char *path, const struct stat *stat_buffer, int type_flag, struct FTW *walk) {
+    (void) stat_buffer;
+    (void) type_flag;
+    (void) walk;
+    return remove(path);
+}
+
+/*!
+ * @brief remove_destination_tree removes a directory of the destination with all its content
+ * Symbolic links are removed, not followed.
+ * @param path is the path of the directory
+ * @return 0 in case of success, -1 else
+ */
+int remove_destination_tree(char *path) {
+    return nftw(path, remove_tree_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+/*!
+ * @brief clear_type_conflict removes the destination entry of a source entry when their types differ
+ * A directory replaced by a file is removed with its content only with --delete, an empty one is always removed.
+ * A file replaced by a directory is removed.
+ * @param source_entry is a pointer to the source entry
+ * @param the_config is a pointer to the configuration
+ * @return 0 when the destination path is free or holds an entry of the same type, -1 else
+ */
+static int clear_type_conflict(files_list_entry_t *source_entry, configuration_t *the_config) {
+    char destination_path[PATH_SIZE];
+    struct stat destination_stat;
+    if (make_destination_path(destination_path, source_entry, the_config) == -1
+        || lstat(destination_path, &destination_stat) == -1
+        || S_ISDIR(destination_stat.st_mode) == (source_entry->entry_type == DOSSIER)) {
+        return 0;
+    }
+
+    if (the_config->verbose == true) {
+        printf("Suppression de %s, remplacé par %s\n", destination_path, source_entry->path_and_name);
+    }
+    int result;
+    if (!S_ISDIR(destination_stat.st_mode)) {
+        result = unlink(destination_path);
+    } else if (the_config->delete_extraneous) {
+        result = remove_destination_tree(destination_path);
+    } else {
+        result = rmdir(destination_path);
+    }
+    if (result == -1) {
+        int error = errno;
+        fprintf(stderr, "Impossible de remplacer %s par %s : %s%s\n", destination_path, source_entry->path_and_name, strerror(error),
+                error == ENOTEMPTY || error == EEXIST ? " (--delete supprime son contenu)" : "");
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief apply_content_change writes the content of a difference to the destination
+ * A destination entry of another type is removed first (@see clear_type_conflict).
+ * The entry is made, in order of preference, as a hard link to the destination file holding its inode (for hard
+ * links of the source), as a hard link to the same file of the previous backup when it is unchanged (--link-dest),
+ * from the destination file of the first file with the same content (@see dedup.h), or by a copy. The destination
+ * file written is then recorded for the following links and duplicates.
+ * @param difference is the entry of the differences list to write
+ * @param previous_entry is the identical file of the previous backup, NULL if there is none
+ * @param hard_links is a pointer to the table of the source inodes with several links
+ * @param contents is a pointer to the index of the contents to copy
+ * @param the_config is a pointer to the configuration
+ * @return 0 in case of success, -1 else
+ */
+int apply_content_change(files_list_entry_t *difference, files_list_entry_t *previous_entry, hard_links_table_t *hard_links,
+                         contents_index_t *contents, configuration_t *the_config) {
+    hard_link_t *hard_link = NULL;
+    if (difference->entry_type == FICHIER && difference->links_count > 1) {
+        hard_link = find_hard_link(hard_links, difference->device, difference->inode);
+    }
+    content_t *content = difference->entry_type == FICHIER ? find_content(contents, difference) : NULL;
+    int result = 0;
+
+    //Un fichier qui remplace un dossier (ou l'inverse) ne peut pas être écrit par-dessus
+    if (the_config->dry_run == false && clear_type_conflict(difference, the_config) == -1) {
+        return -1;
+    }
+
+    if (difference->entry_type == FICHIER && is_copy_checkpointed(difference) && is_destination_up_to_date(difference, the_config)) {
+        //Déjà écrit par la synchronisation reprise
+        if (the_config->verbose == true) {
+            printf("%s déjà copié avant l'interruption\n", difference->path_and_name);
+        }
+    } else if (hard_link != NULL && hard_link->destination_path != NULL) {
+        //Lien vers le fichier de destination qui porte déjà le contenu de l'inode
+        if (the_config->verbose == true) {
+            printf("Lien de %s vers %s\n", difference->path_and_name, hard_link->destination_path);
+        }
+        if (the_config->dry_run == false) {
+            result = link_entry_to_destination(difference, hard_link->destination_path, the_config);
+        }
+    } else if (previous_entry != NULL) {
+        //Fichier inchangé depuis la sauvegarde précédente : les deux sauvegardes partagent son inode
+        if (the_config->verbose == true) {
+            printf("Lien de %s vers %s\n", difference->path_and_name, previous_entry->path_and_name);
+        }
+        if (the_config->dry_run == false) {
+            result = link_entry_to_destination(difference, previous_entry->path_and_name, the_config);
+        }
+    } else if (content != NULL && content->entry != difference && content->is_copied) {
+        //Le même contenu a déjà été écrit dans la destination
+        char target_path[PATH_SIZE];
+        if (make_destination_path(target_path, content->entry, the_config) == -1) {
+            return -1;
+        }
+        if (the_config->verbose == true) {
+            printf("Dédoublonnage de %s depuis %s\n", difference->path_and_name, target_path);
         }
-	
-	if (the_config->verbose == true) {
-		printf("Liste des differences :\n");
-		display_files_list(differences_list);
-	}
-
-
-        if (differences_list != NULL) {
-
-    	//Variable de parcours
-	files_list_entry_t *current_difference = differences_list->head;
-	
-
-		//Parcours de la liste des differences
-		while (current_difference != NULL) {
-		//Copie des differences
-			if (the_config->verbose == true) {
-				printf("Copie de %s\n", current_difference->path_and_name);			
-			}
-			if (the_config->dry_run == false) {
-				copy_entry_to_destination(current_difference,the_config);
-			}
-			
-		    
-		    current_difference = current_difference->next;
-		}
+        if (the_config->dry_run == false) {
+            result = the_config->dedup == DEDUP_LINK ? link_entry_to_destination(difference, target_path, the_config)
+                                                     : clone_entry_to_destination(difference, target_path, the_config);
         }
     } else {
+        //Copie des differences
+        if (the_config->verbose == true) {
+            printf("Copie de %s\n", difference->path_and_name);
+        }
+        if (the_config->dry_run == false) {
+            result = copy_entry_to_destination(difference, the_config);
+        }
+    }
 
-        make_files_lists_parallel(source_list,destination_list,the_config, p_context->message_queue_id);
+    if (result == 0) {
+        if (difference->entry_type == FICHIER && the_config->dry_run == false) {
+            checkpoint_copy(difference);
+        }
+        if (hard_link != NULL && hard_link->destination_path == NULL) {
+            char destination_path[PATH_SIZE];
+            if (make_destination_path(destination_path, difference, the_config) == 0) {
+                hard_link->destination_path = strdup(destination_path);
+            }
+        }
+        if (content != NULL && content->entry == difference) {
+            content->is_copied = true;
+        }
+    }
 
+    return result;
+}
 
-	if (the_config->verbose == true) {
-		printf("Liste source :\n");
-		display_files_list(source_list);
-		printf("Liste destination :\n");
-		display_files_list(destination_list);
-	}
+/*!
+ * @brief make_differences_list compares the source and destination lists in a single pass
+ * Both lists are ordered by their path relative to their root, so they are walked together like in a merge:
+ * an entry only in the source, or different from its destination counterpart, is a difference (with the kind of
+ * change, @see get_change_kind); an entry only in the destination is extraneous, unless the filters exclude it
+ * (@see is_path_excluded).
+ * The differences and extraneous entries are referenced, not copied: both lists must be kept until they are applied.
+ * @param source_list is a pointer to the source list
+ * @param destination_list is a pointer to the destination list
+ * @param differences_list is a pointer to the list receiving the source entries to copy, with their kind of change
+ * @param extraneous_list is a pointer to the list receiving the destination entries absent from the source
+ * @param the_config is a pointer to the configuration
+ * @return 0 in case of success, -1 else (out of memory)
+ */
+int make_differences_list(files_list_t *source_list, files_list_t *destination_list, references_list_t *differences_list,
+                          references_list_t *extraneous_list, configuration_t *the_config) {
+    files_list_entry_t *current_source = source_list->head;
+    files_list_entry_t *current_destination = destination_list->head;
+
+    while (current_source != NULL || current_destination != NULL) {
+        int order = 0;
+        if (current_source == NULL) {
+            order = 1;
+        } else if (current_destination == NULL) {
+            order = -1;
+        } else {
+            order = compare_entry_keys(current_source, current_destination);
+        }
 
-        if (source_list == NULL) {
-            return;
+        if (current_destination != NULL && order >= 0) {
+            current_destination->change_kind = CHANGE_NONE;
+        }
+        if (order < 0) {
+            current_source->change_kind = CHANGE_CONTENT;
+            if (add_reference(differences_list, current_source, CHANGE_CONTENT) == -1) {
+                return -1;
+            }
+            current_source = current_source->next;
+        } else if (order > 0) {
+            //Les entrées exclues de la synchronisation sont protégées, même si le manifeste les contient
+            if (!is_path_excluded(the_config->destination, current_destination->path_and_name + current_destination->key_offset,
+                                  current_destination->entry_type == DOSSIER)
+                && add_reference(extraneous_list, current_destination, CHANGE_DELETE) == -1) {
+                return -1;
+            }
+            current_destination = current_destination->next;
+        } else {
+            current_source->change_kind = get_change_kind(current_source, current_destination, the_config->uses_md5, the_config->quick_check);
+            if (current_source->change_kind != CHANGE_NONE
+                && add_reference(differences_list, current_source, current_source->change_kind) == -1) {
+                return -1;
+            }
+            current_source = current_source->next;
+            current_destination = current_destination->next;
         }
+    }
 
-        //Création d'une variable de parcours
-        files_list_entry_t *current_source = source_list->head;
+    return 0;
+}
 
-        //Si la taille de la liste source est plus grande que la taille de la liste destination
-        if (destination_list == NULL) {
-            //ajout des elements dans la liste des differences
-            while (current_source != NULL) {
-                add_entry_to_tail(differences_list,current_source);
+/*!
+ * @brief delete_extraneous_entries removes from the destination the extraneous entries preceding a path
+ * Consecutive entries of the same directory are removed in a batch, relative to a single descriptor of
+ * their directory (@see unlinkat). Extraneous directories are skipped, they are removed once empty.
+ * @param extraneous_list is a pointer to the list of the extraneous entries
+ * @param cursor is a pointer to the index of the current extraneous entry, advanced past the removed entries
+ * @param limit is the source entry before whose key entries are removed, NULL to remove all the remaining ones
+ * @param the_config is a pointer to the configuration
+ * @return the number of entries which could not be removed
+ */
+int delete_extraneous_entries(references_list_t *extraneous_list, size_t *cursor, files_list_entry_t *limit, configuration_t *the_config) {
+    entry_reference_t *references = extraneous_list->references;
+    int failures_count = 0;
+
+    while (*cursor < extraneous_list->count
+           && (limit == NULL || compare_entry_keys(references[*cursor].entry, limit) < 0)) {
+        //Le dossier parent est commun à toutes les entrées du lot
+        char directory_path[PATH_SIZE];
+        strcpy(directory_path, references[*cursor].entry->path_and_name);
+        char *last_separator = strrchr(directory_path, '/');
+        size_t directory_length = last_separator != NULL ? (size_t) (last_separator - directory_path) : 0;
+        directory_path[directory_length] = '\0';
+
+        int directory_fd = -1;
+        //Un dossier remplacé par un fichier a déjà été supprimé avec son contenu (@see clear_type_conflict)
+        bool is_removed = false;
+        if (the_config->dry_run == false) {
+            directory_fd = open(directory_length > 0 ? directory_path : ".", O_RDONLY | O_DIRECTORY);
+            is_removed = directory_fd == -1 && (errno == ENOENT || errno == ENOTDIR);
+            if (directory_fd == -1 && !is_removed) {
+                perror("Erreur lors de l'ouverture du dossier à nettoyer");
+            }
+        }
 
-                current_source = current_source->next;
+        do {
+            files_list_entry_t *entry = references[(*cursor)++].entry;
+            //Les dossiers ne sont vides qu'une fois leur contenu supprimé (@see delete_extraneous_directories)
+            if (entry->entry_type == DOSSIER) {
+                continue;
             }
-        } else {
-            //Parcours des deux listes
-            while (current_source != NULL) {
-
-                files_list_entry_t *current_destination = destination_list->head;
-                int i = 0;
-                int j = 0;
-                while (current_destination != NULL) {
-                    //S'il y a une difference, on l'ajoute à la liste des differences
-                    if (mismatch(current_source,current_destination, the_config->uses_md5) == true) {
-                        i++;
-                    }
-                    j++;
-
-                    current_destination = current_destination->next;
+            if (the_config->verbose == true) {
+                printf("Suppression de %s\n", entry->path_and_name);
+            }
+            if (the_config->dry_run == false) {
+                char *name = entry->path_and_name + directory_length + 1;
+                int result = is_removed ? 0 : directory_fd == -1 || unlinkat(directory_fd, name, 0) == -1 ? -1 : 0;
+                int error = result == -1 ? errno : 0;
+                if (result == -1 && error == ENOENT) {
+                    //Entrée déjà absente : la destination est dans l'état voulu
+                    result = 0;
+                }
+                if (result == -1) {
+                    errno = error;
+                    perror("Erreur lors de la suppression d'une entrée de la destination");
+                    failures_count++;
+                } else {
+                    entry->change_kind = CHANGE_DELETE;
                 }
+                record_entry_result(entry->path_and_name, result, error);
+            }
+        } while (*cursor < extraneous_list->count
+                 && (limit == NULL || compare_entry_keys(references[*cursor].entry, limit) < 0)
+                 && strncmp(references[*cursor].entry->path_and_name, directory_path, directory_length) == 0
+                 && references[*cursor].entry->path_and_name[directory_length] == '/'
+                 && strchr(references[*cursor].entry->path_and_name + directory_length + 1, '/') == NULL);
+
+        if (directory_fd != -1) {
+            close(directory_fd);
+        }
+    }
 
-            	if (i == j) {
-                	add_entry_to_tail(differences_list,current_source);
-            	}
+    return failures_count;
+}
+
+/*!
+ * @brief delete_extraneous_directories removes from the destination the extraneous directories
+ * The extraneous list is walked backwards, so that subdirectories are removed before their parent.
+ * It must be called once all the extraneous files have been removed.
+ * @param extraneous_list is a pointer to the list of the extraneous entries
+ * @param the_config is a pointer to the configuration
+ * @return the number of directories which could not be removed
+ */
+int delete_extraneous_directories(references_list_t *extraneous_list, configuration_t *the_config) {
+    int failures_count = 0;
 
-                current_source = current_source->next;
+    for (size_t i = extraneous_list->count; i > 0; i--) {
+        files_list_entry_t *cursor = extraneous_list->references[i - 1].entry;
+        if (cursor->entry_type != DOSSIER) {
+            continue;
+        }
+        if (the_config->verbose == true) {
+            printf("Suppression de %s\n", cursor->path_and_name);
+        }
+        if (the_config->dry_run == false) {
+            int result = rmdir(cursor->path_and_name);
+            int error = result == -1 ? errno : 0;
+            if (result == -1 && (error == ENOENT || error == ENOTDIR)) {
+                //Dossier déjà remplacé par un fichier de la source
+                result = 0;
+            }
+            if (result == -1) {
+                errno = error;
+                perror("Erreur lors de la suppression d'un dossier de la destination");
+                failures_count++;
+            } else {
+                cursor->change_kind = CHANGE_DELETE;
             }
+            record_entry_result(cursor->path_and_name, result, error);
         }
+    }
 
-	if (the_config->verbose == true) {
-		printf("Liste des differences :\n");
-		display_files_list(differences_list);
-	}
+    return failures_count;
+}
+
+/*!
+ * @brief add_directory_path adds a copy of a directory path to an array of paths
+ * @param directories is a pointer to the array, reallocated when needed
+ * @param count is a pointer to the number of paths in the array
+ * @param capacity is a pointer to the number of paths the array can hold
+ * @param path is the path to add
+ * @param length is the number of characters of path to copy
+ */
+static void add_directory_path(char ***directories, size_t *count, size_t *capacity, char *path, size_t length) {
+    if (*count == *capacity) {
+        size_t new_capacity = *capacity == 0 ? 64 : *capacity * 2;
+        char **new_directories = realloc(*directories, new_capacity * sizeof(char *));
+        if (new_directories == NULL) {
+            return;
+        }
+        *directories = new_directories;
+        *capacity = new_capacity;
+    }
+    char *copy = strndup(path, length);
+    if (copy != NULL) {
+        (*directories)[(*count)++] = copy;
+    }
+}
 
+/*!
+ * @brief add_parent_directory adds the path of the parent of an entry to an array of paths
+ * Nothing is added when the parent is the root, which is not an entry.
+ * @param directories is a pointer to the array, reallocated when needed
+ * @param count is a pointer to the number of paths in the array
+ * @param capacity is a pointer to the number of paths the array can hold
+ * @param relative_path is the path of the entry, relative to its root
+ */
+static void add_parent_directory(char ***directories, size_t *count, size_t *capacity, char *relative_path) {
+    char *last_separator = strrchr(relative_path, '/');
+    if (last_separator != NULL) {
+        add_directory_path(directories, count, capacity, relative_path, last_separator - relative_path);
+    }
+}
 
-        if (differences_list != NULL && the_config->dry_run == false) {
+/*!
+ * @brief compare_paths compares two paths for qsort
+ * @param lhd is a pointer to the first path
+ * @param rhd is a pointer to the second path
+ * @return the result of strcmp on the paths
+ */
+static int compare_paths(const void *lhd, const void *rhd) {
+    return strcmp(*(char * const *) lhd, *(char * const *) rhd);
+}
 
-            //Variable de parcours
-                files_list_entry_t *current_difference = differences_list->head;
-		
+/*!
+ * @brief update_directories_metadata applies the source mode and mtime to the destination directories
+ * It concerns the directories in the differences list, and the parents of the created, replaced or removed entries,
+ * whose mtime was changed by the synchronization. Both are collected, ordered, then matched against the
+ * source list in a single pass.
+ * @param source_list is a pointer to the source list
+ * @param differences_list is a pointer to the differences list (already applied)
+ * @param extraneous_list is a pointer to the list of the removed entries, NULL if none were removed
+ * @param the_config is a pointer to the configuration
+ * @return the number of directories whose metadata could not be updated
+ */
+int update_directories_metadata(files_list_t *source_list, references_list_t *differences_list, references_list_t *extraneous_list,
+                                configuration_t *the_config) {
+    char **directories = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+
+    for (size_t i = 0; i < differences_list->count; i++) {
+        files_list_entry_t *entry = differences_list->references[i].entry;
+        char *relative_path = entry->path_and_name + entry->key_offset;
+        if (entry->entry_type == DOSSIER) {
+            add_directory_path(&directories, &count, &capacity, relative_path, entry->key_length);
+        }
+        if (differences_list->references[i].change_kind == CHANGE_CONTENT) {
+            add_parent_directory(&directories, &count, &capacity, relative_path);
+        }
+    }
+    for (size_t i = 0; extraneous_list != NULL && i < extraneous_list->count; i++) {
+        files_list_entry_t *entry = extraneous_list->references[i].entry;
+        add_parent_directory(&directories, &count, &capacity, entry->path_and_name + entry->key_offset);
+    }
 
-                //Parcours de la liste des differences
-                while (current_difference != NULL) {
-                //Copie des differences
-			if (the_config->verbose == true) {
-				printf("Copie de %s\n", current_difference->path_and_name);			
-			}
-			if (the_config->dry_run == false) {
-				copy_entry_to_destination(current_difference,the_config);
-			}
-			
-                    
-                    current_difference = current_difference->next;
+    qsort(directories, count, sizeof(char *), compare_paths);
+
+    int failures_count = 0;
+    size_t index = 0;
+    files_list_entry_t *current_source = source_list->head;
+    while (current_source != NULL && index < count) {
+        int order = strcmp(current_source->path_and_name + current_source->key_offset, directories[index]);
+        if (order < 0) {
+            current_source = current_source->next;
+        } else if (order > 0) {
+            index++;
+        } else {
+            //Seul un dossier dont les attributs diffèrent est une entrée à part entière ; pour les autres, seul l'échec compte
+            if (current_source->entry_type == DOSSIER && current_source->change_kind != CHANGE_FAILED) {
+                int result = update_entry_metadata(current_source, the_config);
+                int error = errno;
+                if (current_source->change_kind == CHANGE_METADATA) {
+                    record_entry_result(current_source->path_and_name, result, error);
+                } else if (result == -1) {
+                    record_entry_failure(current_source->path_and_name, error, current_source->change_kind == CHANGE_CONTENT);
                 }
-        
+                if (result == -1) {
+                    current_source->change_kind = CHANGE_FAILED;
+                    failures_count++;
+                }
+            }
+            //Les doublons de ce dossier sont ignorés
+            while (index < count && strcmp(current_source->path_and_name + current_source->key_offset, directories[index]) == 0) {
+                index++;
+            }
+            current_source = current_source->next;
         }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        free(directories[i]);
+    }
+    free(directories);
+
+    return failures_count;
+}
+
+/*!
+ * @brief make_destination_path builds the path of a source entry in the destination
+ * @param destination_path is the buffer receiving the path (PATH_SIZE long)
+ * @param source_entry is a pointer to the source entry, whose key is appended to the destination directory
+ * @param the_config is a pointer to the configuration
+ * @return 0 in case of success, -1 if the path is too long (errno is ENAMETOOLONG)
+ */
+int make_destination_path(char *destination_path, files_list_entry_t *source_entry, configuration_t *the_config) {
+    size_t root_length = strlen(the_config->destination);
+    if (root_length + 1 + source_entry->key_length >= PATH_SIZE) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memcpy(destination_path, the_config->destination, root_length);
+    destination_path[root_length] = '/';
+    memcpy(destination_path + root_length + 1, source_entry->path_and_name + source_entry->key_offset, source_entry->key_length + 1);
+    return 0;
+}
+
+/*!
+ * @brief update_entry_metadata applies the mode and mtime of a source entry to its destination counterpart
+ * The content of the destination entry is not read nor written, unless its inode is shared with other files which
+ * must keep their attributes: it is then replaced by a clone (@see clone_entry_to_destination).
+ * @param source_entry is a pointer to the source entry
+ * @param the_config is a pointer to the configuration
+ * @return 0 in case of success, -1 else, errno being the error of the failed operation
+ */
+int update_entry_metadata(files_list_entry_t *source_entry, configuration_t *the_config) {
+    char destination_path[PATH_SIZE];
+    if (make_destination_path(destination_path, source_entry, the_config) == -1) {
+        return -1;
+    }
+
+    //Les attributs d'un dossier ne sont jamais appliqués au fichier qui porterait son nom
+    int destination_fd = open(destination_path, O_RDONLY | O_NOFOLLOW | (source_entry->entry_type == DOSSIER ? O_DIRECTORY : 0));
+    if (destination_fd == -1) {
+        int error = errno;
+        perror("Erreur lors de l'ouverture de l'entrée de destination");
+        errno = error;
+        return -1;
+    }
+
+    //Un inode partagé avec une sauvegarde précédente (--link-dest) ou un doublon (--dedup=link) n'est pas modifié :
+    //le fichier est cloné (ou recopié) avec ses nouveaux attributs, sauf pour les liens physiques de la source
+    struct stat destination_stat;
+    if (source_entry->entry_type == FICHIER && source_entry->links_count <= 1
+        && fstat(destination_fd, &destination_stat) == 0 && destination_stat.st_nlink > 1) {
+        close(destination_fd);
+        return clone_entry_to_destination(source_entry, destination_path, the_config);
+    }
+
+    struct timespec times[2];
+    times[0].tv_sec = 0;
+    times[0].tv_nsec = UTIME_OMIT;
+    times[1] = source_entry->mtime;
+
+    int result = 0;
+    int error = 0;
+    if (fchmod(destination_fd, source_entry->mode & 07777) == -1 || futimens(destination_fd, times) == -1) {
+        error = errno;
+        perror("Erreur lors de la mise à jour des attributs");
+        result = -1;
+    }
+
+    close(destination_fd);
+    errno = error;
+    return result;
+}
+
+/*!
+ * @brief is_same_mtime compares the modification dates of two entries
+ * @param lhd is a pointer to the first entry
+ * @param rhd is a pointer to the second entry
+ * @param quick_check is QUICK_CHECK_SECONDS to ignore the nanoseconds, which some file systems do not keep
+ * @return true if the dates are equal
+ */
+static bool is_same_mtime(files_list_entry_t *lhd, files_list_entry_t *rhd, quick_check_t quick_check) {
+    return lhd->mtime.tv_sec == rhd->mtime.tv_sec && (quick_check == QUICK_CHECK_SECONDS || lhd->mtime.tv_nsec == rhd->mtime.tv_nsec);
+}
 
+/*!
+ * @brief is_destination_up_to_date checks that the destination file of a source entry has its size, mtime and mode
+ * It is used to trust a copy recorded by an interrupted synchronization without reading the file.
+ * @param source_entry is a pointer to the source entry
+ * @param the_config is a pointer to the configuration
+ * @return true if the destination file matches the source entry
+ */
+bool is_destination_up_to_date(files_list_entry_t *source_entry, configuration_t *the_config) {
+    files_list_entry_t destination_entry;
+    if (make_destination_path(destination_entry.path_and_name, source_entry, the_config) == -1
+        || read_file_stats(&destination_entry) == -1 || destination_entry.entry_type != FICHIER) {
+        return false;
     }
+    read_logical_properties(&destination_entry);
+
+    return destination_entry.size == source_entry->size && is_same_mtime(&destination_entry, source_entry, the_config->quick_check)
+           && (destination_entry.mode & 07777) == (source_entry->mode & 07777);
 }
 
 /*!
@@ -205,37 +842,75 @@ void synchronize(configuration_t *the_config, process_context_t *p_context) {
  * @param lhd a files list entry from the source
  * @param rhd a files list entry from the destination
  * @has_md5 a value to enable or disable MD5 sum check
+ * @param quick_check is the precision of the comparison of the modification dates
  * @return true if both files are not equal, false else
  */
 
-bool mismatch(files_list_entry_t *lhd, files_list_entry_t *rhd, bool has_md5) {
-    // Comparaison de la taille
-    if (lhd->size != rhd->size) {
-        return true;
+bool mismatch(files_list_entry_t *lhd, files_list_entry_t *rhd, bool has_md5, quick_check_t quick_check) {
+    return get_change_kind(lhd, rhd, has_md5, quick_check) != CHANGE_NONE;
+}
+
+/*!
+ * @brief get_change_kind classifies the difference between two entries with the same name
+ * The content of a file is considered unchanged when it has the same size and MD5 sum, so that a different
+ * mtime or mode only requires a metadata update. Without MD5 sums, a different mtime means a content change.
+ * Directories only have metadata.
+ * @param lhd a files list entry from the source
+ * @param rhd a files list entry from the destination
+ * @param has_md5 a value to enable or disable MD5 sum check
+ * @param quick_check is the precision of the comparison of the modification dates (the other modes compare them to
+ * the nanosecond, their ctime and inode checks are done while listing, @see find_manifest_digest)
+ * @return CHANGE_NONE if both entries are equal, CHANGE_METADATA if only their mode or mtime differ, CHANGE_CONTENT else
+ */
+change_kind_t get_change_kind(files_list_entry_t *lhd, files_list_entry_t *rhd, bool has_md5, quick_check_t quick_check) {
+    if (lhd->entry_type != rhd->entry_type) {
+        return CHANGE_CONTENT;
     }
 
-    // Comparaison du MD5 si has_md5 est true
-    if (has_md5 && memcmp(lhd->md5sum, rhd->md5sum, sizeof(lhd->md5sum)) != 0) {
-        return true;
+    if (lhd->entry_type == FICHIER) {
+        // Comparaison de la taille
+        if (lhd->size != rhd->size) {
+            return CHANGE_CONTENT;
+        }
+
+        // Comparaison du MD5 si has_md5 est true
+        if (has_md5 && memcmp(lhd->md5sum, rhd->md5sum, sizeof(lhd->md5sum)) != 0) {
+            return CHANGE_CONTENT;
+        }
     }
 
     // Comparaison de la date de modification (mtime)
-    if (lhd->mtime.tv_sec != rhd->mtime.tv_sec) {
-        return true;
+    if (!is_same_mtime(lhd, rhd, quick_check)) {
+        return has_md5 || lhd->entry_type == DOSSIER ? CHANGE_METADATA : CHANGE_CONTENT;
     }
 
-    return false;  // Si toutes les propriétés sont identiques
+    // Comparaison des droits
+    if ((lhd->mode & 07777) != (rhd->mode & 07777)) {
+        return CHANGE_METADATA;
+    }
+
+    return CHANGE_NONE;  // Si toutes les propriétés sont identiques
 }
 
 /*!
  * @brief make_files_list buils a files list in no parallel mode
+ * Compressed files (@see compress_file_data) are listed with their original size and MD5 sum, without being hashed.
+ * So are the files hashed by an interrupted synchronization which did not change since (@see checkpoint.h), and
+ * the files unchanged since the manifest of the destination, when it is open (@see open_manifest_digests).
  * @param list is a pointer to the list that will be built
  * @param target_path is the path whose files to list
+ * @return 0 in case of success, -1 if the list is incomplete
  */
-void make_files_list(files_list_t *list, char *target_path) {
+int make_files_list(files_list_t *list, char *target_path) {
 
     //Créer la liste des path des fichiers
-    make_list(list,target_path);
+    if (make_list(list,target_path) == -1) {
+        return -1;
+    }
+
+    //Les liens physiques d'un même inode ne sont hachés qu'une fois
+    hard_links_table_t hard_links;
+    init_hard_links_table(&hard_links);
 
     //Variable de parcours
     files_list_entry_t *current = list->head;
@@ -244,237 +919,762 @@ void make_files_list(files_list_t *list, char *target_path) {
     while (current != NULL) {
         //Récupération si possible de toutes les informations du fichier
 
-        if (get_file_stats(current) == -1) {
+        if (read_file_stats(current) == -1) {
             perror("Impossible de récupérer les informations du fichier a");
+        } else if (current->entry_type == FICHIER && read_logical_properties(current) == -1 && find_checkpoint_digest(current) == -1
+                   && find_manifest_digest(current) == -1) {
+            hard_link_t *hard_link = current->links_count > 1 ? add_hard_link(&hard_links, current) : NULL;
+            if (hard_link != NULL && hard_link->entry != current) {
+                memcpy(current->md5sum, hard_link->entry->md5sum, sizeof(current->md5sum));
+            } else if (compute_file_md5(current) == -1) {
+                perror("Impossible de calculer la somme MD5 du fichier");
+            } else {
+                checkpoint_digest(current);
+            }
         }
         current = current->next;
     }
+
+    clear_hard_links_table(&hard_links);
+    return 0;
 }
 
 /*!
- * @brief make_files_lists_parallel makes both (src and dest) files list with parallel processing
+ * @brief make_files_lists_parallel makes the files lists (source, destination and previous backup) with parallel processing
+ * The entries are not copied: the lists point to the entry tables of the listers (@see ENTRY_TABLE_SIZE), which
+ * stay valid until the next listing.
  * @param src_list is a pointer to the source list to build
- * @param dst_list is a pointer to the destination list to build
+ * @param dst_list is a pointer to the destination list to build, NULL when it was loaded from the manifest
+ * @param prev_list is a pointer to the list of the previous backup to build, NULL when it is not needed
+ * The child processes are checked while waiting: when one of them has ended, the lists will never be complete, so
+ * the processes are stopped and the program continues without them (@see stop_processes).
  * @param the_config is a pointer to the program configuration
- * @param msg_queue is the id of the MQ used for communication
+ * @param p_context is a pointer to the processes context
+ * @return 0 in case of success, -1 if a list is incomplete
  */
-void make_files_lists_parallel(files_list_t *src_list, files_list_t *dst_list, configuration_t *the_config, int msg_queue) {
+int make_files_lists_parallel(files_list_t *src_list, files_list_t *dst_list, files_list_t *prev_list, configuration_t *the_config,
+                              process_context_t *p_context) {
+    int msg_queue = p_context->message_queue_id;
+    //Les listeurs parcourent leur arborescence et font hacher les fichiers par leurs analyseurs
+    int lists_count = 1;
+    send_analyze_dir_command(msg_queue, MSG_TYPE_TO_SOURCE_LISTER, the_config->source);
+    if (dst_list != NULL) {
+        send_analyze_dir_command(msg_queue, MSG_TYPE_TO_DESTINATION_LISTER, the_config->destination);
+        lists_count++;
+    }
+    if (prev_list != NULL) {
+        send_analyze_dir_command(msg_queue, MSG_TYPE_TO_PREVIOUS_LISTER, the_config->link_dest);
+        lists_count++;
+    }
 
-    int pid = fork();
+    //Chaque listeur envoie le début et la fin de sa liste, construite dans sa table des entrées
+    int result = 0;
+    any_message_t message;
+    while (lists_count > 0) {
+        if (msgrcv(msg_queue, &message, sizeof(any_message_t) - sizeof(long), MSG_TYPE_TO_MAIN, IPC_NOWAIT) == -1) {
+            if (errno == ENOMSG && has_stopped_process(p_context)) {
+                fprintf(stderr, "Un processus de listage ou d'analyse s'est arrêté, les synchronisations suivantes se feront sans parallélisme\n");
+                stop_processes(the_config, p_context);
+                return -1;
+            }
+            if (errno == ENOMSG) {
+                usleep(PROCESSES_POLL_DELAY_MS * 1000);
+                continue;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Erreur lors de la réception des listes");
+            return -1;
+        }
 
-    if (pid == -1) {
-	printf("erreur avec le fork");
+        if (message.list_complete.op_code == COMMAND_CODE_LIST_COMPLETE) {
+            int lister = message.list_complete.reply_to;
+            files_list_t *list = lister == MSG_TYPE_TO_SOURCE_LISTER ? src_list : lister == MSG_TYPE_TO_DESTINATION_LISTER ? dst_list : prev_list;
+            if (the_config->verbose == true) {
+                concurrency_report_t *report = &message.list_complete.concurrency;
+                printf("Analyseurs de la %s : %u actifs à la fin, %.1f en moyenne (entre %u et %u), débit maximal %.1f Mo/s\n",
+                       lister == MSG_TYPE_TO_SOURCE_LISTER ? "source" : lister == MSG_TYPE_TO_DESTINATION_LISTER ? "destination"
+                                                                                                     : "sauvegarde précédente",
+                       report->final_limit, report->mean_limit, report->min_limit,
+                       report->max_limit, report->best_throughput / (1024 * 1024));
+            }
+            list->head = message.list_complete.head;
+            list->tail = message.list_complete.tail;
+            if (message.list_complete.is_complete == false) {
+                result = -1;
+            }
+            lists_count--;
+        }
     }
+    return result;
+}
 
-    if (pid == 0) { //Enfant
-        make_files_list(src_list,the_config->source);
-
-        //Variable de parcours
-        files_list_entry_t *current = src_list->head;
+/*!
+ * @brief make_parent_directories creates the missing parent directories of a destination path
+ * Directories are created with default permissions, their own entries set them afterwards.
+ * @param destination_path is the path whose parents must exist
+ * @return 0 in case of success, -1 else
+ */
+int make_parent_directories(char *destination_path) {
+    char directory_path[PATH_SIZE];
+    strncpy(directory_path, destination_path, sizeof(directory_path) - 1);
+    directory_path[sizeof(directory_path) - 1] = '\0';
+
+    for (char *separator = strchr(directory_path + 1, '/'); separator != NULL; separator = strchr(separator + 1, '/')) {
+        *separator = '\0';
+        if (mkdir(directory_path, 0755) == -1 && errno != EEXIST) {
+            int error = errno;
+            fprintf(stderr, "Impossible de créer le dossier %s : %s\n", directory_path, strerror(error));
+            errno = error;
+            return -1;
+        }
+        *separator = '/';
+    }
 
-        //Parcours de la liste
-        while (current != NULL) {
-            //Récupération si possible de toutes les informations du fichier
+    return 0;
+}
 
-            if (get_file_stats(current) == -1) {
-                perror("Impossible de récupérer les informations du fichier a");
-            }
-            current = current->next;
+/*!
+ * @brief make_temporary_path builds the path of the temporary file used to replace a destination file
+ * It is in the same directory as the destination file (so that it can be renamed over it), and its name starts
+ * with RESERVED_FILES_PREFIX so that it is never listed. A name too long to be prefixed is replaced by its hash:
+ * the temporary name stays the same from one run to the next, for an interrupted copy to be resumed.
+ * @param temporary_path is the buffer receiving the path (PATH_SIZE long)
+ * @param destination_path is the path of the destination file
+ * @return 0 in case of success, -1 if the path is too long
+ */
+int make_temporary_path(char *temporary_path, char *destination_path) {
+    char *name = strrchr(destination_path, '/');
+    int directory_length = name != NULL ? name - destination_path + 1 : 0;
+    name = name != NULL ? name + 1 : destination_path;
+
+    int written;
+    if (strlen(RESERVED_FILES_PREFIX "tmp.") + strlen(name) <= NAME_MAX) {
+        written = snprintf(temporary_path, PATH_SIZE, "%.*s%stmp.%s", directory_length, destination_path, RESERVED_FILES_PREFIX, name);
+    } else {
+        //Hachage FNV-1a du nom
+        uint64_t hash = 14695981039346656037ULL;
+        for (char *cursor = name; *cursor != '\0'; cursor++) {
+            hash = (hash ^ (uint8_t) *cursor) * 1099511628211ULL;
         }
+        written = snprintf(temporary_path, PATH_SIZE, "%.*s%stmp.%016llx", directory_length, destination_path, RESERVED_FILES_PREFIX,
+                           (unsigned long long) hash);
+    }
+    if (written >= PATH_SIZE) {
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief sync_parent_directory makes the last rename in a directory durable
+ * @param destination_path is the path of the renamed file
+ */
+static void sync_parent_directory(char *destination_path) {
+    char directory_path[PATH_SIZE];
+    strncpy(directory_path, destination_path, sizeof(directory_path) - 1);
+    directory_path[sizeof(directory_path) - 1] = '\0';
+    char *last_separator = strrchr(directory_path, '/');
+    if (last_separator == NULL) {
+        strcpy(directory_path, ".");
+    } else {
+        *last_separator = '\0';
+    }
 
-    } else { //Pere
-	
-        make_files_list(dst_list,the_config->destination);
+    int directory_fd = open(directory_path, O_RDONLY | O_DIRECTORY);
+    if (directory_fd != -1) {
+        fsync(directory_fd);
+        close(directory_fd);
+    }
+}
 
-        //Variable de parcours
-        files_list_entry_t *current = dst_list->head;
+/*!
+ * @brief sync_destination flushes all the pending writes of the destination file system
+ * It is the end of synchronization step of the DURABILITY_BATCH policy, and does nothing with the other policies.
+ * @param the_config is a pointer to the configuration
+ * @return 0 in case of success, -1 else
+ */
+int sync_destination(configuration_t *the_config) {
+    if (the_config->durability != DURABILITY_BATCH || the_config->dry_run == true) {
+        return 0;
+    }
 
-        //Parcours de la liste
-        while (current != NULL) {
-            //Récupération si possible de toutes les informations du fichier
-            if (get_file_stats(current) == -1) {
-                perror("Impossible de récupérer les informations du fichier a");
-            }
-            current = current->next;
+    int destination_fd = open(the_config->destination, O_RDONLY | O_DIRECTORY);
+    if (destination_fd == -1 || syncfs(destination_fd) == -1) {
+        perror("Erreur lors de la synchronisation de la destination");
+        if (destination_fd != -1) {
+            close(destination_fd);
         }
+        return -1;
     }
 
-    wait(0);
-
+    close(destination_fd);
+    return 0;
 }
 
 /*!
- * @brief copy_entry_to_destination copies a file from the source to the destination
- * It keeps access modes and mtime (@see utimensat)
- * Pay attention to the path so that the prefixes are not repeated from the source to the destination
- * Use sendfile to copy the file, mkdir to create the directory
+ * @brief digest_data_range reads a range of a file into a digest, and writes it at the same offset in the destination
+ * It replaces sendfile when the copied data must be hashed (@see copy_entry_to_destination).
+ * @param source_fd is the descriptor of the source file
+ * @param destination_fd is the descriptor of the destination file, -1 to only digest the range
+ * @param offset is the start of the range
+ * @param end is the end of the range (excluded)
+ * @param digest is the digest of the source file, to which the range is added
+ * @return 0 in case of success, -1 else
  */
-void copy_entry_to_destination(files_list_entry_t *source_entry, configuration_t *the_config) {
-    char *source_path = source_entry->path_and_name;
-    char *destination_path = malloc(sizeof(the_config->destination)+
-                                    sizeof(source_entry->path_and_name) -
-                                    sizeof(the_config->source));
-    char *destination_path_without_name = malloc(sizeof(the_config->destination)+
-                                                 sizeof(source_entry->path_and_name) -
-                                                 sizeof(the_config->source));
+static int digest_data_range(int source_fd, int destination_fd, off_t offset, off_t end, file_digest_t *digest) {
+    static uint8_t buffer[COPY_BUFFER_SIZE];
+
+    while (offset < end) {
+        size_t wanted = end - offset < (off_t) sizeof(buffer) ? (size_t) (end - offset) : sizeof(buffer);
+        wanted = throttled_io_size(wanted);
+        throttle_io(wanted);
+        ssize_t read_bytes = pread(source_fd, buffer, wanted, offset);
+        if (read_bytes == -1) {
+            return -1;
+        }
+        if (read_bytes == 0) {
+            break; // Le fichier source a été tronqué pendant la copie
+        }
+        if (update_file_digest(digest, buffer, read_bytes) == -1) {
+            return -1;
+        }
+        for (ssize_t written = 0; destination_fd != -1 && written < read_bytes;) {
+            ssize_t written_bytes = pwrite(destination_fd, buffer + written, read_bytes - written, offset + written);
+            if (written_bytes == -1) {
+                return -1;
+            }
+            written += written_bytes;
+        }
+        offset += read_bytes;
+    }
+    return 0;
+}
 
- 
-    //Creation de la nouvelle chaine de caractere du nouveau path
+/*!
+ * @brief copy_data_range copies a range of a file with sendfile, at the same offset in the destination
+ * @param source_fd is the descriptor of the source file
+ * @param destination_fd is the descriptor of the destination file
+ * @param offset is the start of the range
+ * @param end is the end of the range (excluded)
+ * @param digest is the digest of the source file, NULL when the data is not hashed (@see digest_data_range)
+ * @return 0 in case of success, -1 else
+ */
+static int copy_data_range(int source_fd, int destination_fd, off_t offset, off_t end, file_digest_t *digest) {
+    if (digest != NULL) {
+        return digest_data_range(source_fd, destination_fd, offset, end, digest);
+    }
+    if (lseek(destination_fd, offset, SEEK_SET) == -1) {
+        return -1;
+    }
 
-    int i,j,k,l = -1;
-    for (i = 0; i < strlen(the_config->destination); i++) {
-        destination_path[i] = the_config->destination[i];
+    // sendfile peut copier moins que demandé, par exemple au-delà de 2 Gio
+    while (offset < end) {
+        size_t wanted = throttled_io_size(end - offset);
+        throttle_io(wanted);
+        ssize_t bytes_sent = sendfile(destination_fd, source_fd, &offset, wanted);
+        if (bytes_sent == -1) {
+            return -1;
+        }
+        if (bytes_sent == 0) {
+            break; // Le fichier source a été tronqué pendant la copie
+        }
     }
+    return 0;
+}
 
-    for (j = strlen(the_config->source); j < strlen(source_entry->path_and_name); j++) {
-        destination_path[i] = source_entry->path_and_name[j];
-        i++;
+/*!
+ * @brief copy_file_data copies the content of a file, or of its end, into an empty destination file
+ * For a sparse file, the data extents are found with SEEK_DATA and SEEK_HOLE and only them are copied: the
+ * skipped ranges stay holes in the destination, and ftruncate restores a hole at the end of the file.
+ * When the file system cannot report extents, the whole file is copied.
+ * @param source_fd is the descriptor of the source file
+ * @param destination_fd is the descriptor of the destination file, empty from offset
+ * @param offset is the position where the copy starts
+ * @param size is the size of the source file, or the position where the copy stops
+ * @param is_sparse is true when the source file has fewer allocated blocks than its size
+ * @param digest is the digest of the source file, NULL when the data is not hashed: the holes are read as zeros
+ * @return 0 in case of success, -1 else
+ */
+int copy_file_data(int source_fd, int destination_fd, off_t offset, off_t size, bool is_sparse, file_digest_t *digest) {
+    if (!is_sparse) {
+        return copy_data_range(source_fd, destination_fd, offset, size, digest);
     }
 
-    //Suppression du nom
+    while (offset < size) {
+        off_t data_start = lseek(source_fd, offset, SEEK_DATA);
+        if (data_start == -1) {
+            if (errno == ENXIO) {
+                break; // Plus de données : la fin du fichier est un trou
+            }
+            return copy_data_range(source_fd, destination_fd, offset, size, digest);
+        }
+        if (data_start > size) {
+            break;
+        }
 
-    strcpy(destination_path_without_name,destination_path);
+        off_t data_end = lseek(source_fd, data_start, SEEK_HOLE);
+        if (data_end == -1 || data_end > size) {
+            data_end = size;
+        }
 
-    for (k = 0; k < strlen(destination_path_without_name); k++) {
-        if (destination_path_without_name[k] == '/') {
-            l = k;
+        if ((digest != NULL && digest_data_range(source_fd, -1, offset, data_start, digest) == -1)
+            || copy_data_range(source_fd, destination_fd, data_start, data_end, digest) == -1) {
+            return -1;
         }
+        offset = data_end;
     }
 
-    if (l!=-1) {
-        destination_path_without_name[l] = '\0';
+    if (digest != NULL && offset < size && digest_data_range(source_fd, -1, offset, size, digest) == -1) {
+        return -1;
     }
+    return ftruncate(destination_fd, size);
+}
 
+/*!
+ * @brief copy_file_segments copies the content of a file, recording its progress in the checkpoint journal
+ * When durable copies are requested (a --fsync policy, or a --resume run), large files are copied by segments of
+ * CHECKPOINT_SEGMENT_SIZE: after each one the destination file is synced and its size recorded, so that an
+ * interrupted copy can be resumed from there (@see find_copy_progress). Else the file is copied in one go, and
+ * an interrupted copy starts over.
+ * @param source_entry is the source entry being copied
+ * @param source_fd is the descriptor of the source file
+ * @param destination_fd is the descriptor of the destination file, empty from offset
+ * @param offset is the position where the copy starts
+ * @param size is the size of the source file
+ * @param is_sparse is true when the source file has fewer allocated blocks than its size
+ * @param digest is the digest of the source file, NULL when the data is not hashed
+ * @param the_config is a pointer to the configuration
+ * @return 0 in case of success, -1 else
+ */
+static int copy_file_segments(files_list_entry_t *source_entry, int source_fd, int destination_fd, off_t offset, off_t size,
+                              bool is_sparse, file_digest_t *digest, configuration_t *the_config) {
+    bool is_durable = the_config->durability != DURABILITY_NONE || the_config->resume;
+    if (!is_durable || !is_checkpoint_open() || size - offset <= CHECKPOINT_SEGMENT_SIZE) {
+        return copy_file_data(source_fd, destination_fd, offset, size, is_sparse, digest);
+    }
 
-    //Creation des dossiers nécessaires
-
-    char *tempPath = calloc(strlen(destination_path_without_name)+1,sizeof(char));
+    while (offset < size) {
+        off_t end = size - offset > CHECKPOINT_SEGMENT_SIZE ? offset + CHECKPOINT_SEGMENT_SIZE : size;
+        if (copy_file_data(source_fd, destination_fd, offset, end, is_sparse, digest) == -1 || fdatasync(destination_fd) == -1) {
+            return -1;
+        }
+        checkpoint_copy_progress(source_entry, end);
+        offset = end;
+    }
 
-    int cpt = 0;
-    for (int i = 0; i < strlen(destination_path_without_name); i++) {
+    return ftruncate(destination_fd, size);
+}
 
-        tempPath[cpt] = destination_path_without_name[i];
-        tempPath[cpt+1] = '\0';
-        cpt++;
+/*!
+ * @brief fail_copy reports the failure of a copy and closes its files
+ * The temporary file is removed, unless part of it is recorded in the checkpoint journal: the copy then resumes
+ * from there (@see find_copy_progress).
+ * @param message describes the failed operation
+ * @param source_entry is the source entry being copied
+ * @param source_fd is the descriptor of the source file, -1 if it is not open
+ * @param destination_fd is the descriptor of the temporary file, -1 if it is not open
+ * @param temporary_path is the path of the temporary file, NULL if it was not created
+ * @return -1, errno being the error of the failed operation
+ */
+static int fail_copy(char *message, files_list_entry_t *source_entry, int source_fd, int destination_fd, char *temporary_path) {
+    int error = errno;
+    fprintf(stderr, "%s %s : %s\n", message, source_entry->path_and_name, error != 0 ? strerror(error) : "échec");
+    if (source_fd != -1) {
+        close(source_fd);
+    }
+    if (destination_fd != -1) {
+        close(destination_fd);
+    }
+    if (temporary_path != NULL && find_copy_progress(source_entry) == 0) {
+        unlink(temporary_path);
+    }
+    errno = error;
+    return -1;
+}
 
-        if (destination_path_without_name[i] == '/') {
+/*!
+ * @brief write_temporary_copy writes the content, mode and times of a source file to its temporary destination file
+ * With --verify, the source data is hashed as it is copied, instead of being sent with sendfile.
+ * @param source_entry is the source entry being copied
+ * @param source_stat is the state of the source file
+ * @param temporary_path is the path of the temporary file
+ * @param the_config is a pointer to the configuration
+ * @param md5sum receives the digest of the copied data with --verify
+ * @return 0 in case of success, -1 else (errno is the error, @see fail_copy)
+ */
+static int write_temporary_copy(files_list_entry_t *source_entry, struct stat *source_stat, char *temporary_path,
+                                configuration_t *the_config, uint8_t *md5sum) {
+    char *source_path = source_entry->path_and_name;
 
-            if (chdir(tempPath) != 0) {
+    // Ouvrir le fichier source en lecture
+    int source_fd = open(source_path, O_RDONLY);
+    if (source_fd == -1) {
+        return fail_copy("Erreur lors de l'ouverture du fichier source", source_entry, -1, -1, NULL);
+    }
 
-                if (mkdir(tempPath, 0755) != 0) {
-                    printf("Impossible de créer le dossier %s : \n", tempPath);
-                    return ;
-                }
+    // Une copie interrompue reprend après la dernière partie écrite sur le disque
+    off_t resume_offset = the_config->compress ? 0 : find_copy_progress(source_entry);
+    struct stat temporary_stat;
+    if (resume_offset > 0 && (stat(temporary_path, &temporary_stat) == -1 || temporary_stat.st_size < resume_offset)) {
+        resume_offset = 0;
+    }
 
-                if (chdir(tempPath) != 0) {
-                    printf("Abandon");
-                    return;
-                }
+    int destination_fd = open(temporary_path, O_WRONLY | O_CREAT | (resume_offset > 0 ? 0 : O_TRUNC), 0600);
+    if (destination_fd == -1) {
+        return fail_copy("Erreur lors de la création du fichier de destination de", source_entry, source_fd, -1, NULL);
+    }
+    if (resume_offset > 0 && ftruncate(destination_fd, resume_offset) == -1) {
+        resume_offset = 0;
+        ftruncate(destination_fd, 0);
+    }
+    if (resume_offset > 0 && the_config->verbose == true) {
+        printf("Reprise de la copie de %s à l'octet %lld\n", source_path, (long long) resume_offset);
+    }
 
+    if (the_config->compress) {
+        // Le contenu est compressé, sa taille et sa somme MD5 d'origine sont conservées dans un attribut étendu
+        uint8_t compressed_md5sum[16];
+        if (compress_file_data(source_fd, destination_fd, source_stat->st_size, the_config->compression_level, compressed_md5sum) == -1) {
+            return fail_copy("Erreur lors de la compression de", source_entry, source_fd, destination_fd, temporary_path);
+        }
+        if (write_logical_properties(destination_fd, source_stat->st_size, compressed_md5sum) == -1) {
+            perror("Erreur lors de l'enregistrement de la taille d'origine");
+        }
+        memcpy(md5sum, compressed_md5sum, sizeof(compressed_md5sum));
+    } else {
+        // Utiliser sendfile pour copier le contenu du fichier source vers le fichier de destination
+        // Seules les zones de données d'un fichier creux sont copiées
+        // Avec --verify, les données sont hachées pendant la copie (la partie déjà copiée est relue dans la source)
+        bool is_sparse = (off_t) source_stat->st_blocks * 512 < source_stat->st_size;
+        file_digest_t digest;
+        file_digest_t *copy_digest = NULL;
+        if (the_config->verify) {
+            if (init_file_digest(&digest, source_stat->st_size) == -1) {
+                errno = ENOMEM;
+                return fail_copy("Erreur lors du calcul de la somme MD5 de", source_entry, source_fd, destination_fd, temporary_path);
             }
+            copy_digest = &digest;
+        }
+        if ((copy_digest != NULL && resume_offset > 0 && digest_data_range(source_fd, -1, 0, resume_offset, copy_digest) == -1)
+            || copy_file_segments(source_entry, source_fd, destination_fd, resume_offset, source_stat->st_size, is_sparse, copy_digest,
+                                  the_config) == -1) {
+            if (copy_digest != NULL) {
+                int error = errno;
+                final_file_digest(copy_digest, md5sum);
+                errno = error;
+            }
+            return fail_copy("Erreur lors de la copie de", source_entry, source_fd, destination_fd, temporary_path);
+        }
+        if (copy_digest != NULL && final_file_digest(copy_digest, md5sum) == -1) {
+            errno = 0;
+            return fail_copy("Erreur lors du calcul de la somme MD5 de", source_entry, source_fd, destination_fd, temporary_path);
+        }
+    }
 
+    if (fchmod(destination_fd, source_stat->st_mode & 07777) == -1) {
+        perror("Erreur lors de la copie des droits");
+    }
 
-            tempPath[0] = '\0';
-
-            cpt = 0;
-        }
+    if (the_config->durability == DURABILITY_FILE && fsync(destination_fd) == -1) {
+        return fail_copy("Erreur lors de la synchronisation de la copie de", source_entry, source_fd, destination_fd, temporary_path);
+    }
 
+    // Fermer les descripteurs de fichier
+    close(source_fd);
+    if (close(destination_fd) == -1) {
+        return fail_copy("Erreur lors de l'écriture de la copie de", source_entry, -1, -1, temporary_path);
     }
 
-    if (chdir(tempPath) != 0) {
-        if (mkdir(tempPath, 0755) != 0) {
-            printf("Impossible de créer le dossier %s : \n", tempPath);
-            return ;
-        }
+    // Copier les attributs de temps du fichier source vers le fichier de destination, à la nanoseconde
+    struct timespec times[2];
+    times[0] = source_stat->st_atim;
+    times[1] = source_stat->st_mtim;
 
-        if (chdir(tempPath) != 0) {
-            printf("Abandon");
-            return;
-        }
+    if (utimensat(AT_FDCWD, temporary_path, times, 0) == -1) {
+        return fail_copy("Erreur lors de la copie des attributs de temps de", source_entry, -1, -1, temporary_path);
     }
 
+    return 0;
+}
+
+/*!
+ * @brief copy_entry_to_destination copies a file from the source to the destination
+ * It keeps access modes and mtime (@see utimensat)
+ * Pay attention to the path so that the prefixes are not repeated from the source to the destination
+ * Use sendfile to copy the file, mkdir to create the directory
+ * A file is written to a temporary file in its destination directory, which then replaces the destination file
+ * with a rename: an interrupted copy never leaves a truncated file under the destination name. With the
+ * DURABILITY_FILE policy, the data and the rename are synced before returning.
+ * With --compress, the content is written compressed and the destination file keeps its original size and MD5 sum.
+ * With --verify, the temporary file is read back from the disk before the rename, and copied again while it
+ * differs from the data read in the source, up to VERIFY_MAX_ATTEMPTS times (@see verify_written_file).
+ * Errors are reported and returned, the caller may try again (@see retry_after_error).
+ * @return 0 in case of success, -1 else, errno being the error of the failed operation (0 when the copy kept differing)
+ */
+int copy_entry_to_destination(files_list_entry_t *source_entry, configuration_t *the_config) {
+    char *source_path = source_entry->path_and_name;
+    char destination_path[PATH_SIZE];
+    if (make_destination_path(destination_path, source_entry, the_config) == -1) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    if (make_parent_directories(destination_path) == -1) {
+        return -1;
+    }
 
     // Créer la structure stat pour obtenir des informations sur le fichier source
     struct stat source_stat;
     if (stat(source_path, &source_stat) == -1) {
-        perror("Erreur lors de la récupération des informations sur le fichier source");
-        exit(EXIT_FAILURE);
+        return fail_copy("Erreur lors de la récupération des informations sur le fichier source", source_entry, -1, -1, NULL);
     }
 
-
     // Vérifier si le fichier source est un répertoire
     if (S_ISDIR(source_stat.st_mode)) {
         // Créer le répertoire de destination s'il n'existe pas
         if (mkdir(destination_path, source_stat.st_mode) == -1) {
-            perror("Erreur lors de la création du répertoire de destination");
-            exit(EXIT_FAILURE);
-        }
-    } else {
-        // Ouvrir le fichier source en lecture
-        int source_fd = open(source_path, O_RDONLY);
-        if (source_fd == -1) {
-            perror("Erreur lors de l'ouverture du fichier source");
-            exit(EXIT_FAILURE);
+            struct stat destination_stat;
+            if (errno != EEXIST) {
+                return fail_copy("Erreur lors de la création du répertoire de destination de", source_entry, -1, -1, NULL);
+            }
+            if (stat(destination_path, &destination_stat) == -1 || !S_ISDIR(destination_stat.st_mode)) {
+                errno = ENOTDIR;
+                return fail_copy("Erreur lors de la création du répertoire de destination de", source_entry, -1, -1, NULL);
+            }
         }
+        return 0;
+    }
+
+    char temporary_path[PATH_SIZE];
+    if (make_temporary_path(temporary_path, destination_path) == -1) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
 
-        //Il faut qu'on récupere le path relatif du fichier de la source pour le remplacé par "test.txt"
-        int destination_fd = open(destination_path, O_WRONLY | O_CREAT | O_TRUNC, source_stat.st_mode);
-        if (destination_fd == -1) {
-            perror("Erreur lors de la création du fichier de destination");
-            exit(EXIT_FAILURE);
+    for (int attempt = 1; ; ++attempt) {
+        uint8_t md5sum[16];
+        if (write_temporary_copy(source_entry, &source_stat, temporary_path, the_config, md5sum) == -1) {
+            return -1;
+        }
+        if (!the_config->verify || verify_written_file(temporary_path, source_stat.st_size, the_config->compress, md5sum) == 0) {
+            if (the_config->verify) {
+                record_verification(false, false);
+            }
+            break;
         }
 
-        // Utiliser sendfile pour copier le contenu du fichier source vers le fichier de destination
-        off_t offset = 0;
-        ssize_t bytes_sent = sendfile(destination_fd, source_fd, &offset, source_stat.st_size);
-        if (bytes_sent == -1) {
-            perror("Erreur lors de la copie du fichier");
-            exit(EXIT_FAILURE);
+        //La copie est refaite entièrement, la destination garde son ancienne version en cas d'échec
+        unlink(temporary_path);
+        if (attempt == VERIFY_MAX_ATTEMPTS) {
+            fprintf(stderr, "La copie de %s diffère toujours de la source après %d essais\n", source_path, attempt);
+            record_verification(false, true);
+            errno = 0;
+            return -1;
         }
+        fprintf(stderr, "La copie de %s diffère de la source, elle est refaite\n", source_path);
+        record_verification(true, false);
+    }
 
-        // Fermer les descripteurs de fichier
-        close(source_fd);
+    // Remplacement atomique du fichier de destination
+    if (renameat2(AT_FDCWD, temporary_path, AT_FDCWD, destination_path, 0) == -1) {
+        int error = errno;
+        perror("Erreur lors du remplacement du fichier de destination");
+        unlink(temporary_path);
+        errno = error;
+        return -1;
+    }
+
+    if (the_config->durability == DURABILITY_FILE) {
+        sync_parent_directory(destination_path);
+    }
+
+    return 0;
+}
+
+/*!
+ * @brief link_entry_to_destination creates a destination file as a hard link to another destination file
+ * It is used for the hard links of the source: only the first link of an inode is copied. The link is made
+ * under a temporary name then renamed, like a copy. When the link cannot be made (e.g. too many links),
+ * the entry is copied.
+ * @param source_entry is a pointer to the source entry to create
+ * @param target_path is the path of the destination file with the same inode content
+ * @param the_config is a pointer to the configuration
+ * @return 0 in case of success, -1 else
+ */
+int link_entry_to_destination(files_list_entry_t *source_entry, char *target_path, configuration_t *the_config) {
+    char destination_path[PATH_SIZE];
+    char temporary_path[PATH_SIZE];
+    if (make_destination_path(destination_path, source_entry, the_config) == -1
+        || make_temporary_path(temporary_path, destination_path) == -1 || make_parent_directories(destination_path) == -1) {
+        return -1;
+    }
+
+    unlink(temporary_path);
+    if (linkat(AT_FDCWD, target_path, AT_FDCWD, temporary_path, 0) == -1) {
+        return copy_entry_to_destination(source_entry, the_config);
+    }
+
+    if (renameat2(AT_FDCWD, temporary_path, AT_FDCWD, destination_path, 0) == -1) {
+        int error = errno;
+        perror("Erreur lors du remplacement du fichier de destination");
+        unlink(temporary_path);
+        errno = error;
+        return -1;
+    }
+    //rename ne fait rien si les deux noms désignent déjà le même inode
+    unlink(temporary_path);
+
+    if (the_config->durability == DURABILITY_FILE) {
+        sync_parent_directory(destination_path);
+    }
+
+    return 0;
+}
+
+/*!
+ * @brief clone_entry_to_destination creates a destination file as a clone of another destination file
+ * The clone shares the blocks of the target file (@see FICLONE) until one of them is modified, so no data
+ * is written. The mode and mtime of the source entry are then applied, and the clone is renamed like a copy.
+ * When the file system cannot clone files, the entry is copied.
+ * @param source_entry is a pointer to the source entry to create
+ * @param target_path is the path of the destination file with the same content
+ * @param the_config is a pointer to the configuration
+ * @return 0 in case of success, -1 else
+ */
+int clone_entry_to_destination(files_list_entry_t *source_entry, char *target_path, configuration_t *the_config) {
+    char destination_path[PATH_SIZE];
+    char temporary_path[PATH_SIZE];
+    if (make_destination_path(destination_path, source_entry, the_config) == -1
+        || make_temporary_path(temporary_path, destination_path) == -1 || make_parent_directories(destination_path) == -1) {
+        return -1;
+    }
+
+    int target_fd = open(target_path, O_RDONLY);
+    if (target_fd == -1) {
+        return copy_entry_to_destination(source_entry, the_config);
+    }
+    int destination_fd = open(temporary_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (destination_fd == -1) {
+        close(target_fd);
+        return copy_entry_to_destination(source_entry, the_config);
+    }
+
+    int cloned = ioctl(destination_fd, FICLONE, target_fd);
+    close(target_fd);
+    if (cloned == -1) {
         close(destination_fd);
+        unlink(temporary_path);
+        return copy_entry_to_destination(source_entry, the_config);
     }
 
-    // Copier les attributs de temps du fichier source vers le fichier de destination
-    struct timeval times[2];
-    times[0].tv_sec = source_stat.st_atime;
-    times[0].tv_usec = 0;
-    times[1].tv_sec = source_stat.st_mtime;
-    times[1].tv_usec = 0;
+    struct timespec times[2];
+    times[0].tv_sec = 0;
+    times[0].tv_nsec = UTIME_OMIT;
+    times[1] = source_entry->mtime;
+    if (fchmod(destination_fd, source_entry->mode & 07777) == -1 || futimens(destination_fd, times) == -1) {
+        perror("Erreur lors de la mise à jour des attributs");
+    }
+    // Les attributs étendus ne sont pas clonés avec les données
+    if (the_config->compress && write_logical_properties(destination_fd, source_entry->size, source_entry->md5sum) == -1) {
+        perror("Erreur lors de l'enregistrement de la taille d'origine");
+    }
+    if (the_config->durability == DURABILITY_FILE) {
+        fsync(destination_fd);
+    }
+    close(destination_fd);
+
+    if (renameat2(AT_FDCWD, temporary_path, AT_FDCWD, destination_path, 0) == -1) {
+        int error = errno;
+        perror("Erreur lors du remplacement du fichier de destination");
+        unlink(temporary_path);
+        errno = error;
+        return -1;
+    }
 
-    if (utimes(destination_path, times) == -1) {
-        perror("Erreur lors de la copie des attributs de temps");
-        exit(EXIT_FAILURE);
+    if (the_config->durability == DURABILITY_FILE) {
+        sync_parent_directory(destination_path);
     }
+
+    return 0;
 }
 
 /*!
- * @brief make_list lists files in a location (it recurses in directories)
- * It doesn't get files properties, only a list of paths
- * This function is used by make_files_list and make_files_list_parallel
+ * @brief list_directory adds the files and directories of a location to a list (it recurses in directories)
+ * Excluded entries are skipped before being added, and excluded directories are not opened (@see filter.h).
  * @param list is a pointer to the list that will be built
  * @param target is the target dir whose content must be listed
+ * @param sorter is a pointer to the sort of the keys when the memory is limited, NULL to add the entries to the list
+ * @return 0 in case of success, -1 if a directory could not be read or entries could not be added to the list (out of memory)
  */
-void make_list(files_list_t *list, char *target) {
+static int list_directory(files_list_t *list, char *target, entries_sorter_t *sorter) {
 
     DIR *dir = open_dir(target);
+    if (dir == NULL) {
+        fprintf(stderr, "Impossible de lister le dossier %s : %s\n", target, strerror(errno));
+        return -1;
+    }
+    int result = 0;
+    //Les règles du fichier d'exclusion du dossier s'appliquent à tout son contenu
+    bool has_ignore_file = enter_filter_directory(target, strlen(target) > list->root_length ? target + list->root_length : "");
 
     struct dirent *dent;
 
     while ((dent = get_next_entry(dir)) != NULL) {
         //Si c'est un dossier on parcours le dossier de maniere recurcive
 
-        if (dent->d_type == 4) {
-            make_list(list, concat_path("", target, dent->d_name));
-        } else if (dent->d_type == 8) { //Si c'est un fichier on l'ajoute à la liste
-            add_file_entry(list,concat_path("", target, dent->d_name));
+        char entry_path[PATH_SIZE];
+        bool is_directory = dent->d_type == 4;
+        if (!is_directory && dent->d_type != 8) {
+            continue;
+        }
+        if (concat_path(entry_path, target, dent->d_name) == NULL || is_entry_excluded(entry_path, list->root_length, is_directory)) {
+            continue;
+        }
+        //Le tri sur disque ne garde que les clés, les entrées sont créées lors de la fusion
+        if (sorter != NULL ? add_sorted_entry(sorter, entry_path + list->root_length) == -1 : append_file_entry(list, entry_path) == NULL) {
+            result = -1;
+        } else if (is_directory && list_directory(list, entry_path, sorter) == -1) {
+            result = -1;
         }
     }
 
 
+    if (has_ignore_file) {
+        leave_filter_directory();
+    }
     closedir(dir);
+    return result;
+}
+
+/*!
+ * @brief make_list lists files and directories in a location (it recurses in directories)
+ * It doesn't get files properties, only a list of paths
+ * The entries are appended as they are found, then the list is sorted once (@see sort_files_list). With a memory
+ * limit, the keys are sorted on disk instead, and the entries appended in order (@see external-sort.h).
+ * This function is used by make_files_list and make_files_list_parallel
+ * @param list is a pointer to the list that will be built
+ * @param target is the target dir whose content must be listed
+ * @return 0 in case of success, -1 if entries could not be added to the list (out of memory)
+ */
+int make_list(files_list_t *list, char *target) {
+    if (!is_sorting_out_of_core()) {
+        //Les entrées sont ajoutées dans l'ordre du parcours, puis triées une seule fois
+        int result = list_directory(list, target, NULL);
+        sort_files_list(list);
+        return result;
+    }
+
+    entries_sorter_t sorter;
+    if (init_entries_sorter(&sorter) == -1) {
+        return -1;
+    }
+    int result = list_directory(list, target, &sorter);
+    if (merge_sorted_entries(&sorter, list) == -1) {
+        result = -1;
+    }
+    clear_entries_sorter(&sorter);
+    return result;
 }
 
 /*!
@@ -490,7 +1690,7 @@ DIR *open_dir(char *path) {
  * @brief get_next_entry returns the next entry in an already opened dir
  * @param dir is a pointer to the dir (as a result of opendir, @see open_dir)
  * @return a struct dirent pointer to the next relevant entry, NULL if none found (use it to stop iterating)
- * Relevant entries are all regular files and dir, except . and ..
+ * Relevant entries are all regular files and dir, except . and .. and the files of the program (@see RESERVED_FILES_PREFIX)
  */
 struct dirent *get_next_entry(DIR *dir) {
     struct dirent *dent;
@@ -500,7 +1700,9 @@ struct dirent *get_next_entry(DIR *dir) {
         return NULL;
     }
 
-    if (strcmp(dent->d_name, ".") == 0 || strcmp(dent->d_name, "..") == 0) {
+    //Les fichiers du programme (manifeste, journal) n'appartiennent pas à l'arborescence synchronisée
+    if (strcmp(dent->d_name, ".") == 0 || strcmp(dent->d_name, "..") == 0
+        || strncmp(dent->d_name, RESERVED_FILES_PREFIX, strlen(RESERVED_FILES_PREFIX)) == 0) {
         dent = get_next_entry(dir);
     }
 
@@ -4,13 +4,42 @@
 #include "files-list.h"
 #include "configuration.h"
 #include "processes.h"
+#include "hard-links.h"
+#include "dedup.h"
+#include "file-properties.h"
+#include "failures.h"
 #include <dirent.h>
 
-void synchronize(configuration_t *the_config, process_context_t *p_context);
-void make_files_list(files_list_t *list, char *target_path);
-bool mismatch(files_list_entry_t *lhd, files_list_entry_t *rhd, bool has_md5);
-void make_files_lists_parallel(files_list_t *src_list, files_list_t *dst_list, configuration_t *the_config, int msg_queue);
-void copy_entry_to_destination(files_list_entry_t *source_entry, configuration_t *the_config);
-void make_list(files_list_t *list, char *target);
+// Buffer of the copies whose data is hashed on the way (@see copy_file_data)
+#define COPY_BUFFER_SIZE (256 * 1024)
+
+sync_status_t synchronize(configuration_t *the_config, process_context_t *p_context);
+int make_files_list(files_list_t *list, char *target_path);
+int make_differences_list(files_list_t *source_list, files_list_t *destination_list, references_list_t *differences_list,
+                          references_list_t *extraneous_list, configuration_t *the_config);
+files_list_entry_t *find_unchanged_previous_entry(files_list_entry_t **cursor, files_list_entry_t *source_entry,
+                                                  configuration_t *the_config);
+int apply_content_change(files_list_entry_t *difference, files_list_entry_t *previous_entry, hard_links_table_t *hard_links,
+                         contents_index_t *contents, configuration_t *the_config);
+int delete_extraneous_entries(references_list_t *extraneous_list, size_t *cursor, files_list_entry_t *limit, configuration_t *the_config);
+int delete_extraneous_directories(references_list_t *extraneous_list, configuration_t *the_config);
+int update_directories_metadata(files_list_t *source_list, references_list_t *differences_list, references_list_t *extraneous_list,
+                                configuration_t *the_config);
+int remove_destination_tree(char *path);
+int make_destination_path(char *destination_path, files_list_entry_t *source_entry, configuration_t *the_config);
+int update_entry_metadata(files_list_entry_t *source_entry, configuration_t *the_config);
+bool is_destination_up_to_date(files_list_entry_t *source_entry, configuration_t *the_config);
+bool mismatch(files_list_entry_t *lhd, files_list_entry_t *rhd, bool has_md5, quick_check_t quick_check);
+change_kind_t get_change_kind(files_list_entry_t *lhd, files_list_entry_t *rhd, bool has_md5, quick_check_t quick_check);
+int make_files_lists_parallel(files_list_t *src_list, files_list_t *dst_list, files_list_t *prev_list, configuration_t *the_config,
+                              process_context_t *p_context);
+int make_parent_directories(char *destination_path);
+int make_temporary_path(char *temporary_path, char *destination_path);
+int sync_destination(configuration_t *the_config);
+int copy_file_data(int source_fd, int destination_fd, off_t offset, off_t size, bool is_sparse, file_digest_t *digest);
+int copy_entry_to_destination(files_list_entry_t *source_entry, configuration_t *the_config);
+int link_entry_to_destination(files_list_entry_t *source_entry, char *target_path, configuration_t *the_config);
+int clone_entry_to_destination(files_list_entry_t *source_entry, char *target_path, configuration_t *the_config);
+int make_list(files_list_t *list, char *target);
 DIR *open_dir(char *path);
 struct dirent *get_next_entry(DIR *dir);
\ No newline at end of file
@@ -0,0 +1,52 @@
+#!/bin/sh
+# Vérifie les codes de retour : 0 si tout est synchronisé, 23 si une partie des entrées a échoué, 1 si toutes ont échoué
+# Usage : tests/exit-codes.sh [chemin de lp25-backup]
+
+program=$(realpath "${1:-./lp25-backup}")
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+failures=0
+
+# check_status <code attendu> <description> <arguments...>
+check_status() {
+    expected=$1
+    description=$2
+    shift 2
+    "$program" "$@" >"$work/output" 2>&1
+    status=$?
+    if [ "$status" -eq "$expected" ]; then
+        echo "OK    $description ($status)"
+    else
+        echo "ÉCHEC $description : $status au lieu de $expected"
+        cat "$work/output"
+        failures=$((failures + 1))
+    fi
+}
+
+# repeat <caractère> <nombre> : un nom long
+repeat() {
+    printf "%$2s" "" | tr ' ' "$1"
+}
+
+# Synchronisation complète
+mkdir -p "$work/source/dossier" "$work/complete"
+echo a >"$work/source/a"
+echo b >"$work/source/dossier/b"
+check_status 0 "synchronisation complète" --no-parallel "$work/source" "$work/complete"
+
+# Une entrée dont le chemin de destination dépasse PATH_SIZE échoue, y compris pour root :
+# la destination a une racine longue (près de 1024 caractères), la source un chemin long
+deep=""
+for i in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15; do
+    deep="$deep/$(repeat d 200)"
+done
+mkdir -p "$work/source$deep"
+echo long >"$work/source$deep/$(repeat f 200)"
+destination="$work/$(repeat x 250)/$(repeat y 250)/$(repeat z 250)/$(repeat w 200)"
+mkdir -p "$destination"
+check_status 23 "synchronisation partielle" --no-parallel "$work/source" "$destination"
+
+# Seule l'entrée en échec reste à synchroniser : aucune entrée ne l'est
+check_status 1 "aucune entrée synchronisée" --no-parallel "$work/source" "$destination"
+
+[ "$failures" -eq 0 ]
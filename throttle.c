@@ -0,0 +1,128 @@
+#define _GNU_SOURCE
+#include "throttle.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/ioprio.h>
+
+// Scheduler of the program, NULL when no limit is set
+static io_scheduler_t *io_scheduler = NULL;
+
+/*!
+ * @brief init_token_bucket sets the rate of a full bucket
+ * @param bucket is a pointer to the bucket
+ * @param rate is the number of tokens per second, 0 for no limit
+ */
+static void init_token_bucket(token_bucket_t *bucket, double rate) {
+    bucket->rate = rate;
+    bucket->capacity = rate * THROTTLE_BURST_MS / 1000;
+    if (bucket->capacity < 1) {
+        bucket->capacity = 1;
+    }
+    bucket->tokens = bucket->capacity;
+}
+
+/*!
+ * @brief take_tokens refills a bucket for the elapsed time, then takes tokens from it
+ * @param bucket is a pointer to the bucket
+ * @param elapsed is the time since the last refill, in seconds
+ * @param count is the number of tokens to take
+ * @return the time to wait before the tokens are actually available, in seconds
+ */
+static double take_tokens(token_bucket_t *bucket, double elapsed, double count) {
+    if (bucket->rate == 0) {
+        return 0;
+    }
+
+    bucket->tokens += elapsed * bucket->rate;
+    if (bucket->tokens > bucket->capacity) {
+        bucket->tokens = bucket->capacity;
+    }
+    bucket->tokens -= count;
+    return bucket->tokens < 0 ? -bucket->tokens / bucket->rate : 0;
+}
+
+/*!
+ * @brief init_io_scheduler sets the I/O limits of the program from its configuration
+ * It must be called before any process is created, so that the limits are shared by all of them.
+ * With --io-idle, the program also gets the idle I/O priority class, which children and threads inherit.
+ * @param the_config is a pointer to the configuration
+ * @return 0 in case of success, -1 else
+ */
+int init_io_scheduler(configuration_t *the_config) {
+    if (the_config->io_idle
+        && syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0)) == -1) {
+        perror("Erreur lors du passage en priorité d'entrées/sorties idle");
+    }
+
+    if (the_config->bandwidth_limit == 0 && the_config->iops_limit == 0) {
+        return 0;
+    }
+
+    io_scheduler_t *scheduler = mmap(NULL, sizeof(io_scheduler_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (scheduler == MAP_FAILED) {
+        perror("Erreur lors de la création de l'ordonnanceur d'entrées/sorties");
+        return -1;
+    }
+
+    pthread_mutexattr_t attributes;
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&scheduler->lock, &attributes);
+    pthread_mutexattr_destroy(&attributes);
+
+    clock_gettime(CLOCK_MONOTONIC, &scheduler->last_refill);
+    init_token_bucket(&scheduler->bytes, the_config->bandwidth_limit);
+    init_token_bucket(&scheduler->operations, the_config->iops_limit);
+    io_scheduler = scheduler;
+    return 0;
+}
+
+/*!
+ * @brief throttle_io waits until an I/O operation is allowed by the limits
+ * The tokens are reserved before waiting, so that concurrent callers are served in turn at the configured rate.
+ * @param bytes is the size of the operation (0 for an operation without data)
+ */
+void throttle_io(size_t bytes) {
+    if (io_scheduler == NULL) {
+        return;
+    }
+
+    struct timespec now;
+    pthread_mutex_lock(&io_scheduler->lock);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed = (now.tv_sec - io_scheduler->last_refill.tv_sec) + (now.tv_nsec - io_scheduler->last_refill.tv_nsec) / 1e9;
+    io_scheduler->last_refill = now;
+    double bytes_wait = take_tokens(&io_scheduler->bytes, elapsed, bytes);
+    double operations_wait = take_tokens(&io_scheduler->operations, elapsed, 1);
+    pthread_mutex_unlock(&io_scheduler->lock);
+
+    double wait = bytes_wait > operations_wait ? bytes_wait : operations_wait;
+    if (wait > 0) {
+        struct timespec delay;
+        delay.tv_sec = (time_t) wait;
+        delay.tv_nsec = (long) ((wait - delay.tv_sec) * 1e9);
+        while (nanosleep(&delay, &delay) == -1 && errno == EINTR);
+    }
+}
+
+/*!
+ * @brief throttled_io_size gives the size of the next read or write of a larger transfer
+ * Large transfers are split when the bandwidth is limited, so that they do not come in bursts.
+ * @param wanted is the remaining size of the transfer
+ * @return the size of the next operation
+ */
+size_t throttled_io_size(size_t wanted) {
+    if (io_scheduler == NULL || io_scheduler->bytes.rate == 0) {
+        return wanted;
+    }
+
+    size_t limit = io_scheduler->bytes.capacity < THROTTLED_IO_SIZE ? (size_t) io_scheduler->bytes.capacity : THROTTLED_IO_SIZE;
+    if (limit < 4096) {
+        limit = 4096;
+    }
+    return wanted < limit ? wanted : limit;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include "configuration.h"
+
+// Tokens accumulated while idle: at most this many milliseconds of I/O can be done at once
+#define THROTTLE_BURST_MS 50
+// Largest single read or write when the bandwidth is limited, so that the rate stays steady
+#define THROTTLED_IO_SIZE (256 * 1024)
+
+// Token bucket limiting a rate, the tokens become negative when a request exceeds them
+typedef struct {
+    double rate; // Tokens per second, 0 when unlimited
+    double capacity;
+    double tokens;
+} token_bucket_t;
+
+// Rate limits shared by the processes and threads of the program (it lives in a shared mapping)
+typedef struct {
+    pthread_mutex_t lock;
+    struct timespec last_refill;
+    token_bucket_t bytes;
+    token_bucket_t operations;
+} io_scheduler_t;
+
+int init_io_scheduler(configuration_t *the_config);
+void throttle_io(size_t bytes);
+size_t throttled_io_size(size_t wanted);
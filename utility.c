@@ -1,3 +1,4 @@
+#include "utility.h"
 #include "defines.h"
 #include <string.h>
 #include <stdio.h>
@@ -7,25 +8,39 @@
  * @brief concat_path concatenates suffix to prefix into result
  * It checks if prefix ends by / and adds this token if necessary
  * It also checks that result will fit into PATH_SIZE length
- * @param result the result of the concatenation
+ * @param result the result of the concatenation, a buffer of PATH_SIZE bytes (it may be prefix itself)
  * @param prefix the first part of the resulting path
  * @param suffix the second part of the resulting path
  * @return a pointer to the resulting path, NULL when concatenation failed
  */
 char *concat_path(char *result, char *prefix, char *suffix) {
 
-    if (strlen(prefix) + strlen(suffix) + 2 > PATH_SIZE) {
+    size_t prefix_length = strlen(prefix);
+    size_t suffix_length = strlen(suffix);
+    if (prefix_length + suffix_length + 2 > PATH_SIZE) {
         return NULL;
     }
-    result = malloc((strlen(prefix) + strlen(suffix) + 2) * sizeof (char));
 
-    strcpy(result, prefix);
-    if (prefix[strlen(prefix) - 1] != '/') {
-        strcat(result, "/");
+    memmove(result, prefix, prefix_length);
+    if (prefix_length > 0 && prefix[prefix_length - 1] != '/') {
+        result[prefix_length++] = '/';
     }
-    strcat(result, suffix);
+    memcpy(result + prefix_length, suffix, suffix_length + 1);
 
     return result;
+}
 
+/*!
+ * @brief relative_path_start gives the position of the relative part of a path built with concat_path
+ * @param root the root directory that was used as a prefix
+ * @return the offset of the first character after the root and its separator
+ */
+size_t relative_path_start(char *root) {
+    size_t length = strlen(root);
+
+    if (length > 0 && root[length - 1] != '/') {
+        length++;
+    }
 
+    return length;
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "defines.h"
+#include <stddef.h>
 
 char *concat_path(char *result, char *prefix, char *suffix);
-
+size_t relative_path_start(char *root);
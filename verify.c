@@ -0,0 +1,141 @@
+#define _GNU_SOURCE
+#include "verify.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "file-properties.h"
+#include "compression.h"
+#include "throttle.h"
+
+// Verifications of the current synchronization
+static verify_report_t verify_report;
+
+/*!
+ * @brief digest_descriptor reads a file from its start into a digest
+ * @param fd is the descriptor of the file
+ * @param size is the size of the file
+ * @param buffer is a buffer of VERIFY_BUFFER_SIZE bytes, aligned for O_DIRECT
+ * @param md5sum receives the digest of the data read
+ * @return 0 in case of success, -1 if the file could not be read
+ */
+static int digest_descriptor(int fd, uint64_t size, uint8_t *buffer, uint8_t *md5sum) {
+    file_digest_t digest;
+    if (init_file_digest(&digest, size) == -1) {
+        return -1;
+    }
+
+    int result = 0;
+    ssize_t read_bytes;
+    do {
+        throttle_io(VERIFY_BUFFER_SIZE);
+        read_bytes = read(fd, buffer, VERIFY_BUFFER_SIZE);
+        if (read_bytes == -1 && errno == EINTR) {
+            continue;
+        }
+        if (read_bytes == -1 || (read_bytes > 0 && update_file_digest(&digest, buffer, read_bytes) == -1)) {
+            result = -1;
+        }
+    } while (result == 0 && read_bytes != 0);
+
+    if (final_file_digest(&digest, md5sum) == -1) {
+        result = -1;
+    }
+    return result;
+}
+
+/*!
+ * @brief digest_written_file reads a written file back from the disk into a digest
+ * The file is synced, then its pages are dropped from the page cache, so that the data read is the one stored on
+ * the disk and not the one just written. It is read with O_DIRECT when the file system allows it.
+ * @param path is the path of the file
+ * @param size is the size of the original data
+ * @param is_compressed is true when the file is compressed (@see compress_file_data): its data is decompressed
+ * @param md5sum receives the digest of the original data
+ * @return 0 in case of success, -1 if the file could not be read
+ */
+static int digest_written_file(char *path, uint64_t size, bool is_compressed, uint8_t *md5sum) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    //Les pages modifiées ne sont libérées qu'une fois écrites
+    if (fdatasync(fd) == -1) {
+        close(fd);
+        return -1;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    if (is_compressed) {
+        return digest_compressed_file(fd, size, md5sum);
+    }
+
+    uint8_t *buffer;
+    if (posix_memalign((void **) &buffer, VERIFY_ALIGNMENT, VERIFY_BUFFER_SIZE) != 0) {
+        close(fd);
+        return -1;
+    }
+    int result = -1;
+    int direct_fd = open(path, O_RDONLY | O_DIRECT);
+    if (direct_fd != -1) {
+        result = digest_descriptor(direct_fd, size, buffer, md5sum);
+        close(direct_fd);
+    }
+    //Certains systèmes de fichiers refusent O_DIRECT à l'ouverture ou à la lecture
+    if (result == -1) {
+        result = digest_descriptor(fd, size, buffer, md5sum);
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+
+    free(buffer);
+    close(fd);
+    return result;
+}
+
+/*!
+ * @brief verify_written_file checks that a written file holds the data it was written from
+ * @param path is the path of the file
+ * @param size is the size of the original data
+ * @param is_compressed is true when the file is compressed
+ * @param md5sum is the digest of the original data, computed while it was written
+ * @return 0 if the file is identical, -1 if it differs or could not be read
+ */
+int verify_written_file(char *path, uint64_t size, bool is_compressed, uint8_t *md5sum) {
+    uint8_t written_md5sum[16];
+    if (digest_written_file(path, size, is_compressed, written_md5sum) == -1) {
+        fprintf(stderr, "Impossible de relire %s pour le vérifier\n", path);
+        return -1;
+    }
+    return memcmp(written_md5sum, md5sum, sizeof(written_md5sum)) == 0 ? 0 : -1;
+}
+
+/*!
+ * @brief record_verification accounts the verification of a copy
+ * @param is_retried is true when the copy differed and is made again
+ * @param is_failed is true when the copy differed and is abandoned
+ */
+void record_verification(bool is_retried, bool is_failed) {
+    if (is_retried) {
+        verify_report.retried_count++;
+    } else if (is_failed) {
+        verify_report.failed_count++;
+    } else {
+        verify_report.verified_count++;
+    }
+}
+
+/*!
+ * @brief make_verify_report gives the outcome of the verifications since the last clear_verify_report
+ * @param report receives the counts
+ */
+void make_verify_report(verify_report_t *report) {
+    *report = verify_report;
+}
+
+/*!
+ * @brief clear_verify_report resets the counts, at the start of a synchronization
+ */
+void clear_verify_report() {
+    memset(&verify_report, 0, sizeof(verify_report));
+}
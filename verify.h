@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Size of the reads of a written file, a multiple of the alignment required by O_DIRECT
+#define VERIFY_BUFFER_SIZE (1024 * 1024)
+#define VERIFY_ALIGNMENT 4096
+// Copies of a file made before giving up when the destination keeps differing from the source
+#define VERIFY_MAX_ATTEMPTS 3
+
+// Outcome of the verification of the copies of a synchronization
+typedef struct {
+    size_t verified_count; // Copies read back identical to the source
+    size_t retried_count; // Copies made again after a mismatch
+    size_t failed_count; // Files still different after VERIFY_MAX_ATTEMPTS copies
+} verify_report_t;
+
+int verify_written_file(char *path, uint64_t size, bool is_compressed, uint8_t *md5sum);
+void record_verification(bool is_retried, bool is_failed);
+void make_verify_report(verify_report_t *report);
+void clear_verify_report();
@@ -0,0 +1,413 @@
+#include "watch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include "sync.h"
+#include "manifest.h"
+#include "file-properties.h"
+#include "filter.h"
+
+// IN_MODIFY catches the writes to files which stay open (logs, mapped files), IN_CLOSE_WRITE the others
+#define WATCH_EVENTS_MASK (IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_ATTRIB)
+
+typedef struct {
+    int inotify_fd;
+    int journal_fd;
+    char **watched_paths; // Relative path of each watched directory, indexed by its watch descriptor
+    int watched_capacity;
+    configuration_t *the_config;
+} watch_context_t;
+
+static volatile sig_atomic_t watch_stop_requested = 0;
+
+/*!
+ * @brief stop_watching is the handler of the termination signals in watch mode
+ * @param signal_number is the received signal (unused)
+ */
+static void stop_watching(int signal_number) {
+    watch_stop_requested = 1;
+}
+
+/*!
+ * @brief open_journal opens the journal of changed paths, at the root of the destination
+ * @param the_config is a pointer to the configuration
+ * @return the journal file descriptor, -1 in case of error
+ */
+static int open_journal(configuration_t *the_config) {
+    char journal_path[PATH_SIZE];
+    if (snprintf(journal_path, sizeof(journal_path), "%s/%s", the_config->destination, JOURNAL_FILE_NAME) >= PATH_SIZE) {
+        return -1;
+    }
+
+    int journal_fd = open(journal_path, O_RDWR | O_CREAT | O_APPEND, 0600);
+    if (journal_fd == -1) {
+        perror("Erreur lors de l'ouverture du journal");
+    }
+    return journal_fd;
+}
+
+/*!
+ * @brief journal_path appends a path relative to the source to the journal
+ * Writes are not synced here, the caller syncs the journal once per batch of events.
+ * @param context is a pointer to the watch context
+ * @param relative_path is the path of the changed entry, relative to the source
+ * @return 0 in case of success, -1 else
+ */
+static int journal_path(watch_context_t *context, char *relative_path) {
+    char line[PATH_SIZE + 1];
+    int length = snprintf(line, sizeof(line), "%s\n", relative_path);
+    if (length >= (int) sizeof(line)) {
+        return -1;
+    }
+
+    if (write(context->journal_fd, line, length) != length) {
+        perror("Erreur lors de l'écriture dans le journal");
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief add_watches watches a directory of the source and all its subdirectories
+ * @param context is a pointer to the watch context
+ * @param relative_path is the path of the directory relative to the source ("" for the source itself)
+ * @param journal_files is true when the files found must be journaled (for a directory created while watching)
+ * @return 0 in case of success, -1 else
+ */
+static int add_watches(watch_context_t *context, char *relative_path, bool journal_files) {
+    char full_path[PATH_SIZE];
+    if (snprintf(full_path, sizeof(full_path), "%s/%s", context->the_config->source, relative_path) >= PATH_SIZE) {
+        return -1;
+    }
+
+    int wd = inotify_add_watch(context->inotify_fd, full_path, WATCH_EVENTS_MASK | IN_ONLYDIR);
+    if (wd == -1) {
+        perror("Erreur lors de l'ajout d'une surveillance");
+        return -1;
+    }
+
+    if (wd >= context->watched_capacity) {
+        int new_capacity = context->watched_capacity == 0 ? 64 : context->watched_capacity;
+        while (new_capacity <= wd) {
+            new_capacity *= 2;
+        }
+        char **watched_paths = realloc(context->watched_paths, new_capacity * sizeof(char *));
+        if (watched_paths == NULL) {
+            return -1;
+        }
+        memset(watched_paths + context->watched_capacity, 0, (new_capacity - context->watched_capacity) * sizeof(char *));
+        context->watched_paths = watched_paths;
+        context->watched_capacity = new_capacity;
+    }
+    free(context->watched_paths[wd]);
+    context->watched_paths[wd] = strdup(relative_path);
+
+    DIR *dir = open_dir(full_path);
+    if (dir == NULL) {
+        return -1;
+    }
+
+    struct dirent *dent;
+    char child_path[PATH_SIZE];
+    while ((dent = get_next_entry(dir)) != NULL) {
+        if (snprintf(child_path, sizeof(child_path), "%s%s%s", relative_path, relative_path[0] ? "/" : "", dent->d_name) >= PATH_SIZE) {
+            continue;
+        }
+        if (dent->d_type == DT_DIR) {
+            add_watches(context, child_path, journal_files);
+        } else if (dent->d_type == DT_REG && journal_files) {
+            journal_path(context, child_path);
+        }
+    }
+
+    closedir(dir);
+    return 0;
+}
+
+/*!
+ * @brief read_events reads the pending inotify events and journals the paths they designate
+ * A directory removed or moved away is journaled like a file, to be removed with --delete; a directory created
+ * or moved in is watched, and its files journaled. The consecutive events of a path are journaled once.
+ * @param context is a pointer to the watch context
+ * @return 0 in case of success, 1 when events were lost (a full reconcile is required), -1 in case of error
+ */
+static int read_events(watch_context_t *context) {
+    char buffer[16 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int result = 0;
+
+    ssize_t length = read(context->inotify_fd, buffer, sizeof(buffer));
+    if (length == -1) {
+        return errno == EINTR || errno == EAGAIN ? 0 : -1;
+    }
+
+    char relative_path[PATH_SIZE];
+    char last_path[PATH_SIZE] = "";
+    for (char *cursor = buffer; cursor < buffer + length; cursor += sizeof(struct inotify_event) + ((struct inotify_event *) cursor)->len) {
+        struct inotify_event *event = (struct inotify_event *) cursor;
+
+        if (event->mask & IN_Q_OVERFLOW) {
+            result = 1;
+            continue;
+        }
+        if (event->mask & IN_IGNORED) {
+            free(context->watched_paths[event->wd]);
+            context->watched_paths[event->wd] = NULL;
+            continue;
+        }
+        if (event->len == 0 || event->wd >= context->watched_capacity || context->watched_paths[event->wd] == NULL
+            || strncmp(event->name, RESERVED_FILES_PREFIX, strlen(RESERVED_FILES_PREFIX)) == 0) {
+            continue;
+        }
+
+        char *parent = context->watched_paths[event->wd];
+        if (snprintf(relative_path, sizeof(relative_path), "%s%s%s", parent, parent[0] ? "/" : "", event->name) >= PATH_SIZE) {
+            continue;
+        }
+
+        if (event->mask & IN_ISDIR) {
+            // Un nouveau dossier doit être surveillé, et son contenu (déjà présent) journalisé
+            if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                add_watches(context, relative_path, true);
+            } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                journal_path(context, relative_path);
+            }
+        } else if (!(event->mask & IN_CREATE) && strcmp(relative_path, last_path) != 0) {
+            // La création d'un fichier sera suivie de sa fermeture en écriture
+            journal_path(context, relative_path);
+            strcpy(last_path, relative_path);
+        }
+    }
+
+    if (fdatasync(context->journal_fd) == -1) {
+        perror("Erreur lors de la synchronisation du journal");
+        return -1;
+    }
+    return result;
+}
+
+/*!
+ * @brief compare_journal_lines compares two journal lines for qsort
+ * @param lhd is a pointer to the first line
+ * @param rhd is a pointer to the second line
+ * @return the result of strcmp on the lines
+ */
+static int compare_journal_lines(const void *lhd, const void *rhd) {
+    return strcmp(*(char * const *) lhd, *(char * const *) rhd);
+}
+
+/*!
+ * @brief process_journal copies to the destination the source entries recorded in the journal
+ * Each path is processed once, with the same copy as a full synchronization. The files are only stated, their
+ * MD5 sum is not computed. Paths which do not exist anymore in the source (files, or directories with their
+ * content) are removed from the destination with --delete, and ignored else. The journal is emptied only when
+ * all the copies succeeded.
+ * @param the_config is a pointer to the configuration
+ * @return the number of entries copied or removed, -1 in case of error
+ */
+int process_journal(configuration_t *the_config) {
+    int journal_fd = open_journal(the_config);
+    if (journal_fd == -1) {
+        return -1;
+    }
+
+    struct stat journal_stat;
+    if (fstat(journal_fd, &journal_stat) == -1 || journal_stat.st_size == 0) {
+        close(journal_fd);
+        return 0;
+    }
+
+    char *content = malloc(journal_stat.st_size + 1);
+    if (content == NULL || pread(journal_fd, content, journal_stat.st_size, 0) != journal_stat.st_size) {
+        perror("Erreur lors de la lecture du journal");
+        free(content);
+        close(journal_fd);
+        return -1;
+    }
+    content[journal_stat.st_size] = '\0';
+
+    // Découpage en lignes, puis tri pour ne traiter chaque chemin qu'une fois
+    size_t lines_count = 0;
+    for (off_t i = 0; i < journal_stat.st_size; i++) {
+        if (content[i] == '\n') {
+            lines_count++;
+        }
+    }
+    char **lines = malloc((lines_count + 1) * sizeof(char *));
+    size_t line_index = 0;
+    for (char *line = strtok(content, "\n"); line != NULL && lines != NULL; line = strtok(NULL, "\n")) {
+        lines[line_index++] = line;
+    }
+    if (lines != NULL) {
+        qsort(lines, line_index, sizeof(char *), compare_journal_lines);
+    }
+
+    int copied_count = 0;
+    int failures_count = lines == NULL ? 1 : 0;
+    files_list_entry_t entry;
+    for (size_t i = 0; lines != NULL && i < line_index; i++) {
+        if (i > 0 && strcmp(lines[i], lines[i - 1]) == 0) {
+            continue;
+        }
+
+        if (snprintf(entry.path_and_name, sizeof(entry.path_and_name), "%s/%s", the_config->source, lines[i]) >= PATH_SIZE) {
+            continue;
+        }
+        memset(&entry, 0, offsetof(files_list_entry_t, path_and_name));
+        set_entry_key(&entry, strlen(the_config->source) + 1);
+
+        struct stat entry_stat;
+        if (stat(entry.path_and_name, &entry_stat) == -1) {
+            //Un fichier supprimé de la source l'est aussi de la destination avec --delete
+            if (errno == ENOENT && the_config->delete_extraneous == true) {
+                char destination_path[PATH_SIZE];
+                snprintf(destination_path, sizeof(destination_path), "%s/%s", the_config->destination, lines[i]);
+                if (the_config->verbose == true) {
+                    printf("Suppression de %s\n", destination_path);
+                }
+                struct stat destination_stat;
+                if (the_config->dry_run == false && lstat(destination_path, &destination_stat) == 0
+                    && (S_ISDIR(destination_stat.st_mode) ? remove_destination_tree(destination_path) : unlink(destination_path)) == 0) {
+                    copied_count++;
+                }
+            }
+            continue;
+        }
+        if (!S_ISREG(entry_stat.st_mode) || is_path_excluded(the_config->source, lines[i], false)) {
+            continue;
+        }
+
+        if (the_config->verbose == true) {
+            printf("Copie de %s\n", entry.path_and_name);
+        }
+        if (the_config->dry_run == true) {
+            continue;
+        }
+        int result = read_file_stats(&entry);
+        int attempt = 0;
+        while (result == 0) {
+            errno = 0;
+            result = copy_entry_to_destination(&entry, the_config);
+            if (result == 0 || !retry_after_error(++attempt)) {
+                break;
+            }
+        }
+        if (result == -1) {
+            failures_count++;
+        } else {
+            copied_count++;
+        }
+    }
+
+    // La destination a changé sans que le manifeste soit réécrit
+    if (copied_count > 0) {
+        remove_manifest(the_config->destination);
+        sync_destination(the_config);
+    }
+
+    if (failures_count == 0 && the_config->dry_run == false) {
+        if (ftruncate(journal_fd, 0) == -1 || fdatasync(journal_fd) == -1) {
+            perror("Erreur lors de la remise à zéro du journal");
+        }
+    }
+
+    free(lines);
+    free(content);
+    close(journal_fd);
+    return failures_count == 0 ? copied_count : -1;
+}
+
+/*!
+ * @brief watch_source runs the program as a daemon that keeps the destination up to date
+ * The source tree is watched with inotify, and the changed paths are recorded in a journal stored in the
+ * destination. Once no event has been received for WATCH_QUIET_DELAY_MS, the journaled paths are copied.
+ * A full synchronization is run at startup, then every reconcile_interval seconds, and whenever the kernel
+ * reports that events were lost. The function returns when SIGINT or SIGTERM is received.
+ * @param the_config is a pointer to the configuration
+ * @param p_context is a pointer to the processes context
+ * @return 0 when the daemon was stopped by a signal, -1 in case of error
+ */
+int watch_source(configuration_t *the_config, process_context_t *p_context) {
+    watch_context_t context;
+    memset(&context, 0, sizeof(context));
+    context.the_config = the_config;
+
+    struct sigaction stop_action;
+    memset(&stop_action, 0, sizeof(stop_action));
+    stop_action.sa_handler = stop_watching;
+    sigaction(SIGINT, &stop_action, NULL);
+    sigaction(SIGTERM, &stop_action, NULL);
+
+    // Reprise d'un journal laissé par une exécution précédente
+    if (process_journal(the_config) == -1) {
+        fprintf(stderr, "Le journal n'a pas pu être traité entièrement\n");
+    }
+
+    context.journal_fd = open_journal(the_config);
+    context.inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (context.journal_fd == -1 || context.inotify_fd == -1) {
+        perror("Erreur lors de l'initialisation de la surveillance");
+        return -1;
+    }
+
+    // La surveillance commence avant la réconciliation pour ne perdre aucun changement
+    if (add_watches(&context, "", false) == -1) {
+        close(context.inotify_fd);
+        close(context.journal_fd);
+        return -1;
+    }
+
+    bool reconcile_needed = true;
+    bool journal_pending = false;
+    time_t last_reconcile = 0;
+    struct pollfd inotify_poll = {.fd = context.inotify_fd, .events = POLLIN};
+
+    while (!watch_stop_requested) {
+        if (reconcile_needed || time(NULL) - last_reconcile >= the_config->reconcile_interval) {
+            if (the_config->verbose == true) {
+                printf("Réconciliation complète de %s\n", the_config->destination);
+            }
+            synchronize(the_config, p_context);
+            last_reconcile = time(NULL);
+            reconcile_needed = false;
+        }
+
+        //L'attente est bornée à INT_MAX ms (environ 24 jours) : une boucle de plus relance simplement l'attente
+        long long timeout = journal_pending ? WATCH_QUIET_DELAY_MS
+                            : (last_reconcile + (long long) the_config->reconcile_interval - time(NULL)) * 1000;
+        int ready = poll(&inotify_poll, 1, timeout > INT_MAX ? INT_MAX : timeout > 0 ? (int) timeout : 0);
+        if (ready == -1 && errno != EINTR) {
+            perror("Erreur lors de l'attente des événements");
+            break;
+        }
+
+        if (ready > 0) {
+            int events_result = read_events(&context);
+            if (events_result == -1) {
+                break;
+            }
+            reconcile_needed = events_result == 1;
+            journal_pending = true;
+        } else if (ready == 0 && journal_pending) {
+            process_journal(the_config);
+            journal_pending = false;
+        }
+    }
+
+    for (int i = 0; i < context.watched_capacity; i++) {
+        free(context.watched_paths[i]);
+    }
+    free(context.watched_paths);
+    close(context.inotify_fd);
+    close(context.journal_fd);
+
+    return watch_stop_requested ? 0 : -1;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "configuration.h"
+#include "processes.h"
+#include "defines.h"
+
+#define JOURNAL_FILE_NAME RESERVED_FILES_PREFIX "journal"
+#define WATCH_QUIET_DELAY_MS 1000
+
+int watch_source(configuration_t *the_config, process_context_t *p_context);
+int process_journal(configuration_t *the_config);